@@ -16,6 +16,11 @@
 #ifndef PROJECT_2_15_441_INC_BACKEND_H_
 #define PROJECT_2_15_441_INC_BACKEND_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cmu_tcp.h"
+
 /**
  * Launches the CMU-TCP backend.
  *
@@ -23,4 +28,17 @@
  */
 void* begin_backend(void* in);
 
+/**
+ * Whether the receive window grew enough to tell the other side at once :
+ * advertising 'room' bytes at ACK number 'ack' moves the right edge of the
+ * window by at least 2 MSS, or half the receive buffer if that is less but
+ * never under a full segment (receiver-side silly window syndrome avoidance,
+ * RFC 9293 3.8.6.2.2). A move already advertised is not due again.
+ *
+ * @param sock The socket.
+ * @param ack The next byte expected.
+ * @param room The free space in the receive buffer.
+ */
+bool window_update_due(cmu_socket_t* sock, uint32_t ack, uint32_t room);
+
 #endif  // PROJECT_2_15_441_INC_BACKEND_H_
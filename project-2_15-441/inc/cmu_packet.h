@@ -41,6 +41,15 @@ typedef struct {
 // data for all packets, as this reduces the payload and thus the MSS.
 #define MSS (MAX_LEN - sizeof(cmu_tcp_header_t))
 
+// MSS is what every path is assumed to carry. Segments grow past it, up to
+// MAX_MSS, as far as both ends accept and path MTU discovery finds the path
+// carries them (see pmtu.h); MAX_DATAGRAM_LEN, the largest UDP payload over
+// IPv4, is what a packet may take, and what receivers make room for. Options
+// every segment carries (timestamps, once negotiated) come out of the segment
+// size, not on top of it (see update_mss()).
+#define MAX_DATAGRAM_LEN 65507
+#define MAX_MSS (MAX_DATAGRAM_LEN - sizeof(cmu_tcp_header_t))
+
 /* Helper functions to get/set fields in the header */
 
 uint16_t get_src(cmu_tcp_header_t* header);
@@ -131,13 +140,21 @@ void set_payload(uint8_t* pkt, uint8_t* payload, uint16_t payload_len);
  * @param payload The payload.
  * @param payload_len The length of the payload.
  *
- * @return A pointer to the newly allocated packet. User must `free` after use.
+ * @return A pointer to the newly allocated packet, taken from the packet pool
+ *         (see packet_pool.h). User must `free_packet` after use.
  */
 uint8_t* create_packet(uint16_t src, uint16_t dst, uint32_t seq, uint32_t ack,
                        uint16_t hlen, uint16_t plen, uint8_t flags,
                        uint16_t adv_window, uint16_t ext_len, uint8_t* ext_data,
                        uint8_t* payload, uint16_t payload_len);
 
+/**
+ * Releases a packet returned by `create_packet`.
+ *
+ * @param pkt The packet to release.
+ */
+void free_packet(uint8_t* pkt);
+
 /**
  * Checks if a given sequence number comes before another sequence number.
  *
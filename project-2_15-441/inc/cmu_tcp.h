@@ -16,12 +16,20 @@
 
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include "cmu_packet.h"
+#include "congestion.h"
+#include "extension.h"
+#include "fastopen.h"
 #include "grading.h"
+#include "io_engine.h"
+#include "pacer.h"
+#include "pmtu.h"
+#include "rto.h"
 
 #include "send_buffer.h"
 #include "recv_buffer.h"
@@ -30,12 +38,99 @@
 #define EXIT_ERROR -1
 #define EXIT_FAILURE 1
 
+// delayed ACKs (RFC 9293 3.8.6.3) : by default every second data segment is acknowledged
+// at once, and a lone one within DELACK_DEFAULT_US. the first DELACK_QUICK_ACKS segments
+// of a connection are acknowledged right away, not to hold back slow start
+#define ACK_FREQUENCY_DEFAULT 2
+#define DELACK_DEFAULT_US 40000
+#define DELACK_QUICK_ACKS 16
+
+// bytes of the receive and send buffers, unless CMU_SO_RCVBUF and CMU_SO_SNDBUF set them; the
+// window scale offered lets the other end fill the largest one
+#define DEFAULT_BUFF_SIZE 1024
+#define MAX_BUFF_SIZE (1u << 30)
+
 typedef struct {
   uint32_t next_seq_expected;           // same as ACK send to the other party
   uint32_t last_ack_received;           // next sequence number that I should send
-  uint16_t rcvd_advertised_window;
+  uint32_t rcvd_advertised_window;      // in bytes, scaled
+  uint32_t max_rcvd_window;             // the largest the other side advertised
+  uint32_t adv_window_sent;             // receive window advertised in the last packet sent, in bytes
+  uint32_t dup_acks;                    // duplicate ACKs received in a row
+  uint32_t high_seq_sent;               // highest sequence number ever sent
+  bool in_recovery;                     // in fast recovery after a fast retransmit
+  uint32_t recover_seq;                 // high_seq_sent when fast recovery started
+  bool ts_ok;                           // timestamps offered, then agreed on by both ends
+  uint32_t ts_recent;                   // peer's TSval to echo in TSecr
+  bool sack_ok;                         // SACK offered, then agreed on by both ends
+  bool wscale_ok;                       // window scaling offered, then agreed on by both ends
+  uint8_t snd_wscale;                   // shift of the windows the other side advertises
+  uint8_t rcv_wscale;                   // shift of the windows this end advertises
+  bool in_loss;                         // resending what a timeout found lost (SACK), until
+                                        // recover_seq is acknowledged
+  uint64_t rack_deadline_us;            // when RACK's reordering window runs out for a segment
+                                        // in flight; 0 if none is waiting
+  uint64_t tlp_deadline_us;             // when to send a tail loss probe; 0 if none is armed
+  bool tlp_in_flight;                   // a probe went out and tlp_end_seq is not acknowledged
+  bool tlp_retransmit;                  // ... and it sent old data again
+  uint32_t tlp_end_seq;                 // high_seq_sent when the probe went out
+  uint32_t last_ack_sent;               // ACK number of the last packet sent
+  uint32_t segs_unacked;                // data segments received since then
+  uint64_t delack_deadline_us;          // when the ACK held back for them is due; 0 if none is
+  uint32_t small_end_seq;               // the byte after the last new segment shorter than MSS
+  uint32_t small_held;                  // fresh bytes held back by Nagle the last time it grew
+  uint32_t small_holds;                 // times it grew since data last went out
+  uint64_t persist_deadline_us;         // when the next window probe goes out; 0 unless the
+                                        // other side's window is closed
+  uint32_t persist_backoff;             // probes sent since it closed
+  uint32_t mss;                         // payload of a full segment (see update_mss())
+  uint32_t mss_offer;                   // the largest this end accepts, offered in its SYN;
+                                        // 0 sends no MSS option
+  uint16_t probe_ack;                   // size of a PMTU probe to acknowledge in the next
+                                        // packet sent; 0 if none
+  bool fastopen_ok;                     // fast open on at this end (see fastopen.h)
+  uint8_t fastopen_len;                 // of the cookie in fastopen_cookie, 0 if none : the
+                                        // client's SYN carries it (or asks for one), and the
+                                        // server's SYN-ACK gives it
+  uint8_t fastopen_cookie[EXT_FASTOPEN_MAX_COOKIE];
+  bool ack_now;                         // an ACK is owed now : it goes out with the data sent in
+                                        // this round of the backend loop, or alone at its end
+  uint32_t quick_acks;                  // data segments still acknowledged right away
 } window_t;
 
+/**
+ * Counters and RTT estimates kept by the backend, exposed through
+ * `cmu_get_stats`.
+ */
+typedef struct {
+  uint64_t spin_us;         // time spent spinning on the socket (busy-poll mode)
+  uint64_t sleep_us;        // time spent blocked waiting for packets or timers
+  uint64_t spin_hits;       // packets picked up while spinning
+  uint64_t sleeps;          // number of times the backend blocked
+  uint64_t pacer_waits;     // times the pacer held back a segment the window allowed
+  uint64_t small_segs_avoided;  // short segments that small writes coalesced into others
+                                // would have taken (Nagle, CMU_SO_CORK)
+  uint64_t rtt_samples;     // RTT samples taken from ACKs
+  uint64_t ts_rtt_samples;  // ... of which from echoed timestamps
+  uint64_t timeouts;        // retransmission timeouts
+  uint64_t retransmits;     // segments sent again
+  uint64_t tail_probes;     // tail loss probes sent
+  uint64_t window_probes;   // zero window probes sent
+  uint64_t pmtu_probes;     // path MTU probes sent
+  uint64_t acks_sent;       // pure ACKs sent
+  uint64_t window_updates;  // ... of which only to tell that reads opened the window
+  uint64_t acks_piggybacked;  // ACKs owed or held back that data carried instead
+  uint64_t fastopen_bytes;  // data the server took from a fast open SYN
+  uint64_t syn_cookies_sent;      // SYNs the listener answered with a cookie (see syncookie.h)
+  uint64_t syn_cookies_accepted;  // ... whose cookie came back, accepting the connection
+  // current estimates (see rto.h), filled in by cmu_get_stats
+  uint32_t srtt_us;         // smoothed RTT, 0 before the first sample
+  uint32_t rttvar_us;       // RTT mean deviation
+  uint32_t rto_us;          // retransmission timeout, backoff included
+  uint32_t rto_backoff;     // timeouts in a row
+  uint32_t mss;             // payload of a full segment (see pmtu.h)
+} cmu_socket_stats_t;
+
 /**
  * CMU-TCP socket types. (DO NOT CHANGE.)
  */
@@ -66,25 +161,50 @@ typedef enum {
  */
 typedef struct {
   int socket;               // bind to "my_addr"
+  io_engine_t io;           // moves datagrams in and out of 'socket'
   pthread_t thread_id;
   cmu_socket_type_t type;
   uint16_t my_port;
   struct sockaddr_in conn;  // TCP_INITIATOR (client) : the server's ip/port
-                            // TCP_LISTENER (server) : the client's ip/port, upon receiving the first packet
+                            // TCP_LISTENER (server) : the client's ip/port, upon accepting the connection
   
-  recv_buffer_t* recv_buf;
+  recv_buffer_t* recv_buf;  // NULL, with send_buf, until an initiator is first used or a
+                            // listener accepts a connection
   pthread_mutex_t recv_lock;
   send_buffer_t* send_buf;
   pthread_mutex_t send_lock;
   int dying;
   pthread_mutex_t death_lock;
-  pthread_cond_t wait_cond;
-  // pthread_cond_t wait_cond2;
-  
+  pthread_cond_t wait_cond;   // signaled (with recv_lock) when data arrives
+  pthread_cond_t send_cond;   // signaled (with send_lock) when buffer space frees up
+  int timeout_ms;             // deadline used by the TIMEOUT read/write mode (with send_lock)
+
   window_t window;
+  cc_t cc;                    // congestion control; used with send_lock held
+  pacer_t pacer;              // spreads segments out; used with send_lock held
+  rto_t rto;                  // retransmission timeout; used with send_lock held
+  pmtu_t pmtu;                // path MTU discovery; used with send_lock held
   cmu_socket_state_t state;
   bool initialized;
+  bool syn_deferred;        // an initiator's SYN waits for its first read, write or close,
+                            // and with fast open for the first write, to carry its data
+                            // (with send_lock)
+  uint32_t rcvbuf_size;     // bytes of recv_buf and send_buf once created (with send_lock)
+  uint32_t sndbuf_size;
+  bool buff_size_fixed;     // the SYN or a SYN-ACK went out with the window scale of
+                            // rcvbuf_size : the sizes no longer change (with send_lock)
   long last_send_ms;
+
+  int busy_poll_us;         // spin budget before blocking; 0 disables busy-poll
+                            // (with send_lock)
+  int busy_poll_cur_us;     // current (adaptive) spin budget (with send_lock)
+  int ack_frequency;        // data segments acknowledged by one ACK at most
+                            // (with send_lock)
+  int delack_us;            // how long an ACK may be held back; 0 never holds one back
+                            // (with send_lock)
+  bool nodelay;             // send short segments at once (CMU_SO_NODELAY)
+  bool cork;                // send full segments only (CMU_SO_CORK)
+  cmu_socket_stats_t stats;  // with send_lock
 } cmu_socket_t;
 
 /*
@@ -159,4 +279,111 @@ int cmu_write(cmu_socket_t* sock, const void* buf, int length);
  * You can declare more functions after this point if you need to.
  */
 
+/**
+ * Socket options supported by `cmu_setsockopt` and `cmu_getsockopt`.
+ */
+typedef enum {
+  CMU_SO_TIMEOUT = 0,  // int: milliseconds a TIMEOUT read/write may wait.
+  CMU_SO_BUSY_POLL,    // int: microseconds the backend may spin on the socket
+                       // before blocking (0, the default, never spins).
+  CMU_SO_KERNEL_BUSY_POLL,  // int: microseconds passed to SO_BUSY_POLL.
+  CMU_SO_CONGESTION,   // char[]: name of the congestion control algorithm
+                       // (see congestion.h), without the trailing '\0' :
+                       // the length is strlen() of the name, both ways.
+  CMU_SO_MAX_PACING_RATE,  // int: bytes per second the socket sends at most,
+                           // whatever the congestion control asks (0, the
+                           // default, for no cap; see pacer.h).
+  CMU_SO_RTO_MIN,      // int: microseconds the retransmission timeout never
+                       // goes below (0 restores the default; see rto.h).
+  CMU_SO_ACK_FREQUENCY,  // int: data segments received before an ACK goes out
+                         // at once (ACK_FREQUENCY_DEFAULT by default; 1 ACKs
+                         // every segment).
+  CMU_SO_DELACK_TIMEOUT,  // int: microseconds an ACK may be held back waiting
+                          // for more data (DELACK_DEFAULT_US by default; 0
+                          // ACKs every segment at once).
+  CMU_SO_NODELAY,      // int: non-zero sends data shorter than MSS at once
+                       // instead of waiting for the last short segment to be
+                       // acknowledged (Nagle's algorithm, on by default).
+  CMU_SO_CORK,         // int: non-zero holds back data shorter than MSS until
+                       // the option is cleared or the socket closed; clearing
+                       // it sends what is held.
+  CMU_SO_RCVBUF,       // int: bytes of the receive buffer, from 1 to
+                       // MAX_BUFF_SIZE (DEFAULT_BUFF_SIZE by default); the
+                       // window scale offered follows it.
+  CMU_SO_SNDBUF,       // int: bytes of the send buffer, likewise. Both are
+                       // set before the handshake : before the first read,
+                       // write or close of an initiator, before a listener
+                       // answers a SYN. Setting them later fails with EISCONN.
+} cmu_sockopt_t;
+
+/**
+ * Writes data to a CMU-TCP socket, waiting for send buffer space according to
+ * `flags`.
+ *
+ * `TIMEOUT` is implemented for both `cmu_read` and `cmu_write_mode` : either
+ * waits, for the handshake and then for data or buffer space, until the
+ * socket's `CMU_SO_TIMEOUT` milliseconds have passed. A `cmu_read` that times
+ * out returns 0 with errno set to ETIMEDOUT.
+ *
+ * @param sock The socket to write to.
+ * @param buf The data to write.
+ * @param length The number of bytes to write.
+ * @param flags `NO_FLAG` blocks until everything is buffered, `NO_WAIT` only
+ *              buffers what fits right now and `TIMEOUT` waits for at most
+ *              the socket's `CMU_SO_TIMEOUT` milliseconds.
+ *
+ * @return The number of bytes buffered for sending (less than `length` if the
+ *         deadline passed, in which case errno is set to ETIMEDOUT), -1 on
+ *         error, including a handshake not done in time (errno ETIMEDOUT;
+ *         with `NO_WAIT`, not done yet).
+ */
+int cmu_write_mode(cmu_socket_t* sock, const void* buf, int length,
+                   cmu_read_mode_t flags);
+
+/**
+ * Sets a socket option.
+ *
+ * @param sock The socket to configure.
+ * @param opt The option to set.
+ * @param val A pointer to the new value.
+ * @param len The size of the value pointed to by `val`.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int cmu_setsockopt(cmu_socket_t* sock, cmu_sockopt_t opt, const void* val,
+                   socklen_t len);
+
+/**
+ * Gets the current value of a socket option.
+ *
+ * @param sock The socket to query.
+ * @param opt The option to get.
+ * @param val Where to store the value.
+ * @param len In: the size of `val`. Out: the size of the stored value.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int cmu_getsockopt(cmu_socket_t* sock, cmu_sockopt_t opt, void* val,
+                   socklen_t* len);
+
+/**
+ * Gets a snapshot of the socket's backend counters.
+ *
+ * @param sock The socket to query.
+ * @param stats Where to store the counters.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int cmu_get_stats(cmu_socket_t* sock, cmu_socket_stats_t* stats);
+
+/**
+ * Allocates the receive and send buffers of a socket, of the sizes set by
+ * CMU_SO_RCVBUF and CMU_SO_SNDBUF, the send buffer starting after the socket's
+ * ISN. An initiator gets them when it is first read, written or closed, a
+ * listener when it accepts a connection. The caller holds send_lock.
+ *
+ * @param sock The socket.
+ */
+void create_buffers(cmu_socket_t* sock);
+
 #endif  // PROJECT_2_15_441_INC_CMU_TCP_H_
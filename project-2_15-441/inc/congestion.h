@@ -0,0 +1,150 @@
+/**
+ * This file defines the congestion control interface of the CMU-TCP backend.
+ *
+ * An algorithm is a table of callbacks (cc_ops_t) that the backend invokes as
+ * it sends data and processes ACKs. The algorithm keeps the congestion window
+ * in cc_t.cwnd; the backend never has more than min(cwnd, advertised window)
+ * bytes in flight.
+ *
+ * The algorithm is picked per socket: set the environment variable CMU_TCP_CC
+ * to its name before creating the socket, or change it later with
+ * cmu_setsockopt(CMU_SO_CONGESTION). The backend calls every callback with the
+ * socket's send_lock held.
+ *
+ * Available algorithms:
+ *   none  : no congestion control, only the advertised window limits sending
+ *   reno  : NewReno, slow start and congestion avoidance with fast retransmit
+ *           and fast recovery (default)
+ *   cubic : CUBIC window growth with HyStart, for paths with a large
+ *           bandwidth-delay product
+ *   bbr   : BBR, paces at the measured bottleneck bandwidth and keeps about
+ *           one bandwidth-delay product in flight; losses do not slow it down
+ */
+
+#ifndef PROJECT_2_15_441_INC_CONGESTION_H_
+#define PROJECT_2_15_441_INC_CONGESTION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CC_ENV "CMU_TCP_CC"
+#define CC_DEFAULT "reno"
+#define CC_NAME_MAX 16
+
+// duplicate ACKs in a row that signal a lost segment
+#define CC_DUPACK_THRESHOLD 3
+
+typedef struct cc_t cc_t;
+
+// where an ACK leaves fast recovery (entered with on_loss)
+typedef enum {
+  CC_RECOVERY_NONE = 0,  // not in fast recovery
+  CC_RECOVERY_PARTIAL,   // partial ACK : the next missing segment is resent and
+                         // recovery goes on
+  CC_RECOVERY_DONE,      // everything outstanding at the loss is acknowledged
+} cc_recovery_t;
+
+// what the backend knows about an ACK that acknowledged new data
+typedef struct {
+  uint32_t acked;     // bytes newly acknowledged
+  uint32_t inflight;  // bytes still in flight after this ACK (see cc_t.sack)
+  cc_recovery_t recovery;
+  uint32_t rtt_us;  // RTT sample taken from this ACK, 0 if none
+  uint64_t now_us;  // get_time_us() when the ACK was processed
+
+  // delivery rate sample (see send_buffer.h)
+  uint64_t delivered;        // bytes delivered so far, this ACK included
+  uint64_t prior_delivered;  // 'delivered' when the newest acknowledged segment
+                             // was sent
+  uint64_t interval_us;
+  uint64_t delivery_rate;  // bytes per second, 0 if none
+  bool app_limited;        // the sample may be below what the path can do
+} cc_ack_t;
+
+typedef struct {
+  const char* name;
+  // set cwnd, ssthresh and any private state; -1 if that cannot be allocated
+  int (*init)(cc_t* cc);
+  void (*on_ack)(cc_t* cc, const cc_ack_t* ack);
+  // 'count' duplicate ACKs in a row so far
+  void (*on_dupack)(cc_t* cc, uint32_t count, uint32_t inflight);
+  // a segment was found lost, from duplicate ACKs or by RACK with SACK; the
+  // backend fast retransmits it and enters fast recovery. also called when a
+  // tail loss probe alone repaired a loss
+  void (*on_loss)(cc_t* cc, uint32_t inflight);
+  // the retransmission timer fired
+  void (*on_rto)(cc_t* cc, uint32_t inflight);
+  // 'bytes' were put on the wire; 'inflight' includes them
+  void (*on_send)(cc_t* cc, uint32_t bytes, uint32_t inflight, bool retransmit);
+  // bytes per second to pace sends at, 0 to send as fast as the window allows
+  uint64_t (*pacing_rate)(cc_t* cc);
+  // release the private state
+  void (*destroy)(cc_t* cc);
+} cc_ops_t;
+
+struct cc_t {
+  const cc_ops_t* ops;
+  uint32_t mss;
+  uint32_t cwnd;      // congestion window, in bytes
+  uint32_t ssthresh;  // slow start threshold, in bytes
+  bool sack;          // the connection uses SACK : 'inflight' leaves out the
+                      // bytes sacked or presumed lost (RFC 6675 pipe)
+  void* state;        // algorithm-specific
+};
+
+/**
+ * Looks up a congestion control algorithm by name.
+ *
+ * @param name The algorithm's name.
+ *
+ * @return The algorithm, or NULL if there is none with that name.
+ */
+const cc_ops_t* cc_find(const char* name);
+
+/**
+ * Sets up congestion control for a socket.
+ *
+ * @param cc The state to initialize.
+ * @param name The algorithm to use; NULL picks CMU_TCP_CC, or CC_DEFAULT if
+ *             that is unset or unknown.
+ * @param mss The maximum segment size of the connection.
+ *
+ * @return 0 on success, -1 with errno set to ENOENT if 'name' is not a known
+ *         algorithm, or to ENOMEM if its state cannot be allocated; 'cc' is
+ *         left unset then.
+ */
+int cc_init(cc_t* cc, const char* name, uint32_t mss);
+
+void cc_destroy(cc_t* cc);
+
+static inline void cc_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  cc->ops->on_ack(cc, ack);
+}
+
+static inline void cc_on_dupack(cc_t* cc, uint32_t count, uint32_t inflight) {
+  cc->ops->on_dupack(cc, count, inflight);
+}
+
+static inline void cc_on_loss(cc_t* cc, uint32_t inflight) {
+  cc->ops->on_loss(cc, inflight);
+}
+
+static inline void cc_on_rto(cc_t* cc, uint32_t inflight) {
+  cc->ops->on_rto(cc, inflight);
+}
+
+static inline void cc_on_send(cc_t* cc, uint32_t bytes, uint32_t inflight,
+                              bool retransmit) {
+  cc->ops->on_send(cc, bytes, inflight, retransmit);
+}
+
+static inline uint64_t cc_pacing_rate(cc_t* cc) {
+  return cc->ops->pacing_rate(cc);
+}
+
+extern const cc_ops_t cc_none_ops;
+extern const cc_ops_t cc_reno_ops;
+extern const cc_ops_t cc_cubic_ops;
+extern const cc_ops_t cc_bbr_ops;
+
+#endif  // PROJECT_2_15_441_INC_CONGESTION_H_
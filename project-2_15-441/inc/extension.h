@@ -0,0 +1,182 @@
+/**
+ * This file defines the header extensions (options) of CMU-TCP.
+ *
+ * `extension_data` holds a list of options, each encoded as
+ *
+ *   kind (1 byte) | length (1 byte, whole option) | value (length - 2 bytes)
+ *
+ * with multi-byte values in network byte order. `hlen` covers the fixed header
+ * and the extensions, so the payload starts at `hlen` as before. Unknown kinds
+ * are skipped, so an end that does not know an option just ignores it.
+ *
+ * Options:
+ *   maximum segment size (kind 2, 4 bytes) : in the SYN and SYN-ACK, the
+ *       largest payload this end accepts in a segment (RFC 9293 3.7.1), of
+ *       which a sender takes out the options it puts in every segment; without
+ *       it, the other side sends MSS bytes at most. Segments grow past MSS only
+ *       as far as path MTU discovery (pmtu.h) finds the path carries them.
+ *   PMTU probe (kind 20, 4 bytes) : this packet is a path MTU probe, as long
+ *       as a segment of the size given, padded with a payload that is not data.
+ *       Sent only to an end that sent the MSS option, which answers at once
+ *       with a pure ACK carrying
+ *   PMTU probe ACK (kind 21, 4 bytes) : a probe of the size given arrived.
+ *   window scale (kind 3, 3 bytes) : in the SYN and SYN-ACK, the shift this
+ *       end applies to the windows it advertises (RFC 7323). Used only if both
+ *       ends send it; SYN and SYN-ACK windows themselves are never scaled.
+ *   timestamp (kind 8, 10 bytes) : TSval, the sender's clock in microseconds,
+ *       and TSecr, the TSval of the last in-order segment received, echoed
+ *       back (RFC 7323). Offered in the SYN, accepted in the SYN-ACK, then
+ *       carried by every packet; the ACK of any segment, retransmitted or not,
+ *       gives an RTT sample.
+ *   SACK permitted (kind 4, 2 bytes) : in the SYN and SYN-ACK, this end
+ *       understands SACK blocks (RFC 2018).
+ *   SACK (kind 5, 2 + 8 * n bytes) : up to EXT_MAX_SACK_BLOCKS ranges of bytes
+ *       received past the ACK number, the one holding the most recently
+ *       received segment first. Sent on ACKs while there is out-of-order data.
+ *   fast open cookie (kind 34, 2 + n bytes) : in the SYN, a cookie the server
+ *       gave earlier, for it to take the data the SYN carries; empty, a
+ *       request for one. In the SYN-ACK, a new cookie (RFC 7413, see
+ *       fastopen.h).
+ */
+
+#ifndef PROJECT_2_15_441_INC_EXTENSION_H_
+#define PROJECT_2_15_441_INC_EXTENSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// space the options of one packet may take
+#define EXT_MAX_LEN 40
+
+#define EXT_KIND_MSS 2
+#define EXT_MSS_LEN 4
+
+#define EXT_KIND_WINDOW_SCALE 3
+#define EXT_WINDOW_SCALE_LEN 3
+#define EXT_MAX_WINDOW_SCALE 14  // windows up to 1 GB
+
+#define EXT_KIND_SACK_PERMITTED 4
+#define EXT_SACK_PERMITTED_LEN 2
+#define EXT_KIND_SACK 5
+#define EXT_SACK_BLOCK_LEN 8
+#define EXT_MAX_SACK_BLOCKS 4
+#define EXT_KIND_TIMESTAMP 8
+#define EXT_TIMESTAMP_LEN 10
+#define EXT_KIND_PROBE 20
+#define EXT_KIND_PROBE_ACK 21
+#define EXT_PROBE_LEN 4
+#define EXT_KIND_FASTOPEN 34
+#define EXT_FASTOPEN_MIN_COOKIE 4
+#define EXT_FASTOPEN_MAX_COOKIE 16
+
+// set CMU_TCP_TIMESTAMPS=0 to not offer or accept the timestamp option
+#define EXT_TIMESTAMPS_ENV "CMU_TCP_TIMESTAMPS"
+// set CMU_TCP_SACK=0 to not offer or accept SACK
+#define EXT_SACK_ENV "CMU_TCP_SACK"
+// set CMU_TCP_WSCALE=0 to not offer or accept window scaling
+#define EXT_WSCALE_ENV "CMU_TCP_WSCALE"
+// set CMU_TCP_MSS to the largest segment payload this end accepts (and so
+// sends, at most); 0 to not send the MSS option
+#define EXT_MSS_ENV "CMU_TCP_MSS"
+
+// the bytes [start, end) were received
+typedef struct {
+  uint32_t start;
+  uint32_t end;
+} sack_block_t;
+
+// the options found in a packet
+typedef struct {
+  uint16_t mss;        // 0 if none
+  uint16_t probe;      // size of the PMTU probe this packet is, 0 if it is none
+  uint16_t probe_ack;  // size of the PMTU probe acknowledged, 0 if none
+  bool has_wscale;
+  uint8_t wscale;  // at most EXT_MAX_WINDOW_SCALE
+  bool has_timestamp;
+  uint32_t ts_val;
+  uint32_t ts_ecr;
+  bool sack_permitted;
+  uint8_t sack_count;
+  sack_block_t sack[EXT_MAX_SACK_BLOCKS];
+  bool has_fastopen;
+  uint8_t fastopen_len;  // of the cookie; 0 for a request
+  uint8_t fastopen_cookie[EXT_FASTOPEN_MAX_COOKIE];
+} ext_opts_t;
+
+/**
+ * Appends a timestamp option.
+ *
+ * @param buf Where the options of the packet are built.
+ * @param len The length of the options already in 'buf'.
+ * @param ts_val This end's clock.
+ * @param ts_ecr The timestamp echoed back, 0 if none yet.
+ *
+ * @return The new length of the options.
+ */
+uint16_t ext_put_timestamp(uint8_t* buf, uint16_t len, uint32_t ts_val,
+                           uint32_t ts_ecr);
+
+// appends a maximum segment size option; returns the new length of the options
+uint16_t ext_put_mss(uint8_t* buf, uint16_t len, uint16_t mss);
+
+// appends a PMTU probe option ('kind' EXT_KIND_PROBE) or probe ACK option
+// ('kind' EXT_KIND_PROBE_ACK) for a probe of 'size'; returns the new length of
+// the options
+uint16_t ext_put_probe(uint8_t* buf, uint16_t len, uint8_t kind, uint16_t size);
+
+// appends a fast open cookie option carrying the 'cookie_len' bytes of 'cookie'
+// (a request if 0); returns the new length of the options
+uint16_t ext_put_fastopen(uint8_t* buf, uint16_t len, const uint8_t* cookie,
+                          uint8_t cookie_len);
+
+// appends a window scale option; returns the new length of the options
+uint16_t ext_put_window_scale(uint8_t* buf, uint16_t len, uint8_t shift);
+
+// appends a SACK permitted option; returns the new length of the options
+uint16_t ext_put_sack_permitted(uint8_t* buf, uint16_t len);
+
+/**
+ * Appends a SACK option with as many of 'blocks' as fit.
+ *
+ * @param buf Where the options of the packet are built.
+ * @param len The length of the options already in 'buf'.
+ * @param room The most the options may take in all.
+ * @param blocks The blocks to report, most important first.
+ * @param count How many there are.
+ *
+ * @return The new length of the options; 'len' if not even one block fits.
+ */
+uint16_t ext_put_sack(uint8_t* buf, uint16_t len, uint16_t room,
+                      const sack_block_t* blocks, uint32_t count);
+
+/**
+ * Parses the options of a packet.
+ *
+ * @param data The extension data.
+ * @param len Its length.
+ * @param opts Filled with the options found.
+ *
+ * @return 0 on success, -1 if an option runs past 'len'.
+ */
+int ext_parse(const uint8_t* data, uint16_t len, ext_opts_t* opts);
+
+// whether this end offers and accepts timestamps (CMU_TCP_TIMESTAMPS)
+bool ext_timestamps_enabled();
+
+// whether this end offers and accepts SACK (CMU_TCP_SACK)
+bool ext_sack_enabled();
+
+// whether this end offers and accepts window scaling (CMU_TCP_WSCALE)
+bool ext_wscale_enabled();
+
+// the largest segment payload this end accepts : CMU_TCP_MSS clamped to
+// [base, max], or 'max' if it is not set; 0 if it is "0"
+uint32_t ext_mss_limit(uint32_t base, uint32_t max);
+
+// the smallest shift that lets a window of 'bytes' be advertised in 16 bits
+uint8_t ext_window_scale_for(uint32_t bytes);
+
+// this end's timestamp clock : microseconds, never 0 (0 means "no echo")
+uint32_t ext_timestamp_now();
+
+#endif  // PROJECT_2_15_441_INC_EXTENSION_H_
@@ -0,0 +1,59 @@
+/**
+ * This file defines fast open (RFC 7413) for CMU-TCP : data in the SYN, for
+ * the server to hand to the application before the handshake is over, which
+ * takes a round trip off a short exchange.
+ *
+ * A server only takes data from a SYN that carries a cookie it issued to the
+ * client's address, so that a forged source address gets nothing delivered.
+ * The cookie is a keyed hash of that address (see siphash.h) : cookies stay
+ * valid as long as the server process runs.
+ * The first connection to a server asks for a cookie with an empty option in
+ * its SYN and gets one in the SYN-ACK, which the client keeps in a cache of
+ * the process, by server address and port.
+ *
+ * A client with a cookie for the server waits for the first write before it
+ * sends its SYN : the SYN carries as much of that write as fits in one
+ * packet. Data the server does not take (an old cookie, a full receive
+ * buffer) goes out after the handshake like any other, and so does the SYN's
+ * data if the SYN has to be sent again.
+ *
+ * A SYN may come twice, so an application that turns fast open on must not
+ * mind a request it gets twice. Set CMU_TCP_FASTOPEN=1 on both ends to turn
+ * it on.
+ */
+
+#ifndef PROJECT_2_15_441_INC_FASTOPEN_H_
+#define PROJECT_2_15_441_INC_FASTOPEN_H_
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FASTOPEN_COOKIE_LEN 8
+#define FASTOPEN_CACHE_SIZE 16
+
+#define FASTOPEN_ENV "CMU_TCP_FASTOPEN"
+
+// write the cookie of the client at 'client' (FASTOPEN_COOKIE_LEN bytes) to
+// 'cookie'
+void fastopen_cookie(const struct sockaddr_in* client, uint8_t* cookie);
+
+// whether the 'len' bytes of 'cookie' are the cookie of the client at 'client'
+bool fastopen_cookie_valid(const struct sockaddr_in* client,
+                           const uint8_t* cookie, uint8_t len);
+
+// copy the cookie cached for the server at 'server' to 'cookie'; return its
+// length, 0 if none
+uint8_t fastopen_cache_get(const struct sockaddr_in* server, uint8_t* cookie);
+
+// cache the 'len' bytes of 'cookie' for the server at 'server'
+void fastopen_cache_put(const struct sockaddr_in* server, const uint8_t* cookie,
+                        uint8_t len);
+
+// forget the cookie of the server at 'server', which does not take it any more
+void fastopen_cache_drop(const struct sockaddr_in* server);
+
+// whether this end uses fast open (CMU_TCP_FASTOPEN)
+bool fastopen_enabled();
+
+#endif  // PROJECT_2_15_441_INC_FASTOPEN_H_
@@ -0,0 +1,105 @@
+/**
+ * This file defines the I/O engine interface used by the CMU-TCP backend to
+ * move datagrams in and out of the UDP socket.
+ *
+ * The default engine issues one sendto()/recvfrom() per packet. When built with
+ * `make IO_URING=1`, an io_uring engine is also available: it keeps a multishot
+ * recvmsg armed over a provided buffer ring and batches the packets sent during
+ * one backend iteration into a single io_uring_enter() call.
+ *
+ * Every engine also watches an eventfd so that the application threads can
+ * interrupt a blocking receive with io_engine_wake() (e.g. after queueing new
+ * data to send).
+ *
+ * The engine is picked when the socket is created. Set the environment variable
+ * CMU_TCP_IO_ENGINE to "io_uring" to request the io_uring engine; the backend
+ * falls back to the sendto engine if io_uring is unavailable.
+ */
+
+#ifndef PROJECT_2_15_441_INC_IO_ENGINE_H_
+#define PROJECT_2_15_441_INC_IO_ENGINE_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define IO_ENGINE_ENV "CMU_TCP_IO_ENGINE"
+
+typedef struct io_engine_t io_engine_t;
+
+typedef struct {
+  const char* name;
+  // return 0 on success, -1 if the engine cannot be used on this system
+  int (*init)(io_engine_t* engine);
+  // queue (or send) one datagram; the engine copies 'pkt' before returning
+  int (*send)(io_engine_t* engine, const uint8_t* pkt, uint16_t len,
+              const struct sockaddr_in* to);
+  // push any queued datagrams to the kernel
+  void (*flush)(io_engine_t* engine);
+  // receive one datagram, waiting at most 'timeout_us' microseconds (-1 :
+  // forever); return its length, or 0 if none arrived in time or
+  // io_engine_wake() was called
+  ssize_t (*recv)(io_engine_t* engine, uint8_t* buf, uint32_t cap,
+                  struct sockaddr_in* from, int64_t timeout_us);
+  void (*destroy)(io_engine_t* engine);
+} io_engine_ops_t;
+
+struct io_engine_t {
+  const io_engine_ops_t* ops;
+  int sockfd;
+  uint32_t max_len;  // of the datagrams the socket sends and receives
+  int wake_fd;       // eventfd written by io_engine_wake()
+  int wake_pending;  // set by io_engine_wake(), cleared with the eventfd
+  void* state;       // engine-specific
+};
+
+/**
+ * Sets up the I/O engine for a UDP socket, honoring CMU_TCP_IO_ENGINE.
+ *
+ * @param engine The engine to initialize.
+ * @param sockfd The bound UDP socket.
+ * @param max_len The longest datagram the socket sends or receives; engines
+ *                that keep buffers size them from it.
+ */
+void io_engine_init(io_engine_t* engine, int sockfd, uint32_t max_len);
+
+static inline int io_engine_send(io_engine_t* engine, const uint8_t* pkt,
+                                 uint16_t len, const struct sockaddr_in* to) {
+  return engine->ops->send(engine, pkt, len, to);
+}
+
+static inline void io_engine_flush(io_engine_t* engine) {
+  engine->ops->flush(engine);
+}
+
+static inline ssize_t io_engine_recv(io_engine_t* engine, uint8_t* buf,
+                                     uint32_t cap, struct sockaddr_in* from,
+                                     int64_t timeout_us) {
+  return engine->ops->recv(engine, buf, cap, from, timeout_us);
+}
+
+/**
+ * Interrupts a receive that is blocked (or about to block) in the backend.
+ * Safe to call from any thread.
+ *
+ * @param engine The engine to wake up.
+ */
+void io_engine_wake(io_engine_t* engine);
+
+// clear pending wakeups; used by the engines once a wakeup has been seen
+void io_engine_clear_wake(io_engine_t* engine);
+
+// whether io_engine_wake() was called since the last clear; no syscall, so a
+// busy-polling backend can check it on every spin
+static inline int io_engine_wake_pending(io_engine_t* engine) {
+  return __atomic_load_n(&engine->wake_pending, __ATOMIC_ACQUIRE);
+}
+
+void io_engine_destroy(io_engine_t* engine);
+
+extern const io_engine_ops_t sendto_engine_ops;
+#ifdef CMU_TCP_IO_URING
+extern const io_engine_ops_t io_uring_engine_ops;
+#endif
+
+#endif  // PROJECT_2_15_441_INC_IO_ENGINE_H_
@@ -0,0 +1,73 @@
+/**
+ * This file defines the pacer of the CMU-TCP backend.
+ *
+ * Without pacing, the backend sends all the window allows back to back, a
+ * burst that can overflow a shallow queue along the path. The pacer spreads
+ * segments out at a target rate with a token bucket: tokens (bytes) come in at
+ * the rate, a segment goes out only once the bucket holds all of its bytes,
+ * and the bucket holds at most a short burst, so an idle connection cannot
+ * save up for a long one.
+ *
+ * The rate is the lower of the one asked by the congestion control algorithm
+ * (cc_pacing_rate()) and a per-socket cap set with
+ * cmu_setsockopt(CMU_SO_MAX_PACING_RATE); 0 for both means no pacing. Time is
+ * kept in microseconds, and the backend sleeps until the next release with
+ * the same resolution.
+ */
+
+#ifndef PROJECT_2_15_441_INC_PACER_H_
+#define PROJECT_2_15_441_INC_PACER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the bucket holds this much sending time worth of bytes...
+#define PACER_BURST_US 1000
+// ...and never less than this many segments
+#define PACER_MIN_BURST_SEGMENTS 2
+
+typedef struct {
+  uint64_t rate;      // bytes per second in effect, 0 if not pacing
+  uint64_t cc_rate;   // asked by the congestion control algorithm, 0 if none
+  uint64_t max_rate;  // per-socket cap, 0 if none
+  uint32_t mss;
+  uint64_t tokens;   // bytes in the bucket, times 1000000 (byte-microseconds
+                     // at one byte per second) to keep the fractions
+  uint64_t depth;    // bucket size, same unit
+  uint64_t last_us;  // when tokens were last added
+} pacer_t;
+
+void pacer_init(pacer_t* pacer, uint32_t mss);
+
+/**
+ * Sets the rate asked by the congestion control algorithm.
+ *
+ * @param pacer The pacer.
+ * @param rate Bytes per second, 0 for as fast as the window allows.
+ * @param now_us get_time_us().
+ */
+void pacer_set_rate(pacer_t* pacer, uint64_t rate, uint64_t now_us);
+
+// caps the rate at 'max_rate' bytes per second whatever the algorithm asks; 0
+// lifts the cap
+void pacer_set_max_rate(pacer_t* pacer, uint64_t max_rate, uint64_t now_us);
+
+static inline bool pacer_active(const pacer_t* pacer) {
+  return pacer->rate > 0;
+}
+
+/**
+ * Tells how long a segment must wait.
+ *
+ * @param pacer The pacer.
+ * @param len The segment's length.
+ * @param now_us get_time_us().
+ *
+ * @return Microseconds until 'len' bytes may go out, 0 if they may now.
+ */
+uint64_t pacer_delay_us(pacer_t* pacer, uint32_t len, uint64_t now_us);
+
+// takes the tokens for 'len' bytes put on the wire
+void pacer_consume(pacer_t* pacer, uint32_t len, uint64_t now_us);
+
+#endif  // PROJECT_2_15_441_INC_PACER_H_
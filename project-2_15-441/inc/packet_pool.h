@@ -0,0 +1,52 @@
+/**
+ * This file defines a pool of fixed-size packet buffers.
+ *
+ * Every slot holds MAX_LEN bytes, i.e. any packet CMU-TCP puts on the wire
+ * until path MTU discovery (see pmtu.h) finds that segments may be larger.
+ * Only the first bytes of a slot are touched by a short packet. Larger packets,
+ * up to MAX_DATAGRAM_LEN, are malloc'ed and freed one by one : a 64 KB slot
+ * for every ACK would take far more memory than the packets in flight.
+ * Each thread keeps its own free list, so allocating and freeing a packet does
+ * not take a lock nor call malloc() in the common case. A thread that frees
+ * more than PACKET_POOL_CACHE_MAX slots hands a batch back to a shared list,
+ * where threads with an empty free list pick them up; the slots cached by a
+ * thread are also handed back when it exits.
+ *
+ * Slots are never returned to the system.
+ */
+
+#ifndef PROJECT_2_15_441_INC_PACKET_POOL_H_
+#define PROJECT_2_15_441_INC_PACKET_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cmu_packet.h"
+#include "grading.h"
+
+#define PACKET_POOL_SLOT_SIZE MAX_LEN
+// slots a thread keeps on its own free list
+#define PACKET_POOL_CACHE_MAX 64
+// slots moved between a thread and the shared list (or malloc'ed) at once
+#define PACKET_POOL_BATCH 32
+
+/**
+ * Takes a packet buffer from the calling thread's free list.
+ *
+ * @param len The number of bytes needed.
+ *
+ * @return A buffer of at least 'len' bytes (from malloc() if 'len' is larger
+ *         than PACKET_POOL_SLOT_SIZE), or NULL if memory is exhausted. The
+ *         buffer is not zeroed. Release it with packet_pool_free(), from any
+ *         thread.
+ */
+uint8_t* packet_pool_alloc(size_t len);
+
+/**
+ * Returns a buffer obtained from packet_pool_alloc() to the pool.
+ *
+ * @param pkt The buffer to release; NULL is ignored.
+ */
+void packet_pool_free(uint8_t* pkt);
+
+#endif  // PROJECT_2_15_441_INC_PACKET_POOL_H_
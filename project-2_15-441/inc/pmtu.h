@@ -0,0 +1,83 @@
+/**
+ * This file defines the packetization layer path MTU discovery of the CMU-TCP
+ * backend (RFC 8899, after RFC 4821) : the search for the largest segment a
+ * connection can send.
+ *
+ * A connection starts with MSS, which every path is assumed to carry. If the
+ * other side accepts larger segments (the MSS option, see extension.h), the
+ * backend sends probes : packets as long as a segment of 'probe_size' bytes,
+ * padding only, that the other side answers with a probe ACK. The first probe
+ * tries the largest size both ends accept, which settles loopback and jumbo
+ * frame networks at once; after that the search halves the interval between
+ * the largest size that got through and the smallest one that did not, until
+ * it is narrower than PMTU_SEARCH_STEP. A probe not answered in time (the
+ * backend allows 2 SRTT, the answer being immediate) is sent again, up to
+ * PMTU_MAX_PROBES times, then the size is taken as too large. Probes carry
+ * no data, so losing one costs neither a retransmission nor a congestion
+ * response.
+ *
+ * Once the search is done, it starts again after PMTU_RAISE_US in case the
+ * path got better. Segments of the size found that keep timing out
+ * (PMTU_BLACK_HOLE_TIMEOUTS retransmission timeouts in a row) mean that it got
+ * worse : the connection falls back to MSS and searches again.
+ *
+ * Set CMU_TCP_PMTU_PROBE=0 to not search : a connection then uses the largest
+ * size both ends accept right away, for paths known to carry it.
+ */
+
+#ifndef PROJECT_2_15_441_INC_PMTU_H_
+#define PROJECT_2_15_441_INC_PMTU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PMTU_MAX_PROBES 3
+#define PMTU_SEARCH_STEP 32
+#define PMTU_RAISE_US 600000000ull
+#define PMTU_BLACK_HOLE_TIMEOUTS 2
+
+#define PMTU_PROBE_ENV "CMU_TCP_PMTU_PROBE"
+
+typedef struct {
+  uint32_t mss;          // segment size in use
+  uint32_t base_mss;     // ... when nothing is known about the path
+  uint32_t max_mss;      // the largest both ends accept
+  uint32_t lo;           // the largest size known to get through
+  uint32_t hi;           // the smallest size known not to; max_mss + 1 if none
+  uint32_t probe_size;   // of the probe out, 0 if none is
+  uint32_t probes;       // times it was sent
+  uint64_t deadline_us;  // when the probe out is taken as lost, or the next
+                         // search starts; 0 if never
+  uint32_t timeouts;     // retransmission timeouts since data was last
+                         // acknowledged
+} pmtu_t;
+
+// start with segments of 'base_mss' bytes, and search no further
+void pmtu_init(pmtu_t* pmtu, uint32_t base_mss);
+
+// both ends accept segments up to 'max_mss' bytes : search for the largest the
+// path carries, starting now, or with 'search' false, use it at once
+void pmtu_start(pmtu_t* pmtu, uint32_t max_mss, bool search, uint64_t now_us);
+
+// the size of the probe to send now, 0 if none is due
+uint32_t pmtu_probe_due(pmtu_t* pmtu, uint64_t now_us);
+
+// a probe of 'size' went out; unanswered after 'timeout_us', it is sent again
+// or taken as lost
+void pmtu_on_probe_sent(pmtu_t* pmtu, uint32_t size, uint64_t timeout_us,
+                        uint64_t now_us);
+
+// the other side got a probe of 'size'; return true if the segment size grew
+bool pmtu_on_probe_ack(pmtu_t* pmtu, uint32_t size, uint64_t now_us);
+
+// new data was acknowledged
+void pmtu_on_ack(pmtu_t* pmtu);
+
+// the retransmission timer fired; return true if the segment size fell back to
+// the base
+bool pmtu_on_timeout(pmtu_t* pmtu, uint64_t now_us);
+
+// whether this end searches (CMU_TCP_PMTU_PROBE)
+bool pmtu_probe_enabled();
+
+#endif  // PROJECT_2_15_441_INC_PMTU_H_
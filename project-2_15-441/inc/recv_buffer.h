@@ -4,15 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// typedef struct segment_t segment_t;
-
-// a data segment on the buffer
-typedef struct segment_t {  
-    uint32_t start_seqnum_inclusive;
-    uint32_t end_seqnum_inclusive;
-    struct segment_t* prev;
-    struct segment_t* next;
-} segment_t;
+#include "extension.h"
 
 typedef struct {
     uint32_t capacity;
@@ -20,8 +12,11 @@ typedef struct {
     uint32_t last_byte_read_index;       // the index of the buffer array, on which the byte was the last one read/consumed
     uint32_t next_byte_expected_index;   // the index of the buffer array to put the next in-order byte
     uint8_t* buffer;
-    segment_t* start;
-    segment_t* end;
+    // one bit per byte of 'buffer' : set if the byte was received out of order, i.e. beyond the
+    // next byte expected. scanned a 64-bit word at a time to find where the next hole starts
+    uint64_t* ooo_bitmap;
+    uint32_t last_ooo_seqnum;            // first byte of the latest segment received out of order
+    uint32_t ooo_end_seqnum;             // the byte after the highest one received out of order
 } recv_buffer_t;
 
 recv_buffer_t* recv_buffer_create(uint32_t capacity);
@@ -46,9 +41,17 @@ void recv_buffer_read(recv_buffer_t* recv_buffer, uint8_t* buf, uint32_t len);
 uint8_t recv_buffer_can_receive(recv_buffer_t* recv_buffer, uint32_t seqnum, uint32_t len);
 
 // receive 'len' bytes of data starting at 'seqnum'
-// also update out_of_order_segments
+// also update the out-of-order bitmap
 void recv_buffer_receive(recv_buffer_t* recv_buffer, uint32_t seqnum, uint32_t len, uint8_t* data);
 
+// fill 'blocks' with at most 'max_blocks' ranges of bytes received out of order, for SACK :
+// the range holding the latest such segment first, then the others from the lowest up
+// return the number of blocks
+uint32_t recv_buffer_sack_blocks(recv_buffer_t* recv_buffer, sack_block_t* blocks, uint32_t max_blocks);
+
+// whether bytes past a hole are waiting for it to be filled
+bool recv_buffer_has_ooo(recv_buffer_t* recv_buffer);
+
 // free the resources
 void recv_buffer_clean(recv_buffer_t* recv_buffer);
 
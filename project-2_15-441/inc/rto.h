@@ -0,0 +1,49 @@
+/**
+ * This file defines the retransmission timeout estimator of the CMU-TCP
+ * backend (RFC 6298).
+ *
+ * Every RTT sample updates a smoothed RTT (SRTT) and its mean deviation
+ * (RTTVAR) with Jacobson/Karels' gains of 1/8 and 1/4, and the timeout is
+ *   RTO = SRTT + max(G, 4 * RTTVAR)
+ * clamped to [min, max]. With the timestamp option (extension.h) every ACK of
+ * new data gives a sample; otherwise samples only come from segments that were
+ * sent once (Karn's rule, see send_buffer_ack_segments()). Each timeout in a
+ * row doubles the RTO, up to the max, until an ACK gives a new sample.
+ *
+ * The minimum defaults to RTO_MIN_US; on a path with a known small RTT it can
+ * be lowered with cmu_setsockopt(CMU_SO_RTO_MIN).
+ */
+
+#ifndef PROJECT_2_15_441_INC_RTO_H_
+#define PROJECT_2_15_441_INC_RTO_H_
+
+#include <stdint.h>
+
+// before the first sample
+#define RTO_INITIAL_US 1000000
+#define RTO_MIN_US 200000
+#define RTO_MAX_US 60000000
+// clock granularity G : the RTO stays this much above SRTT
+#define RTO_GRANULARITY_US 1000
+
+typedef struct {
+  uint32_t srtt_us;  // 0 until the first sample
+  uint32_t rttvar_us;
+  uint32_t rto_us;  // backoff included
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t backoff;  // timeouts in a row
+} rto_t;
+
+void rto_init(rto_t* rto);
+
+// takes an RTT sample, which also ends any backoff
+void rto_on_sample(rto_t* rto, uint32_t rtt_us);
+
+// the retransmission timer fired : back off
+void rto_on_timeout(rto_t* rto);
+
+// sets the lower clamp; 0 restores RTO_MIN_US
+void rto_set_min(rto_t* rto, uint32_t min_us);
+
+#endif  // PROJECT_2_15_441_INC_RTO_H_
@@ -5,18 +5,87 @@
 #include <stdbool.h>
 #include <sys/time.h>
 
+#include "extension.h"
+
+// expected bytes per sent segment, to size the segment table; when the table
+// is full, new data is merged into the last segment
+#define SEND_BUFFER_SEGMENT_BYTES 512
+#define SEND_BUFFER_MIN_SEGMENTS 16
+
+typedef enum {
+    SEGMENT_IN_FLIGHT,  // sent, fate unknown
+    SEGMENT_SACKED,     // the other side reported it in a SACK block
+    SEGMENT_LOST,       // presumed lost and not sent again since
+} send_segment_state_t;
+
+// a segment sent and not yet fully acknowledged : the retransmission scoreboard entry,
+// with what was known about delivery when it was (last) sent, to sample the delivery
+// rate once it is acknowledged (draft-cheng-iccrg-delivery-rate-estimation)
+typedef struct {
+    uint32_t seq;            // first byte
+    uint32_t len;
+    uint16_t tx_count;       // times it was put on the wire
+    uint8_t state;           // a send_segment_state_t
+    bool app_limited;        // sent while the application did not keep the window full
+    uint64_t orig_sent_us;   // when it was first sent
+    uint64_t sent_us;        // when it was last sent
+    uint64_t delivered;      // send_buffer->delivered when it was sent
+    uint64_t delivered_us;   // send_buffer->delivered_us when it was sent
+    uint64_t first_sent_us;  // send time of the segment that started the sampling interval
+} send_segment_t;
+
+// a delivery rate sample, taken when an ACK acknowledges new data
+typedef struct {
+    uint64_t delivered;        // bytes delivered so far, this ACK included
+    uint64_t prior_delivered;  // 'delivered' when the newest acknowledged segment was sent
+    uint64_t interval_us;      // over which 'delivered - prior_delivered' bytes were delivered
+    uint64_t delivery_rate;    // bytes per second; 0 if this ACK gives no sample
+    bool app_limited;
+    uint32_t rtt_us;           // since the oldest acknowledged segment was sent; 0 if this
+                               // ACK covers a retransmission (Karn's rule)
+} rate_sample_t;
+
 typedef struct {
     uint32_t capacity;
-    long last_byte_acked_ts;
+    uint64_t last_byte_acked_us;          // when the retransmission timer (re)started
     uint32_t last_byte_acked_seqnum;
     uint32_t last_byte_acked_index;       // the index of the last byte that is received by the other side; i.e. ackNum_from_receiver - 1
     uint32_t last_byte_sent_index;        // the index of the last byte that is sent (not yet acked)
     uint32_t next_byte_written_index;     // the index of the buffer to write the next byte from application
     uint8_t* buffer;
+
+    // sent and unacknowledged segments in sequence order, a ring of 'segments_cap'
+    send_segment_t* segments;
+    uint32_t segments_cap;
+    uint32_t segments_head;
+    uint32_t segments_count;
+    uint32_t segments_removed;            // segments dropped from the ring so far; the one at
+                                          // position i is number segments_removed + i
+    uint32_t* segment_index;              // for each SEND_BUFFER_SEGMENT_BYTES chunk of 'buffer',
+                                          // the number of the segment holding its first byte
+    uint64_t delivered;                   // bytes acknowledged so far
+    uint32_t dupack_delivered;            // part of 'delivered' credited to duplicate ACKs, not yet
+                                          // covered by a cumulative ACK
+    uint64_t delivered_us;                // when 'delivered' last grew
+    uint64_t first_sent_us;
+    uint64_t app_limited;                 // samples are app-limited until 'delivered' passes this; 0 if not
+    uint32_t sacked_bytes;                // in segments marked sacked
+    uint32_t lost_bytes;                  // in segments marked lost
+
+    // RACK (RFC 8985) : the most recently sent segment known to be delivered
+    uint64_t rack_xmit_us;                // when it was last sent; 0 before the first one
+    uint32_t rack_end_seq;                // the byte after it
+    uint32_t rack_rtt_us;                 // its RTT
+    uint32_t rack_min_rtt_us;             // lowest RTT of a segment sent once; 0 before the first
+    uint32_t rack_fack;                   // the byte after the highest one delivered
+    bool rack_reordering_seen;            // a segment sent once arrived after a later one
 } send_buffer_t;
 
 long get_time_ms();
 
+// monotonic clock in microseconds, for timing finer than get_time_ms()
+uint64_t get_time_us();
+
 send_buffer_t* send_buffer_create(uint32_t capacity);
 
 void send_buffer_initialize(send_buffer_t* send_buffer, uint32_t isn);
@@ -33,6 +102,10 @@ void send_buffer_write(send_buffer_t* send_buffer, const uint8_t* buf, uint32_t
 // dump 'len' bytes starting from 'last_byte_acked_index' into 'data' for sendto()
 void send_buffer_dump(send_buffer_t* send_buffer, uint32_t start_index, uint32_t len, uint8_t* data);
 
+// copy 'len' bytes starting from 'start_index' into 'data', without counting them as sent
+// (the data a fast open SYN carries, which the other side may not take)
+void send_buffer_peek(send_buffer_t* send_buffer, uint32_t start_index, uint32_t len, uint8_t* data);
+
 // free the resources
 void send_buffer_clean(send_buffer_t* send_buffer);
 
@@ -40,6 +113,54 @@ void send_buffer_clean(send_buffer_t* send_buffer);
 // last_byte_acked_seqnum : the sequence number of the lastest byte that is actually RECEIVED
 void send_buffer_update_ack(send_buffer_t* send_buffer, uint32_t hdr_ack);
 
+// record that the bytes [seq, seq+len) were just put on the wire
+void send_buffer_on_send(send_buffer_t* send_buffer, uint32_t seq, uint32_t len, uint64_t now_us);
+
+// the application did not give enough data to fill the window; the segments sent until
+// what is in flight now is delivered give app-limited rate samples
+void send_buffer_mark_app_limited(send_buffer_t* send_buffer);
+
+// a duplicate ACK means the other side got a segment past a hole; count its 'len' bytes
+// as delivered now rather than all at once when the hole is filled
+void send_buffer_on_dupack(send_buffer_t* send_buffer, uint32_t len, uint64_t now_us);
+
+// drop the segments acknowledged by 'hdr_ack' and fill 'rs' with a delivery rate sample
+// must be called before send_buffer_update_ack()
+void send_buffer_ack_segments(send_buffer_t* send_buffer, uint32_t hdr_ack, uint64_t now_us,
+                              rate_sample_t* rs);
+
+// mark the segments that lie entirely inside one of the 'count' SACK blocks; the bytes
+// newly sacked count as delivered now. return how many there are
+uint32_t send_buffer_on_sack(send_buffer_t* send_buffer, const sack_block_t* blocks, uint32_t count,
+                             uint64_t now_us);
+
+// RACK : mark as lost the segments in flight sent before the most recently sent one known
+// delivered, if a round trip and 'reo_wnd_us' have passed since (RFC 8985 6.2). 'wait_us' is
+// set to when the next one will be, 0 if none is waiting; return the number of bytes newly marked
+uint32_t send_buffer_rack_mark_lost(send_buffer_t* send_buffer, uint32_t reo_wnd_us, uint64_t now_us,
+                                    uint64_t* wait_us);
+
+// mark the first unacknowledged segment as lost unless it was sacked or already sent again
+void send_buffer_mark_first_lost(send_buffer_t* send_buffer);
+
+// after a timeout : mark every segment not sacked as lost; with 'forget_sacks', also forget
+// what was sacked, in case the other side dropped it
+void send_buffer_mark_all_lost(send_buffer_t* send_buffer, bool forget_sacks);
+
+// find the first segment marked lost; false if there is none
+bool send_buffer_next_lost(send_buffer_t* send_buffer, uint32_t* seq, uint32_t* len);
+
+// find the last segment sent; false if nothing is in flight
+bool send_buffer_last_segment(send_buffer_t* send_buffer, uint32_t* seq, uint32_t* len);
+
+// bytes presumably still in the network : the unacknowledged ones that were neither sacked nor
+// lost (the "pipe" of RFC 6675)
+uint32_t send_buffer_in_flight(send_buffer_t* send_buffer);
+
+// treat every unacknowledged byte as never sent, so that it is sent again (go-back-N after a timeout)
+// an ACK for bytes sent before the rewind moves the last byte sent forward again
+void send_buffer_rewind(send_buffer_t* send_buffer);
+
 // return the number of unknowledged data
 uint32_t get_unacknowledged_count(send_buffer_t* send_buffer);
 
@@ -47,4 +168,7 @@ uint32_t get_last_byte_sent_seqnum(send_buffer_t* send_buffer);
 
 uint8_t* get_buf_at_index_send(send_buffer_t* send_buffer, uint32_t index);
 
+// index in the buffer of the byte with sequence number 'seqnum' (last_byte_acked_seqnum or later)
+uint32_t seqnum_to_index_send(send_buffer_t* send_buffer, uint32_t seqnum);
+
 #endif  // PROJECT_2_15_441_INC_SEND_BUFFER_H_
\ No newline at end of file
@@ -0,0 +1,21 @@
+/**
+ * This file defines the keyed hash behind the cookies of CMU-TCP, fast open
+ * cookies (see fastopen.h) and SYN cookies (see syncookie.h) : SipHash-2-4,
+ * under a key drawn once per process. Only this process can compute a cookie,
+ * and its cookies stay valid as long as it runs.
+ */
+
+#ifndef PROJECT_2_15_441_INC_SIPHASH_H_
+#define PROJECT_2_15_441_INC_SIPHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SipHash-2-4 of the 'len' bytes at 'data' under the process key
+uint64_t siphash(const void* data, size_t len);
+
+// SipHash-2-4 of the 'len' bytes at 'data' under the key 'k' (k[0] holds the
+// first 8 key bytes, little endian)
+uint64_t siphash_keyed(const uint64_t k[2], const void* data, size_t len);
+
+#endif  // PROJECT_2_15_441_INC_SIPHASH_H_
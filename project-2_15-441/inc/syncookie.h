@@ -0,0 +1,65 @@
+/**
+ * This file defines SYN cookies for the CMU-TCP listener : answering a SYN
+ * without keeping anything of it, so that a flood of SYNs from forged
+ * addresses costs the listener no memory and cannot keep a real client out.
+ *
+ * The listener picks the sequence number of the SYN-ACK (its ISN) as a cookie
+ * that holds what it needs of the SYN, and only accepts the connection when
+ * the client's ACK brings the cookie back, as its ACK number minus one. The
+ * 32 bits of the cookie are
+ *
+ *   31..27  a counter that ticks every SYNCOOKIE_PERIOD_US, for cookies to
+ *           expire after SYNCOOKIE_MAX_AGE ticks
+ *   26..24  the client's MSS offer, rounded down to one of 8 sizes (0 : no
+ *           MSS option)
+ *   23      whether the client offered SACK
+ *   22..19  the client's window scale plus one (0 : no window scale option)
+ *   18..0   a keyed hash (see siphash.h) of the client's address, port and
+ *           ISN (the ACK's sequence number minus one) and of the bits above
+ *
+ * so a forged ACK has one chance in 2^19 to be taken. The timestamp option
+ * needs no room : the client's ACK carries it if both ends agreed on it.
+ * Fast open data in the SYN is not taken (the client sends it again after the
+ * handshake), unless its cookie proves the address (see fastopen.h).
+ *
+ * A listener holds one SYN half-open at a time. CMU_TCP_SYNCOOKIES picks when
+ * it answers with a cookie instead :
+ *   0  never : the listener holds the latest SYN, a flood keeps replacing it
+ *   1  when it already holds one, from another SYN (the default)
+ *   2  always : the listener holds nothing until the handshake is over
+ */
+
+#ifndef PROJECT_2_15_441_INC_SYNCOOKIE_H_
+#define PROJECT_2_15_441_INC_SYNCOOKIE_H_
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "extension.h"
+
+#define SYNCOOKIE_PERIOD_US 64000000ull
+#define SYNCOOKIE_MAX_AGE 2
+
+#define SYNCOOKIE_NEVER 0
+#define SYNCOOKIE_WHEN_BUSY 1
+#define SYNCOOKIE_ALWAYS 2
+
+#define SYNCOOKIE_ENV "CMU_TCP_SYNCOOKIES"
+
+// the cookie answering, at 'now_us', the SYN of the client at 'client' with ISN
+// 'client_isn' and options 'opts'
+uint32_t syncookie_make(const struct sockaddr_in* client, uint32_t client_isn,
+                        const ext_opts_t* opts, uint64_t now_us);
+
+// whether 'cookie' answered, less than SYNCOOKIE_MAX_AGE ticks before 'now_us',
+// a SYN of the client at 'client' with ISN 'client_isn'; if so, set the MSS,
+// SACK permitted and window scale options of that SYN in 'opts'
+bool syncookie_check(const struct sockaddr_in* client, uint32_t client_isn,
+                     uint32_t cookie, uint64_t now_us, ext_opts_t* opts);
+
+// when the listener answers with a cookie (CMU_TCP_SYNCOOKIES) : one of
+// SYNCOOKIE_NEVER, SYNCOOKIE_WHEN_BUSY or SYNCOOKIE_ALWAYS
+int syncookie_mode();
+
+#endif  // PROJECT_2_15_441_INC_SYNCOOKIE_H_
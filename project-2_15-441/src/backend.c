@@ -17,37 +17,556 @@
 
 #include "backend.h"
 
-#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
 #include "cmu_packet.h"
 #include "cmu_tcp.h"
+#include "congestion.h"
+#include "extension.h"
+#include "fastopen.h"
+#include "io_engine.h"
+#include "pacer.h"
 #include "recv_buffer.h"
+#include "rto.h"
 #include "send_buffer.h"
+#include "syncookie.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
+// packets handled back to back before the backend looks at its timers again
+#define MAX_PACKETS_PER_WAKEUP 64
+
 /* ******************************************************************************************* */
 /* ******************************************************************************************* */
 /* ******************************************************************************************* */
 
+// hand a packet to the socket's I/O engine; it is copied, so the caller can free it right away
+void send_packet(cmu_socket_t *sock, uint8_t *pkt, uint16_t plen) {
+  io_engine_send(&(sock->io), pkt, plen, &(sock->conn));
+}
+
+// build the options of a packet with 'flags' into 'ext', in at most 'room' bytes; return their
+// length. a SYN offers what this end wants; after it, packets carry what both ends agreed on
+// takes recv_lock
+uint16_t put_extensions(cmu_socket_t *sock, uint8_t *ext, uint8_t flags, uint16_t room) {
+  uint16_t ext_len = 0;
+  if (sock->window.mss_offer != 0 && (flags & SYN_FLAG_MASK)) {
+    ext_len = ext_put_mss(ext, ext_len, sock->window.mss_offer);
+  }
+  if (sock->window.wscale_ok && (flags & SYN_FLAG_MASK)) {
+    ext_len = ext_put_window_scale(ext, ext_len, sock->window.rcv_wscale);
+  }
+  if (sock->window.fastopen_ok && (flags & SYN_FLAG_MASK) && sock->type == TCP_INITIATOR) {
+    ext_len = ext_put_fastopen(ext, ext_len, sock->window.fastopen_cookie, sock->window.fastopen_len);
+  }
+  if (sock->window.ts_ok) {
+    ext_len = ext_put_timestamp(ext, ext_len, ext_timestamp_now(), sock->window.ts_recent);
+  }
+  if (sock->window.probe_ack != 0 && ext_len + EXT_PROBE_LEN <= room) {
+    ext_len = ext_put_probe(ext, ext_len, EXT_KIND_PROBE_ACK, sock->window.probe_ack);
+    sock->window.probe_ack = 0;
+  }
+  if (sock->window.sack_ok && (flags & SYN_FLAG_MASK)) {
+    ext_len = ext_put_sack_permitted(ext, ext_len);
+  } else if (sock->window.sack_ok && (flags & ACK_FLAG_MASK)) {
+    sack_block_t blocks[EXT_MAX_SACK_BLOCKS];
+    while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+    }
+    uint32_t count = recv_buffer_sack_blocks(sock->recv_buf, blocks, EXT_MAX_SACK_BLOCKS);
+    pthread_mutex_unlock(&(sock->recv_lock));
+    ext_len = ext_put_sack(ext, ext_len, room, blocks, count);
+  }
+  return ext_len;
+}
+
+// whether the 'len' bytes in 'pkt' hold a whole packet whose lengths add up
+bool packet_is_valid(uint8_t *pkt, ssize_t len) {
+  if (len < (ssize_t)sizeof(cmu_tcp_header_t)) {
+    return false;
+  }
+  cmu_tcp_header_t *hdr = (cmu_tcp_header_t *)pkt;
+  return get_hlen(hdr) == sizeof(cmu_tcp_header_t) + get_extension_length(hdr) &&
+         get_hlen(hdr) <= get_plen(hdr) && get_plen(hdr) <= len;
+}
+
+// an RTT sample from the TSecr of a packet, 0 if it has none
+uint32_t timestamp_rtt_us(cmu_socket_t *sock, ext_opts_t *opts) {
+  if (!sock->window.ts_ok || !opts->has_timestamp || opts->ts_ecr == 0) {
+    return 0;
+  }
+  uint32_t rtt_us = ext_timestamp_now() - opts->ts_ecr;
+  // an echo from the future, or older than any RTO, is bogus
+  if (rtt_us >= RTO_MAX_US) {
+    return 0;
+  }
+  return MAX(rtt_us, 1);
+}
+
+// how far advertising 'room' bytes at ACK number 'ack' moves the right edge of the window
+// past the last one advertised; not positive if it does not
+int32_t window_edge_gain(cmu_socket_t *sock, uint32_t ack, uint32_t room) {
+  uint32_t window = room >> sock->window.rcv_wscale << sock->window.rcv_wscale;
+  return (int32_t)((ack + window) - (sock->window.last_ack_sent + sock->window.adv_window_sent));
+}
+
+// the smallest move of the right edge worth advertising : 2 MSS, or half the receive buffer
+// if that is less, but a full segment at least, lest a buffer under 2 MSS open in slivers
+// the other side sends as short segments. a buffer under a segment opens all at once, which
+// is its capacity less the byte it keeps free
+uint32_t window_update_threshold(cmu_socket_t *sock) {
+  uint32_t capacity = sock->recv_buf->capacity;
+  return MIN(2 * (uint32_t)MSS, MAX(capacity / 2, MIN(sock->window.mss, capacity - 1)));
+}
+
+bool window_update_due(cmu_socket_t *sock, uint32_t ack, uint32_t room) {
+  return window_edge_gain(sock, ack, room) >= (int32_t)window_update_threshold(sock);
+}
+
+// the receive window to put in a packet, 'room' bytes scaled down; remembered unscaled in
+// adv_window_sent, with the ACK number of the packet in last_ack_sent. the right edge stays
+// where it was until it can move by a useful amount, rather than open a sliver at a time as
+// the application reads (RFC 9293 3.8.6.2.2)
+// recv_lock already hold by the caller : cmu_read() reads both to tell when the window opened
+uint16_t advertise_window(cmu_socket_t *sock, uint32_t room) {
+  uint32_t ack = sock->window.next_seq_expected;
+  uint32_t old_edge = sock->window.last_ack_sent + sock->window.adv_window_sent;
+  int32_t gain = window_edge_gain(sock, ack, room);
+  if (gain > 0 && gain < (int32_t)window_update_threshold(sock) && !after(ack, old_edge)) {
+    room = MIN(room, old_edge - ack);
+  }
+  uint16_t adv_window = MIN(room >> sock->window.rcv_wscale, (uint32_t)UINT16_MAX);
+  sock->window.adv_window_sent = (uint32_t)adv_window << sock->window.rcv_wscale;
+  sock->window.last_ack_sent = ack;
+  return adv_window;
+}
+
+// the window advertised by the other side in 'hdr', in bytes
+uint32_t received_window(cmu_socket_t *sock, cmu_tcp_header_t *hdr) {
+  return (uint32_t)get_advertised_window(hdr) << sock->window.snd_wscale;
+}
+
+// the bytes of options every segment carries : the timestamp option, once both ends agreed on
+// it. they come out of the segment size, as an MSS option counts them in (RFC 9293 3.7.1)
+static uint32_t segment_ext_len(cmu_socket_t *sock) {
+  return sock->window.ts_ok ? EXT_TIMESTAMP_LEN : 0;
+}
+
+// the payload of a full segment : what path MTU discovery found the path carries, but no
+// more than half the largest window the other side advertised, so that its window holds
+// two segments at least, less the options every segment carries. the congestion control and
+// the pacer count in these segments
+// send_lock already hold by the caller
+void update_mss(cmu_socket_t *sock) {
+  uint32_t mss = MIN(sock->pmtu.mss, MAX(sock->window.max_rcvd_window / 2, (uint32_t)MSS)) -
+                 segment_ext_len(sock);
+  sock->window.mss = mss;
+  sock->cc.mss = mss;
+  sock->pacer.mss = mss;
+}
+
+// send a pure ACK carrying the current next_seq_expected and receive window; it covers
+// any ACK held back
+void send_ack(cmu_socket_t *sock) {
+  uint16_t payload_len = 0;
+  uint8_t *payload = NULL;
+  uint8_t flags = ACK_FLAG_MASK;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = put_extensions(sock, ext_data, flags, EXT_MAX_LEN);
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(sock->conn.sin_port);
+  uint32_t seq = sock->window.last_ack_received;
+  uint32_t ack = sock->window.next_seq_expected;
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = hlen + payload_len;
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  uint16_t adv_window = advertise_window(sock, recv_buffer_max_receive(sock->recv_buf));
+  pthread_mutex_unlock(&(sock->recv_lock));
+  sock->stats.acks_sent += 1;
+  pthread_mutex_unlock(&(sock->send_lock));
+  sock->window.segs_unacked = 0;
+  sock->window.delack_deadline_us = 0;
+  sock->window.ack_now = false;
+
+  uint8_t *packet =
+      create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                    ext_len, ext_data, payload, payload_len);
+
+  send_packet(sock, packet, plen);
+  free_packet(packet);
+}
+
+// send the SYN-ACK again, acknowledging everything received so far : a server that took the data
+// of a fast open SYN left the handshake without waiting for the client to get it
+void send_syn_ack(cmu_socket_t *sock) {
+  uint8_t flags = SYN_FLAG_MASK | ACK_FLAG_MASK;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = put_extensions(sock, ext_data, flags, EXT_MAX_LEN);
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(sock->conn.sin_port);
+  uint32_t seq = sock->window.last_ack_received;  // still the ISN
+  uint32_t ack = sock->window.next_seq_expected;
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = hlen;
+  uint16_t adv_window = CP1_WINDOW_SIZE;
+  // the window of a SYN is not scaled
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  sock->window.last_ack_sent = ack;
+  sock->window.adv_window_sent = CP1_WINDOW_SIZE;
+  pthread_mutex_unlock(&(sock->recv_lock));
+
+  uint8_t *packet =
+      create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                    ext_len, ext_data, NULL, 0);
+
+  send_packet(sock, packet, plen);
+  free_packet(packet);
+}
+
+// acknowledge a data segment just received : right away if 'now', as the other side detects
+// losses from these ACKs. for every ack_frequency segments, early in the connection, or when
+// the receive window runs low, the ACK is owed by the end of this round of the backend loop,
+// so that data sent meanwhile carries it; otherwise it is held back for up to delack_us.
+// 'window_low' tells the window runs low and that reading what the buffer holds would not
+// make up a window update : if it would, that update carries the ACK, rather than two ACKs
+// going out for one segment
+void ack_data(cmu_socket_t *sock, bool now, bool window_low) {
+  sock->window.segs_unacked += 1;
+  if (now) {
+    send_ack(sock);
+    return;
+  }
+  if (sock->window.quick_acks > 0) {
+    sock->window.quick_acks -= 1;
+    sock->window.ack_now = true;
+  }
+  // the application may set both at any time
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  int ack_frequency = sock->ack_frequency;
+  int delack_us = sock->delack_us;
+  pthread_mutex_unlock(&(sock->send_lock));
+  if (delack_us == 0 || sock->window.segs_unacked >= (uint32_t)ack_frequency || window_low) {
+    sock->window.ack_now = true;
+  } else if (sock->window.delack_deadline_us == 0) {
+    sock->window.delack_deadline_us = get_time_us() + delack_us;
+  }
+}
+
+// bytes that may be in flight : the smaller of the congestion and advertised windows
+uint32_t send_window(cmu_socket_t *sock) {
+  return MIN(sock->cc.cwnd, (uint32_t)sock->window.rcvd_advertised_window);
+}
+
+// arm the tail loss probe timer after new data went out or new data was acknowledged, if
+// data is in flight and neither a recovery nor another probe is under way (RFC 8985 7.2).
+// it fires 2 SRTT later, or with the retransmission timer if that comes first. the ACK of a
+// lone segment may be held back; the other side is taken to delay it no longer than we would
+// send_lock already hold by the caller
+void arm_tail_probe(cmu_socket_t *sock, uint64_t now_us) {
+  uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
+  sock->window.tlp_deadline_us = 0;
+  if (!sock->window.sack_ok || sock->rto.srtt_us == 0 || num_unacknowledged == 0 ||
+      sock->window.in_recovery || sock->window.in_loss || sock->window.tlp_in_flight ||
+      sock->window.rcvd_advertised_window == 0) {
+    return;
+  }
+  uint64_t pto_us = 2 * (uint64_t)sock->rto.srtt_us;
+  if (num_unacknowledged <= sock->window.mss) {
+    pto_us += sock->delack_us;
+  }
+  uint64_t rto_deadline_us = sock->send_buf->last_byte_acked_us + sock->rto.rto_us;
+  sock->window.tlp_deadline_us = MIN(now_us + pto_us, rto_deadline_us);
+}
+
+// the persist timer (RFC 9293 3.8.6.1) : while the other side's window is closed, probe it
+// one RTO from now, twice as long after every probe, up to RTO_MAX_US. the retransmission
+// timer waits meanwhile; whatever is in flight lies beyond the window
+// send_lock already hold by the caller
+void arm_persist_timer(cmu_socket_t *sock, uint64_t now_us) {
+  uint64_t interval_us = (uint64_t)sock->rto.rto_us << MIN(sock->window.persist_backoff, 16u);
+  sock->window.persist_deadline_us = now_us + MIN(interval_us, (uint64_t)RTO_MAX_US);
+}
+
+// the other side advertised 'window' bytes : start the persist timer if it closed, stop it
+// if it opened again
+// send_lock already hold by the caller
+void update_persist_timer(cmu_socket_t *sock, uint32_t window, uint64_t now_us) {
+  if (window == 0 && sock->window.persist_deadline_us == 0) {
+    arm_persist_timer(sock, now_us);
+  } else if (window > 0 && sock->window.persist_deadline_us != 0) {
+    sock->window.persist_deadline_us = 0;
+    sock->window.persist_backoff = 0;
+    // the retransmission timer starts over rather than fire for the time spent waiting
+    sock->send_buf->last_byte_acked_us = now_us;
+  }
+}
+
+// send a zero window probe : one byte the other side already has, which it drops, but
+// answers with an ACK carrying its current window. a probe of new data would stick out of
+// the window, and be in flight once the window opens
+// send_lock already hold by the caller
+void send_window_probe(cmu_socket_t *sock) {
+  uint8_t payload[1] = {0};
+  uint16_t payload_len = 1;
+  uint8_t flags = ACK_FLAG_MASK;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = put_extensions(sock, ext_data, flags, EXT_MAX_LEN);
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(sock->conn.sin_port);
+  uint32_t seq = sock->window.last_ack_received - 1;
+  uint32_t ack = sock->window.next_seq_expected;
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = hlen + payload_len;
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  uint16_t adv_window = advertise_window(sock, recv_buffer_max_receive(sock->recv_buf));
+  pthread_mutex_unlock(&(sock->recv_lock));
+  sock->stats.window_probes += 1;
+
+  uint8_t *packet =
+      create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                    ext_len, ext_data, payload, payload_len);
+
+  send_packet(sock, packet, plen);
+  free_packet(packet);
+}
+
+// send a path MTU probe as long as a segment of 'size' bytes, options included : a probe
+// option, then padding that the other side does not take as data. it only answers,
+// with a probe ACK, so the packet neither acknowledges nor advertises anything new
+// send_lock already hold by the caller
+void send_pmtu_probe(cmu_socket_t *sock, uint32_t size, uint64_t now_us) {
+  static uint8_t padding[MAX_MSS];
+  uint8_t flags = ACK_FLAG_MASK;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = ext_put_probe(ext_data, 0, EXT_KIND_PROBE, size);
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(sock->conn.sin_port);
+  uint32_t seq = sock->window.last_ack_received;
+  uint32_t ack = sock->window.last_ack_sent;
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = sizeof(cmu_tcp_header_t) + size;
+  uint16_t adv_window = sock->window.adv_window_sent >> sock->window.rcv_wscale;
+  sock->stats.pmtu_probes += 1;
+
+  uint8_t *packet =
+      create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                    ext_len, ext_data, padding, plen - hlen);
+
+  send_packet(sock, packet, plen);
+  free_packet(packet);
+  // the answer comes at once : unanswered within 2 SRTT (or the RTO before the first sample),
+  // it is sent again or taken as too large
+  uint64_t timeout_us = sock->rto.rto_us;
+  if (sock->rto.srtt_us > 0) {
+    timeout_us = MIN(timeout_us, MAX(2 * (uint64_t)sock->rto.srtt_us, (uint64_t)RTO_GRANULARITY_US));
+  }
+  pmtu_on_probe_sent(&(sock->pmtu), size, timeout_us, now_us);
+}
+
+// whether 'len' bytes of new data, less than a full segment, should wait for more. if the
+// window limits them ('window_limited'), they wait for it to open to half the largest window
+// seen, as long as an ACK is to come (sender-side silly window syndrome avoidance, RFC 9293
+// 3.8.6.2.1). otherwise Nagle's algorithm (RFC 9293 3.7.4) in Minshall's form, where a
+// short segment waits only while an earlier short one is unacknowledged, so that a lone
+// short write is not held up behind full segments. with CMU_SO_CORK it waits for a full
+// segment; with CMU_SO_NODELAY it never waits. nothing waits for more data once the
+// application closes the socket
+// send_lock already hold by the caller
+bool hold_small_segment(cmu_socket_t *sock, uint32_t len, bool window_limited) {
+  if (len == 0 || len >= sock->window.mss) {
+    return false;
+  }
+  if (window_limited && len < sock->window.max_rcvd_window / 2 &&
+      get_unacknowledged_count(sock->send_buf) > 0) {
+    return true;
+  }
+  while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+  }
+  bool closing = sock->dying;
+  pthread_mutex_unlock(&(sock->death_lock));
+  if (closing) {
+    return false;
+  }
+  if (sock->cork) {
+    return true;
+  }
+  return !sock->nodelay && after(sock->window.small_end_seq, sock->window.last_ack_received);
+}
+
+// send the 'payload_len' bytes of the send buffer starting at 'seq' as one data segment
+// send_lock already hold by the caller
+void send_segment(cmu_socket_t *sock, uint32_t seq, uint16_t payload_len) {
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(sock->conn.sin_port);
+  uint32_t ack = sock->window.next_seq_expected;
+  uint8_t flags = ACK_FLAG_MASK;
+  // SACK blocks only if they fit next to the payload, in a packet no longer than a full segment
+  uint32_t room = sock->window.mss + segment_ext_len(sock);
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = put_extensions(sock, ext_data, flags,
+                                    MIN(EXT_MAX_LEN, room > payload_len ? room - payload_len : 0));
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = hlen + payload_len;
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  uint16_t adv_window = advertise_window(sock, recv_buffer_max_receive(sock->recv_buf));
+  pthread_mutex_unlock(&(sock->recv_lock));
+  uint8_t payload[MAX_MSS];
+
+  // this also moves the last byte sent forward when these bytes were never sent
+  uint32_t start_index = seqnum_to_index_send(sock->send_buf, seq);
+  send_buffer_dump(sock->send_buf, start_index, payload_len, payload);
+
+  uint8_t *msg = create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                               ext_len, ext_data, payload, payload_len);
+  send_packet(sock, msg, plen);
+  free_packet(msg);
+  if (sock->window.segs_unacked > 0) {
+    // this segment carries the ACK that was owed or held back. data flowing back soon after
+    // data came in looks interactive : stop the quick ACKs, whose pure ACKs data would
+    // carry if they waited a little
+    sock->stats.acks_piggybacked += 1;
+    sock->window.segs_unacked = 0;
+    sock->window.delack_deadline_us = 0;
+    sock->window.ack_now = false;
+    sock->window.quick_acks = 0;
+  }
+
+  uint64_t now_us = get_time_us();
+  if (sock->send_buf->segments_count == 0) {
+    // nothing was in flight : the retransmission timer starts now
+    sock->send_buf->last_byte_acked_us = now_us;
+  }
+  send_buffer_on_send(sock->send_buf, seq, payload_len, now_us);
+
+  uint32_t last_seq = seq + payload_len - 1;
+  bool retransmit = !after(last_seq, sock->window.high_seq_sent);
+  if (!retransmit) {
+    sock->window.high_seq_sent = last_seq;
+    if (payload_len < sock->window.mss) {
+      sock->window.small_end_seq = seq + payload_len;
+    }
+    arm_tail_probe(sock, now_us);
+  } else {
+    sock->stats.retransmits += 1;
+  }
+  cc_on_send(&(sock->cc), payload_len, send_buffer_in_flight(sock->send_buf), retransmit);
+}
+
+// resend only the first unacknowledged segment (fast retransmit, or a NewReno partial ACK)
+// send_lock already hold by the caller
+void retransmit_first_unacknowledged(cmu_socket_t *sock) {
+  uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
+  if (num_unacknowledged > 0) {
+    send_segment(sock, sock->send_buf->last_byte_acked_seqnum + 1,
+                 MIN(num_unacknowledged, sock->window.mss));
+  }
+}
+
+// fast retransmit : resend only the missing segment, then stay in fast recovery until
+// everything sent so far is acknowledged
+// send_lock already hold by the caller
+void enter_recovery(cmu_socket_t *sock) {
+  // a probe under way did its job : it showed the loss
+  sock->window.tlp_in_flight = false;
+  sock->window.tlp_deadline_us = 0;
+  sock->window.in_recovery = true;
+  sock->window.recover_seq = sock->window.high_seq_sent;
+  cc_on_loss(&(sock->cc), send_buffer_in_flight(sock->send_buf));
+  retransmit_first_unacknowledged(sock);
+}
+
+// RACK's reordering window (RFC 8985 6.2 step 4) : a quarter of the minimum RTT, or none
+// while no reordering was seen and recovery started or enough was sacked past the hole
+// send_lock already hold by the caller
+uint32_t rack_reo_wnd_us(cmu_socket_t *sock) {
+  send_buffer_t *buf = sock->send_buf;
+  if (!buf->rack_reordering_seen &&
+      (sock->window.in_recovery || sock->window.in_loss ||
+       buf->sacked_bytes >= CC_DUPACK_THRESHOLD * sock->window.mss)) {
+    return 0;
+  }
+  return MIN(buf->rack_min_rtt_us / 4, sock->rto.srtt_us);
+}
+
+// mark lost what RACK finds lost, and arm the reordering timer for the segments that will be
+// once their reordering window runs out
+// send_lock already hold by the caller
+void rack_detect_loss(cmu_socket_t *sock, uint64_t now_us) {
+  uint64_t wait_us;
+  send_buffer_rack_mark_lost(sock->send_buf, rack_reo_wnd_us(sock), now_us, &wait_us);
+  sock->window.rack_deadline_us = wait_us > 0 ? now_us + wait_us : 0;
+}
+
+// take in the SACK blocks of an ACK and mark the segments they show to be lost
+// return the bytes newly sacked
+// send_lock already hold by the caller
+uint32_t process_sack(cmu_socket_t *sock, ext_opts_t *opts) {
+  uint64_t now_us = get_time_us();
+  uint32_t newly = send_buffer_on_sack(sock->send_buf, opts->sack, opts->sack_count, now_us);
+  rack_detect_loss(sock, now_us);
+  return newly;
+}
+
+// with SACK, a segment found lost outside of any recovery starts fast recovery
+// send_lock already hold by the caller
+void check_sack_loss(cmu_socket_t *sock) {
+  if (sock->window.sack_ok && sock->send_buf->lost_bytes > 0 && !sock->window.in_recovery &&
+      !sock->window.in_loss) {
+    enter_recovery(sock);
+  }
+}
+
 void handle_message(void *in, uint8_t* pkt) {
   cmu_socket_t *sock = (cmu_socket_t *)in;
-  socklen_t conn_len = sizeof(sock->conn);
   cmu_tcp_header_t* hdr = (cmu_tcp_header_t*)pkt;
 
+  // a SYN after the handshake is a late retransmission; the handshake is already done. a
+  // server that answered a fast open SYN before the end of the handshake is still in SYN_RCVD,
+  // and its SYN-ACK may be what got lost
+  if (get_flags(hdr) & SYN_FLAG_MASK) {
+    if (sock->state == SYN_RCVD) {
+      send_syn_ack(sock);
+    }
+    return;
+  }
   // require all packets to carry ACK number and advertised_window
   assert(get_flags(hdr) & ACK_FLAG_MASK);
-  // should not see a SYN packet after initial handshake
-  assert(!(get_flags(hdr) & SYN_FLAG_MASK));
+  if (sock->state == SYN_RCVD && after(get_ack(hdr), sock->window.last_ack_received)) {
+    // the client got the SYN-ACK
+    sock->state = ESTABLISHED;
+  }
+  ext_opts_t opts;
+  if (ext_parse(get_extension_data(hdr), get_extension_length(hdr), &opts) != 0) {
+    return;
+  }
+  if (opts.probe != 0) {
+    // a path MTU probe : tell the other side it got here. the rest of it is padding
+    sock->window.probe_ack = opts.probe;
+    send_ack(sock);
+    return;
+  }
+  if (sock->window.ts_ok && opts.has_timestamp &&
+      !after(get_seq(hdr), sock->window.last_ack_sent)) {
+    // echo the TSval of the segment that moves (or would move) the last ACK sent, not of one
+    // past a hole, nor of a later one sharing a delayed ACK (RFC 7323 4.3) : the ACK that
+    // finally covers a retransmission times the retransmission, and the delay is in the RTT
+    sock->window.ts_recent = opts.ts_val;
+  }
 
   if (get_flags(hdr) & FIN_FLAG_MASK) {
     // TDDO : special handling for a FIN packet
@@ -55,68 +574,164 @@ void handle_message(void *in, uint8_t* pkt) {
   } else {
     // update ACK
     uint32_t acknum = get_ack(hdr);
-    if (acknum == sock->window.last_ack_received) {
-      // TODO : duplicate ACK, congestion control
-
-    } else {
-      sock->window.last_ack_received = MAX(sock->window.last_ack_received, acknum);
-      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
-      }
+    uint16_t payload_len = get_payload_len(pkt);
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    if (after(acknum, sock->window.last_ack_received)) {
+      cc_ack_t ack;
+      rate_sample_t rs;
+      ack.acked = acknum - sock->window.last_ack_received;
+      ack.now_us = get_time_us();
+      sock->window.last_ack_received = acknum;
+      sock->window.dup_acks = 0;
+      pmtu_on_ack(&(sock->pmtu));
+      send_buffer_ack_segments(sock->send_buf, acknum, ack.now_us, &rs);
       send_buffer_update_ack(sock->send_buf, acknum);
-      pthread_mutex_unlock(&(sock->send_lock));
+      if (sock->window.in_loss && after(acknum, sock->window.recover_seq)) {
+        // everything outstanding at the timeout is acknowledged
+        sock->window.in_loss = false;
+      }
+      ack.recovery = CC_RECOVERY_NONE;
+      if (sock->window.in_recovery) {
+        if (after(acknum, sock->window.recover_seq)) {
+          // everything outstanding when the loss was detected is acknowledged
+          sock->window.in_recovery = false;
+          ack.recovery = CC_RECOVERY_DONE;
+        } else {
+          ack.recovery = CC_RECOVERY_PARTIAL;
+        }
+      }
+      if (sock->window.sack_ok) {
+        // blocks above the ACK : what is still in flight depends on them
+        process_sack(sock, &opts);
+      }
+      ack.inflight = send_buffer_in_flight(sock->send_buf);
+      ack.delivered = rs.delivered;
+      ack.prior_delivered = rs.prior_delivered;
+      ack.interval_us = rs.interval_us;
+      ack.delivery_rate = rs.delivery_rate;
+      ack.app_limited = rs.app_limited;
+      // the echoed timestamp times the segment that made the other side ACK, retransmitted
+      // or not; the send buffer's own sample (Karn) is the fallback when there is none
+      ack.rtt_us = timestamp_rtt_us(sock, &opts);
+      if (ack.rtt_us > 0) {
+        sock->stats.ts_rtt_samples += 1;
+      } else {
+        ack.rtt_us = rs.rtt_us;
+      }
+      if (ack.rtt_us > 0) {
+        rto_on_sample(&(sock->rto), ack.rtt_us);
+        sock->stats.rtt_samples += 1;
+      }
+      cc_on_ack(&(sock->cc), &ack);
+      if (ack.recovery == CC_RECOVERY_PARTIAL) {
+        // NewReno : the segment right after the one just recovered is lost too. with SACK
+        // it goes out with the other lost segments, as the window allows
+        if (sock->window.sack_ok) {
+          send_buffer_mark_first_lost(sock->send_buf);
+        } else {
+          retransmit_first_unacknowledged(sock);
+        }
+      }
+      check_sack_loss(sock);
+      if (sock->window.tlp_in_flight && after(acknum, sock->window.tlp_end_seq)) {
+        // the probe's episode is over without a recovery (RFC 8985 7.4). if the probe sent old
+        // data again, it alone repaired a loss, which the congestion control has to hear about
+        sock->window.tlp_in_flight = false;
+        if (sock->window.tlp_retransmit) {
+          cc_on_loss(&(sock->cc), send_buffer_in_flight(sock->send_buf));
+        }
+      }
+      arm_tail_probe(sock, ack.now_us);
+      // wake up writers waiting for send buffer space
+      pthread_cond_broadcast(&(sock->send_cond));
+    } else if (acknum == sock->window.last_ack_received && payload_len == 0 && opts.probe_ack == 0) {
+      uint32_t inflight = get_unacknowledged_count(sock->send_buf);
+      uint32_t adv_window = received_window(sock, hdr);
+      if (inflight > 0 && sock->window.sack_ok) {
+        // the blocks tell exactly what got past the hole
+        process_sack(sock, &opts);
+      } else if (inflight > 0) {
+        // the other side only ACKs the data it gets : it got a segment past a hole, whether
+        // or not its window moved meanwhile
+        send_buffer_on_dupack(sock->send_buf, sock->window.mss, get_time_us());
+      }
+      // a pure ACK that neither acknowledges new data nor updates the window
+      if (inflight > 0 && adv_window == sock->window.rcvd_advertised_window) {
+        sock->window.dup_acks += 1;
+        cc_on_dupack(&(sock->cc), sock->window.dup_acks, send_buffer_in_flight(sock->send_buf));
+        // with SACK, RACK tells what is lost instead
+        if (sock->window.dup_acks == CC_DUPACK_THRESHOLD && !sock->window.sack_ok &&
+            !sock->window.in_recovery && !sock->window.in_loss) {
+          enter_recovery(sock);
+        }
+      }
+      check_sack_loss(sock);
     }
 
     // update advertised window
-    sock->window.rcvd_advertised_window = get_advertised_window(hdr);
-    if (sock->window.rcvd_advertised_window == 0) {
-      // TODO : zero window probe
-
+    sock->window.rcvd_advertised_window = received_window(sock, hdr);
+    if (opts.probe_ack != 0 && pmtu_on_probe_ack(&(sock->pmtu), opts.probe_ack, get_time_us())) {
+      update_mss(sock);
+    }
+    if (sock->window.rcvd_advertised_window > sock->window.max_rcvd_window) {
+      sock->window.max_rcvd_window = sock->window.rcvd_advertised_window;
+      update_mss(sock);
     }
+    update_persist_timer(sock, sock->window.rcvd_advertised_window, get_time_us());
+    pthread_mutex_unlock(&(sock->send_lock));
 
-    uint16_t payload_len = get_payload_len(pkt);
     if (payload_len != 0) {
       // not pure-ACK packet, has some data
       uint32_t seqnum = get_seq(hdr);
       // doesn't matter if the seqnum is what we expected, we still try to receive it
       // after receiving it and update the internal recv_buffer, then send an ACK back
+      // data out of order, filling a hole, or not taken is ACKed at once : the other side
+      // detects losses from these ACKs
+      bool urgent = seqnum != sock->window.next_seq_expected;
       while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
       }
+      urgent = urgent || recv_buffer_has_ooo(sock->recv_buf);
       if (recv_buffer_can_receive(sock->recv_buf, seqnum, payload_len) == 0) {
         recv_buffer_receive(sock->recv_buf, seqnum, payload_len, get_payload(pkt));
         pthread_cond_signal(&(sock->wait_cond));
         // printf("notified\n");
+      } else {
+        urgent = true;
       }
       sock->window.next_seq_expected = get_next_byte_expected_seqnum(sock->recv_buf);
-      pthread_mutex_unlock(&(sock->recv_lock));
-      
-      // respond with a pure ACK message
-      payload_len = 0;
-      uint8_t *payload = NULL;
-      uint16_t ext_len = 0;
-      uint8_t *ext_data = NULL;
-      uint16_t src = sock->my_port;
-      uint16_t dst = ntohs(sock->conn.sin_port);
-      uint32_t seq = sock->window.last_ack_received;
-      uint32_t ack = sock->window.next_seq_expected;
-      uint16_t hlen = sizeof(cmu_tcp_header_t);
-      uint16_t plen = hlen + ext_len + payload_len;
-      uint8_t flags = ACK_FLAG_MASK;
-      while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
-      }
-      uint16_t adv_window = recv_buffer_max_receive(sock->recv_buf);
+      uint32_t window_left = recv_buffer_max_receive(sock->recv_buf);
+      uint32_t window_read = window_left + recv_buffer_max_read(sock->recv_buf);
+      bool window_low = window_left < 2 * MSS &&
+                        !window_update_due(sock, sock->window.next_seq_expected, window_read);
       pthread_mutex_unlock(&(sock->recv_lock));
 
-      uint8_t *packet =
-          create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
-                        ext_len, ext_data, payload, payload_len);
-      
-      sendto(sock->socket, packet, plen, 0,
-          (struct sockaddr *)&(sock->conn), conn_len);
-      free(packet);
+      // respond with a pure ACK message, now or a little later
+      ack_data(sock, urgent, window_low);
     }
   }
 }
 
+// window scaling is on if both SYNs offered it; otherwise neither side scales
+void set_window_scale(cmu_socket_t *sock, ext_opts_t *opts) {
+  sock->window.wscale_ok = sock->window.wscale_ok && opts->has_wscale;
+  sock->window.snd_wscale = sock->window.wscale_ok ? opts->wscale : 0;
+  if (!sock->window.wscale_ok) {
+    sock->window.rcv_wscale = 0;
+  }
+}
+
+// segments may grow past MSS if both SYNs carried the MSS option, as far as path MTU
+// discovery finds the path carries them; either way the options agreed on come out of them
+// send_lock already hold by the caller
+void start_pmtu(cmu_socket_t *sock, ext_opts_t *opts) {
+  if (sock->window.mss_offer != 0 && opts->mss != 0) {
+    pmtu_start(&(sock->pmtu), MIN(sock->window.mss_offer, (uint32_t)opts->mss),
+               pmtu_probe_enabled(), get_time_us());
+  }
+  update_mss(sock);
+}
+
 int counter1 = 0;
 int counter2 = 0;
 int counter3 = 0;
@@ -125,22 +740,61 @@ int counter1_lim = 0;
 int counter2_lim = 0;
 int counter3_lim = 0;
 
+// hold the SYN back until the application first reads, writes or closes the socket, for the
+// buffer sizes it sets before to apply; with fast open, until it writes, for the SYN to carry
+// the data, or reads or closes the socket first
+void wait_for_first_use(cmu_socket_t *sock) {
+  uint8_t buf[MAX_DATAGRAM_LEN];
+  struct sockaddr_in from;
+  while (true) {
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    if (sock->send_buf != NULL && send_buffer_max_new_dump(sock->send_buf) > 0) {
+      sock->syn_deferred = false;
+    }
+    bool deferred = sock->syn_deferred;
+    pthread_mutex_unlock(&(sock->send_lock));
+    if (!deferred) {
+      return;
+    }
+    // nothing is expected before the SYN : whatever arrives is dropped
+    io_engine_recv(&(sock->io), buf, MAX_DATAGRAM_LEN, &from, -1);
+  }
+}
+
 void init_handshake_client(void *in) {
   // printf("client start handshake\n");
   cmu_socket_t *sock = (cmu_socket_t *)in;
   assert(sock->type == TCP_INITIATOR);
+  wait_for_first_use(sock);
 
   // send the initial SYN packet
+  // offer timestamps, SACK, window scaling and fast open (ts_ok, sack_ok, wscale_ok and
+  // fastopen_ok are still only what this end wants), and tell the largest segment this end
+  // accepts
+  uint8_t syn_data[MAX_LEN];
   uint16_t payload_len = 0;
   uint8_t *payload = NULL;
-  uint16_t ext_len = 0;
-  uint8_t *ext_data = NULL;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = put_extensions(sock, ext_data, SYN_FLAG_MASK, EXT_MAX_LEN);
   uint16_t src = sock->my_port;
   uint16_t dst = ntohs(sock->conn.sin_port);
   uint32_t seq = sock->window.last_ack_received;
   uint32_t ack = 0; // ack doesn't matter in this SYN
-  uint16_t hlen = sizeof(cmu_tcp_header_t);
-  uint16_t plen = hlen + ext_len + payload_len;
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  if (sock->window.fastopen_len != 0) {
+    // with a cookie, as much of what the application wrote as fits in the packet. it stays
+    // unsent in the send buffer until the SYN-ACK tells how much the server took
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    payload_len = MIN(send_buffer_max_new_dump(sock->send_buf), (uint32_t)(MAX_LEN - hlen));
+    send_buffer_peek(sock->send_buf, seqnum_to_index_send(sock->send_buf, seq + 1), payload_len,
+                     syn_data);
+    pthread_mutex_unlock(&(sock->send_lock));
+    payload = syn_data;
+  }
+  uint16_t syn_data_len = payload_len;
+  uint16_t plen = hlen + payload_len;
   uint8_t flags = SYN_FLAG_MASK;
   uint16_t adv_window = CP1_WINDOW_SIZE;
   
@@ -148,45 +802,85 @@ void init_handshake_client(void *in) {
       create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
                     ext_len, ext_data, payload, payload_len);
 
-  socklen_t conn_len = sizeof(sock->conn);
+  uint8_t buf[MAX_DATAGRAM_LEN];
 
   if (counter1 >= counter1_lim) {
-    sendto(sock->socket, packet, plen, 0,
-          (struct sockaddr *)&(sock->conn), conn_len);
+    send_packet(sock, packet, plen);
   } else {
     counter1 += 1;
   }
+  long syn_sent_ms = get_time_ms();
   
   sock->state = SYN_SENT;
 
   while (sock->state != ESTABLISHED) {
     // wait at most DEFAULT_TIMEOUT for the reply
     // printf("client in while loop\n");
-    struct pollfd ack_fd;
-    ack_fd.fd = sock->socket;
-    ack_fd.events = POLLIN;
-    if (poll(&ack_fd, 1, DEFAULT_TIMEOUT) <= 0) {
+    long wait_ms = MAX(syn_sent_ms + DEFAULT_TIMEOUT - get_time_ms(), 0);
+    ssize_t len = io_engine_recv(&(sock->io), buf, MAX_DATAGRAM_LEN, &(sock->conn),
+                                 (int64_t)wait_ms * 1000);
+    if (len <= 0) {
+      if (get_time_ms() - syn_sent_ms < DEFAULT_TIMEOUT) {
+        // woken up by the application, keep waiting
+        continue;
+      }
       // reached timeout and still don't have ack, resend the packet
       // printf("re-send message\n");
+      if (payload_len > 0) {
+        // without the data, in case it is what does not get through : it goes out after the
+        // handshake instead
+        free_packet(packet);
+        payload_len = 0;
+        plen = hlen;
+        packet = create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
+                               ext_len, ext_data, NULL, 0);
+      }
       if (counter1 >= counter1_lim) {
-        sendto(sock->socket, packet, plen, 0,
-              (struct sockaddr *)&(sock->conn), conn_len);
+        send_packet(sock, packet, plen);
       } else {
         counter1 += 1;
       }
+      syn_sent_ms = get_time_ms();
     } else {
       cmu_tcp_header_t hdr;
-      ssize_t len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t),
-                     MSG_PEEK, (struct sockaddr *)&(sock->conn),
-                     &conn_len);
-      if (len == sizeof(cmu_tcp_header_t)) {
-        len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t), 0,
-                   (struct sockaddr *)&(sock->conn), &conn_len);
-        assert(len == sizeof(cmu_tcp_header_t));
-      
-        // the packet must be SYN-ACK
-        assert(get_flags(&hdr) & SYN_FLAG_MASK);
-        assert(get_flags(&hdr) & ACK_FLAG_MASK);
+      ext_opts_t opts;
+      // the packet must be SYN-ACK. a server that took the data of a fast open SYN may send
+      // more before it, if the SYN-ACK was lost : that comes again once the handshake is done.
+      // its ACK number may only acknowledge the SYN and part of the data of the first one; any
+      // other is a stale or forged SYN-ACK, dropped
+      uint32_t isn = sock->window.last_ack_received;
+      if (packet_is_valid(buf, len) && get_payload_len(buf) == 0 &&
+          (get_flags((cmu_tcp_header_t *)buf) & (SYN_FLAG_MASK | ACK_FLAG_MASK)) ==
+              (SYN_FLAG_MASK | ACK_FLAG_MASK) &&
+          !before(get_ack((cmu_tcp_header_t *)buf), isn + 1) &&
+          !after(get_ack((cmu_tcp_header_t *)buf), isn + 1 + syn_data_len) &&
+          ext_parse(get_extension_data((cmu_tcp_header_t *)buf),
+                    get_extension_length((cmu_tcp_header_t *)buf), &opts) == 0) {
+        memcpy(&hdr, buf, sizeof(cmu_tcp_header_t));
+
+        // timestamps are on only if the server echoed the option back
+        sock->window.ts_ok = sock->window.ts_ok && opts.has_timestamp;
+        if (sock->window.ts_ok) {
+          sock->window.ts_recent = opts.ts_val;
+          uint32_t rtt_us = timestamp_rtt_us(sock, &opts);
+          if (rtt_us > 0) {
+            // the SYN's round trip gives the RTO a first estimate
+            while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+            }
+            rto_on_sample(&(sock->rto), rtt_us);
+            sock->stats.rtt_samples += 1;
+            sock->stats.ts_rtt_samples += 1;
+            pthread_mutex_unlock(&(sock->send_lock));
+          }
+        }
+        // and so is SACK, and window scaling
+        sock->window.sack_ok = sock->window.sack_ok && opts.sack_permitted;
+        set_window_scale(sock, &opts);
+        while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+        }
+        sock->cc.sack = sock->window.sack_ok;
+        start_pmtu(sock, &opts);
+        pthread_mutex_unlock(&(sock->send_lock));
 
         // upon receiving the first SYN packet, 
         // use the ISN to initialize the receive_buffer
@@ -195,327 +889,559 @@ void init_handshake_client(void *in) {
         recv_buffer_initialize(sock->recv_buf, get_seq(&hdr));
         pthread_mutex_unlock(&(sock->recv_lock));
         
-        assert(get_ack(&hdr) == sock->window.last_ack_received + 1);
+        // the server may have taken part of the SYN's data; it is acknowledged, and the rest
+        // goes out after the handshake
+        uint32_t taken = get_ack(&hdr) - (isn + 1);
+        if (sock->window.fastopen_ok && opts.fastopen_len != 0) {
+          fastopen_cache_put(&(sock->conn), opts.fastopen_cookie, opts.fastopen_len);
+        } else if (payload_len > 0 && taken == 0) {
+          // the server got the cookie and the data but took neither : it does not do fast
+          // open any more
+          fastopen_cache_drop(&(sock->conn));
+        }
         sock->window.last_ack_received = get_ack(&hdr);
+        if (taken > 0) {
+          while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+          }
+          send_buffer_update_ack(sock->send_buf, get_ack(&hdr));
+          sock->window.high_seq_sent = get_ack(&hdr) - 1;
+          sock->stats.fastopen_bytes += taken;
+          // wake up writers waiting for send buffer space
+          pthread_cond_broadcast(&(sock->send_cond));
+          pthread_mutex_unlock(&(sock->send_lock));
+        }
         sock->window.next_seq_expected = get_seq(&hdr)+1;
 
         // send ACK packet
-        free(packet);
+        free_packet(packet);
 
         payload_len = 0;
         payload = NULL;
-        ext_len = 0;
-        ext_data = NULL;
+        ext_len = put_extensions(sock, ext_data, ACK_FLAG_MASK, EXT_MAX_LEN);
         src = sock->my_port;
         dst = ntohs(sock->conn.sin_port);
         seq = sock->window.last_ack_received;
         ack = sock->window.next_seq_expected;
-        hlen = sizeof(cmu_tcp_header_t);
-        plen = hlen + ext_len + payload_len;
+        hlen = sizeof(cmu_tcp_header_t) + ext_len;
+        plen = hlen + payload_len;
         flags = ACK_FLAG_MASK;
-        adv_window = CP1_WINDOW_SIZE;
+        // unlike the SYNs', the window of this ACK is scaled. the SYN advertised
+        // CP1_WINDOW_SIZE past the first byte expected
+        while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+        }
+        sock->window.last_ack_sent = sock->window.next_seq_expected;
+        adv_window = advertise_window(sock, recv_buffer_max_receive(sock->recv_buf));
+        pthread_mutex_unlock(&(sock->recv_lock));
         
         packet =
             create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
                           ext_len, ext_data, payload, payload_len);
 
         if (counter2 >= counter2_lim) {
-          sendto(sock->socket, packet, plen, 0,
-                (struct sockaddr *)&(sock->conn), conn_len);
+          send_packet(sock, packet, plen);
         } else {
           counter2 += 1;
         }
         
         // printf("client sent ack packet back\n");
 
-        free(packet);
+        free_packet(packet);
 
         sock->state = ESTABLISHED;
       }
     }
   }
 
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
   sock->initialized = true;
+  pthread_cond_broadcast(&(sock->wait_cond));
+  pthread_mutex_unlock(&(sock->recv_lock));
   printf("!-- client finished handshake --!\n");
 }
 
-void init_handshake_server(void *in) {
-  // printf("server start handshake\n");
-  cmu_socket_t *sock = (cmu_socket_t *)in;
-  socklen_t conn_len = sizeof(sock->conn);
-  assert(sock->type == TCP_LISTENER);
+// whether 'a' and 'b' are the same address and port
+bool same_peer(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+  return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
 
-  sock->state = LISTEN;
+// answer the SYN of the client at 'to', whose options are 'opts', with a SYN-ACK of sequence
+// number 'isn' acknowledging 'ack' : it carries the options this end wants among those the
+// client offered, the MSS option either way, and a fast open cookie if the client asked for one.
+// the socket keeps none of it until it accepts the connection
+void answer_syn(cmu_socket_t *sock, struct sockaddr_in *to, uint32_t isn, uint32_t ack,
+                ext_opts_t *opts) {
+  uint8_t flags = SYN_FLAG_MASK | ACK_FLAG_MASK;
+  uint8_t ext_data[EXT_MAX_LEN];
+  uint16_t ext_len = 0;
+  // the connection it accepts uses the window scale offered : the buffer sizes are now fixed
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  sock->buff_size_fixed = true;
+  uint8_t rcv_wscale = sock->window.rcv_wscale;
+  pthread_mutex_unlock(&(sock->send_lock));
+  if (sock->window.mss_offer != 0) {
+    ext_len = ext_put_mss(ext_data, ext_len, sock->window.mss_offer);
+  }
+  if (sock->window.wscale_ok && opts->has_wscale) {
+    ext_len = ext_put_window_scale(ext_data, ext_len, rcv_wscale);
+  }
+  if (sock->window.fastopen_ok && opts->has_fastopen &&
+      !fastopen_cookie_valid(to, opts->fastopen_cookie, opts->fastopen_len)) {
+    uint8_t cookie[FASTOPEN_COOKIE_LEN];
+    fastopen_cookie(to, cookie);
+    ext_len = ext_put_fastopen(ext_data, ext_len, cookie, FASTOPEN_COOKIE_LEN);
+  }
+  if (sock->window.ts_ok && opts->has_timestamp) {
+    ext_len = ext_put_timestamp(ext_data, ext_len, ext_timestamp_now(), opts->ts_val);
+  }
+  if (sock->window.sack_ok && opts->sack_permitted) {
+    ext_len = ext_put_sack_permitted(ext_data, ext_len);
+  }
+  uint16_t src = sock->my_port;
+  uint16_t dst = ntohs(to->sin_port);
+  uint16_t hlen = sizeof(cmu_tcp_header_t) + ext_len;
+  uint16_t plen = hlen;
+  uint16_t adv_window = CP1_WINDOW_SIZE;
 
-  uint16_t payload_len;
-  uint8_t *payload;
-  uint16_t ext_len;
-  uint8_t *ext_data;
-  uint16_t src;
-  uint16_t dst;
-  uint32_t seq;
-  uint32_t ack;
-  uint16_t hlen;
-  uint16_t plen;
-  uint8_t flags;
-  uint16_t adv_window;
-  
-  uint8_t *packet;
+  uint8_t *packet = create_packet(src, dst, isn, ack, hlen, plen, flags, adv_window,
+                                  ext_len, ext_data, NULL, 0);
 
-  while (sock->state != ESTABLISHED) {
-    if (sock->state == LISTEN) {
-      // printf("server in LISTEN\n");
-      cmu_tcp_header_t hdr;
-      ssize_t len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t),
-                     0, (struct sockaddr *)&(sock->conn), &conn_len);
+  if (counter3 >= counter3_lim) {
+    io_engine_send(&(sock->io), packet, plen, to);
+  } else {
+    counter3 += 1;
+  }
+  free_packet(packet);
+}
 
-      assert(len == sizeof(cmu_tcp_header_t));
+// accept the connection of the client at 'from', with ISN 'client_isn' and the options of its
+// SYN in 'opts', this end's ISN being 'isn' : allocate the buffers, and hand the application the
+// 'data_len' bytes of 'data' the SYN carried, as much as the receive buffer takes
+void accept_syn(cmu_socket_t *sock, struct sockaddr_in *from, uint32_t isn, uint32_t client_isn,
+                ext_opts_t *opts, uint8_t *data, uint16_t data_len) {
+  sock->conn = *from;
+  // with a cookie, the ISN the SYN-ACK carried
+  sock->window.last_ack_received = isn;
+  sock->window.high_seq_sent = isn;
+  sock->window.small_end_seq = isn;
+  sock->window.ts_ok = sock->window.ts_ok && opts->has_timestamp;
+  if (sock->window.ts_ok) {
+    sock->window.ts_recent = opts->ts_val;
+  }
+  sock->window.sack_ok = sock->window.sack_ok && opts->sack_permitted;
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  // the application may set CMU_SO_RCVBUF, and with it rcv_wscale, until the buffers exist
+  set_window_scale(sock, opts);
+  sock->cc.sack = sock->window.sack_ok;
+  start_pmtu(sock, opts);
+  create_buffers(sock);
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  // use the client's ISN to initialize the receive_buffer
+  uint16_t taken = 0;
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  recv_buffer_initialize(sock->recv_buf, client_isn);
+  data_len = MIN(data_len, recv_buffer_max_receive(sock->recv_buf));
+  if (data_len > 0 && recv_buffer_can_receive(sock->recv_buf, client_isn + 1, data_len) == 0) {
+    recv_buffer_receive(sock->recv_buf, client_isn + 1, data_len, data);
+    taken = data_len;
+  }
+  sock->window.next_seq_expected = get_next_byte_expected_seqnum(sock->recv_buf);
+  sock->window.last_ack_sent = sock->window.next_seq_expected;
+  sock->initialized = true;
+  pthread_cond_broadcast(&(sock->wait_cond));
+  pthread_mutex_unlock(&(sock->recv_lock));
 
-      // the packet must be SYN
-      assert(get_flags(&hdr) == SYN_FLAG_MASK);
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  sock->stats.fastopen_bytes += taken;
+  pthread_mutex_unlock(&(sock->send_lock));
+}
 
-      // upon receiving the first SYN packet, 
-      // use the ISN to initialize the receive_buffer
-      while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
-      }
-      recv_buffer_initialize(sock->recv_buf, get_seq(&hdr));
-      pthread_mutex_unlock(&(sock->recv_lock));
-      sock->initialized = true;
-
-      sock->window.next_seq_expected = get_seq(&hdr) + 1;
-
-      // send the SYN-ACK packet
-      payload_len = 0;
-      payload = NULL;
-      ext_len = 0;
-      ext_data = NULL;
-      src = sock->my_port;
-      dst = ntohs(sock->conn.sin_port);
-      seq = sock->window.last_ack_received;
-      ack = sock->window.next_seq_expected;
-      hlen = sizeof(cmu_tcp_header_t);
-      plen = hlen + ext_len + payload_len;
-      flags = SYN_FLAG_MASK | ACK_FLAG_MASK;
-      adv_window = CP1_WINDOW_SIZE;
-      
-      packet = create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
-                    ext_len, ext_data, payload, payload_len);
+void init_handshake_server(void *in) {
+  // printf("server start handshake\n");
+  cmu_socket_t *sock = (cmu_socket_t *)in;
+  uint8_t buf[MAX_DATAGRAM_LEN];
+  assert(sock->type == TCP_LISTENER);
+  int cookies = syncookie_mode();
 
-      if (counter3 >= counter3_lim) {
-        sendto(sock->socket, packet, plen, 0,
-          (struct sockaddr *)&(sock->conn), conn_len);
-      } else {
-        counter3 += 1;
-      }
+  // in SYN_RCVD, the SYN the listener holds half-open : its only one
+  struct sockaddr_in syn_from;
+  uint32_t syn_isn = 0;
+  ext_opts_t syn_opts;
 
-      sock->state = SYN_RCVD;
-    } else {
-      assert(sock->state == SYN_RCVD);
-      // printf("in SYN_RCVD state \n");
+  sock->state = LISTEN;
 
-      cmu_tcp_header_t hdr;
-      ssize_t len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t),
-                    MSG_WAITALL | MSG_PEEK, (struct sockaddr *)&(sock->conn),
-                    &conn_len);
-
-      if (len == (ssize_t)sizeof(cmu_tcp_header_t)) {
-        uint32_t packet_len = get_plen(&hdr);
-        uint8_t* pkt = malloc(packet_len);
-        uint32_t recv_len = 0;
-        while (recv_len < packet_len) {
-          uint32_t n = recvfrom(sock->socket, pkt + recv_len, packet_len - recv_len, 0,
-                  (struct sockaddr *)&(sock->conn), &conn_len);
-          recv_len += n;
+  while (sock->state != ESTABLISHED) {
+    struct sockaddr_in from;
+    ssize_t len = io_engine_recv(&(sock->io), buf, MAX_DATAGRAM_LEN, &from, -1);
+
+    // woken up by the application (len is 0), or not a packet : keep listening
+    ext_opts_t opts;
+    if (!packet_is_valid(buf, len) ||
+        ext_parse(get_extension_data((cmu_tcp_header_t *)buf),
+                  get_extension_length((cmu_tcp_header_t *)buf), &opts) != 0) {
+      continue;
+    }
+    cmu_tcp_header_t *hdr = (cmu_tcp_header_t *)buf;
+    bool pending = sock->state == SYN_RCVD;
+    uint32_t isn = sock->window.last_ack_received;
+
+    if (get_flags(hdr) == SYN_FLAG_MASK) {
+      if (sock->window.fastopen_ok && opts.has_fastopen && get_payload_len(buf) > 0 &&
+          fastopen_cookie_valid(&from, opts.fastopen_cookie, opts.fastopen_len)) {
+        // data with the cookie of the client's address, which is then not forged : the
+        // connection is accepted at once, for the application to answer the data without
+        // waiting for the end of the handshake. the backend loop takes over, and
+        // handle_message() finishes it
+        accept_syn(sock, &from, isn, get_seq(hdr), &opts, get_payload(buf), get_payload_len(buf));
+        answer_syn(sock, &from, isn, sock->window.next_seq_expected, &opts);
+        sock->state = SYN_RCVD;
+        break;
+      } else if (pending && same_peer(&from, &syn_from) && get_seq(hdr) == syn_isn) {
+        // the SYN-ACK was not received by the client, so client repeatly send SYN packet
+        answer_syn(sock, &from, isn, syn_isn + 1, &syn_opts);
+      } else if (cookies == SYNCOOKIE_ALWAYS || (cookies == SYNCOOKIE_WHEN_BUSY && pending)) {
+        // the cookie holds what the listener needs of the SYN, which it forgets
+        uint32_t cookie = syncookie_make(&from, get_seq(hdr), &opts, get_time_us());
+        answer_syn(sock, &from, cookie, get_seq(hdr) + 1, &opts);
+        while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
         }
-
-        // can transit to ESTABLISHED if the received packet
-        // 1) has ACK flag set
-        // 2) ack_num = sock->window.last_ack_received + 1
-        // this should be true no matter this is the pure ACK sent by the client when it first received
-        // the SYN-ACK from the server, or when it's some later packets when the client is already ESTABLISHED
-        if ((get_flags(&hdr) & ACK_FLAG_MASK) && get_ack(&hdr) == sock->window.last_ack_received + 1) {
-          sock->state = ESTABLISHED;
-          handle_message(in, pkt);
-        } else {
-          // the SYN-ACK was not received by the client, so client repeatly send SYN packet
-          assert(get_flags(&hdr) & SYN_FLAG_MASK);
-          if (counter3 >= counter3_lim) {
-            sendto(sock->socket, packet, plen, 0,
-              (struct sockaddr *)&(sock->conn), conn_len);
-          } else {
-            counter3 += 1;
-          }
+        sock->stats.syn_cookies_sent += 1;
+        pthread_mutex_unlock(&(sock->send_lock));
+      } else {
+        // hold this SYN, instead of any other
+        syn_from = from;
+        syn_isn = get_seq(hdr);
+        syn_opts = opts;
+        answer_syn(sock, &from, isn, syn_isn + 1, &syn_opts);
+        sock->state = SYN_RCVD;
+      }
+    } else if (get_flags(hdr) & ACK_FLAG_MASK) {
+      // can transit to ESTABLISHED if the received packet acknowledges the SYN-ACK of the SYN
+      // held, or brings back a cookie. this should be true no matter this is the pure ACK sent
+      // by the client when it first received the SYN-ACK from the server, or its first data
+      // segment, when that ACK was lost
+      if (pending && same_peer(&from, &syn_from) && get_ack(hdr) == isn + 1) {
+        accept_syn(sock, &from, isn, syn_isn, &syn_opts, NULL, 0);
+      } else if (cookies != SYNCOOKIE_NEVER &&
+                 syncookie_check(&from, get_seq(hdr) - 1, get_ack(hdr) - 1, get_time_us(), &opts)) {
+        accept_syn(sock, &from, get_ack(hdr) - 1, get_seq(hdr) - 1, &opts, NULL, 0);
+        while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
         }
-
-        free(pkt);
+        sock->stats.syn_cookies_accepted += 1;
+        pthread_mutex_unlock(&(sock->send_lock));
+      } else {
+        continue;
       }
+      sock->state = ESTABLISHED;
+      handle_message(in, buf);
     }
   }
 
-  if (packet != NULL) {
-    free(packet);
-  }
-
   printf("!-- server finished handshake --!\n");
 }
 
-void check_for_data(cmu_socket_t *sock, cmu_read_mode_t flags) {
-  cmu_tcp_header_t hdr;
-  uint8_t *pkt;
-  socklen_t conn_len = sizeof(sock->conn);
-  ssize_t len = 0;
-  uint32_t plen = 0, buf_size = 0, n = 0;
+// wait at most 'timeout_us' (-1 : forever, 0 : don't wait) for a packet and handle it; what
+// comes from anyone but the other end, like the rest of a SYN flood, is dropped
+// return 1 if a packet was handled, 0 otherwise
+int receive_packet(cmu_socket_t *sock, int64_t timeout_us) {
+  uint8_t pkt[MAX_DATAGRAM_LEN];
+  struct sockaddr_in from;
+  ssize_t len = io_engine_recv(&(sock->io), pkt, MAX_DATAGRAM_LEN, &from, timeout_us);
+  if (packet_is_valid(pkt, len) && same_peer(&from, &(sock->conn))) {
+    handle_message(sock, pkt);
+    return 1;
+  }
+  return 0;
+}
 
+int check_for_data(cmu_socket_t *sock, cmu_read_mode_t flags) {
   switch (flags) {
     case NO_FLAG:
-      len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t), MSG_PEEK,
-                     (struct sockaddr *)&(sock->conn), &conn_len);
-      break;
-    case TIMEOUT: {
-      // Using `poll` here so that we can specify a timeout.
-      struct pollfd ack_fd;
-      ack_fd.fd = sock->socket;
-      ack_fd.events = POLLIN;
+      return receive_packet(sock, -1);
+    case TIMEOUT:
       // Timeout after DEFAULT_TIMEOUT.
-      if (poll(&ack_fd, 1, DEFAULT_TIMEOUT) <= 0) {
-        break;
-      }
-    }
-    // Fallthrough.
+      return receive_packet(sock, (int64_t)DEFAULT_TIMEOUT * 1000);
     case NO_WAIT:
-      len = recvfrom(sock->socket, &hdr, sizeof(cmu_tcp_header_t),
-                     MSG_DONTWAIT | MSG_PEEK, (struct sockaddr *)&(sock->conn),
-                     &conn_len);
-      break;
+      return receive_packet(sock, 0);
     default:
       perror("ERROR unknown flag");
+      return 0;
+  }
+}
+
+// microseconds the backend can sleep before the retransmission, reordering, probe or delayed
+// ACK timer, or the pacer, needs attention
+int64_t next_timeout_us(cmu_socket_t *sock) {
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
+  uint64_t deadline_us = sock->send_buf->last_byte_acked_us + sock->rto.rto_us;
+  if (sock->window.persist_deadline_us != 0) {
+    // the window probes stand in for the retransmission timer
+    deadline_us = sock->window.persist_deadline_us;
+  }
+  if (sock->window.rack_deadline_us != 0) {
+    deadline_us = MIN(deadline_us, sock->window.rack_deadline_us);
+  }
+  if (sock->window.tlp_deadline_us != 0) {
+    deadline_us = MIN(deadline_us, sock->window.tlp_deadline_us);
+  }
+  uint64_t pace_us = 0;
+  uint32_t window = send_window(sock);
+  uint32_t in_flight = send_buffer_in_flight(sock->send_buf);
+  uint32_t num_fresh = send_buffer_max_new_dump(sock->send_buf);
+  if (in_flight < window &&
+      hold_small_segment(sock, MIN(num_fresh, window - in_flight), num_fresh > window - in_flight)) {
+    // held back for more data, not by the pacer
+    num_fresh = 0;
+  }
+  uint32_t num_pending = num_fresh + sock->send_buf->lost_bytes;
+  bool paced = pacer_active(&(sock->pacer)) && num_pending > 0 && in_flight < window;
+  if (paced) {
+    // data held back by the pacer only
+    uint32_t len = MIN(MIN(num_pending, window - in_flight), sock->window.mss);
+    pace_us = pacer_delay_us(&(sock->pacer), len, get_time_us());
+  }
+  uint64_t pmtu_deadline_us = 0;
+  if (num_unacknowledged + send_buffer_max_new_dump(sock->send_buf) > 0 &&
+      sock->window.max_rcvd_window / 2 > sock->pmtu.mss) {
+    // a path MTU probe to send, or one to give up on
+    pmtu_deadline_us = sock->pmtu.deadline_us;
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  int64_t timeout_us = (int64_t)DEFAULT_TIMEOUT * 1000;
+  if (num_unacknowledged > 0 || sock->window.persist_deadline_us != 0) {
+    uint64_t now_us = get_time_us();
+    timeout_us = deadline_us > now_us ? (int64_t)(deadline_us - now_us) : 0;
+  }
+  if (pmtu_deadline_us != 0) {
+    uint64_t now_us = get_time_us();
+    timeout_us = MIN(timeout_us, pmtu_deadline_us > now_us ? (int64_t)(pmtu_deadline_us - now_us) : 0);
+  }
+  // otherwise nothing in flight nor waiting for the window : sleep until a packet arrives or
+  // the application wakes us up
+  if (paced) {
+    timeout_us = MIN(timeout_us, (int64_t)pace_us);
+  }
+  if (sock->window.delack_deadline_us != 0) {
+    uint64_t now_us = get_time_us();
+    uint64_t delack_deadline_us = sock->window.delack_deadline_us;
+    timeout_us = MIN(timeout_us, delack_deadline_us > now_us ? (int64_t)(delack_deadline_us - now_us) : 0);
+  }
+  return timeout_us;
+}
+
+// wait for packets until 'timeout_us' passes or the application wakes us up,
+// then handle everything already queued on the socket
+//
+// in busy-poll mode the socket is polled without blocking for up to
+// busy_poll_cur_us first. the budget adapts to the traffic : it is halved
+// every time a spin finds nothing, down to plain blocking, and restored as
+// soon as a packet shows up within the configured budget. the budgets and the
+// counters are read and updated under send_lock, as the application sets the
+// one and reads the others
+void wait_for_packets(cmu_socket_t *sock, int64_t timeout_us) {
+  int got = 0;
+  uint64_t start = get_time_us();
+  uint64_t spun_us = 0;
+  uint64_t slept_us = 0;
+  bool slept = false;
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
   }
-  if (len >= (ssize_t)sizeof(cmu_tcp_header_t)) {
-    plen = get_plen(&hdr);
-    pkt = malloc(plen);
-    while (buf_size < plen) {
-      n = recvfrom(sock->socket, pkt + buf_size, plen - buf_size, 0,
-                   (struct sockaddr *)&(sock->conn), &conn_len);
-      buf_size = buf_size + n;
+  int busy_poll_us = sock->busy_poll_us;
+  int busy_poll_cur_us = sock->busy_poll_cur_us;
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  if (busy_poll_cur_us > 0 && timeout_us != 0) {
+    uint64_t spin_us = busy_poll_cur_us;
+    if (timeout_us > 0 && spin_us > (uint64_t)timeout_us) {
+      spin_us = (uint64_t)timeout_us;
     }
-    handle_message(sock, pkt);
-    free(pkt);
+    uint64_t now = start;
+    // stop early if the application has work for us; the wakeup is still
+    // pending, so the blocking receive below returns right away
+    while (!got && now - start < spin_us && !io_engine_wake_pending(&(sock->io))) {
+      got = check_for_data(sock, NO_WAIT);
+      if (!got) {
+        // don't starve the peer thread if it shares our CPU
+        sched_yield();
+      }
+      now = get_time_us();
+    }
+    spun_us = now - start;
+    if (got) {
+      busy_poll_cur_us = busy_poll_us;
+    } else {
+      busy_poll_cur_us /= 2;
+      if (timeout_us > 0) {
+        timeout_us = MAX(timeout_us - (int64_t)(now - start), 1);
+      }
+    }
+  }
+  bool spin_hit = got;
+
+  if (!got) {
+    uint64_t sleep_start = get_time_us();
+    got = receive_packet(sock, timeout_us);
+    slept_us = get_time_us() - sleep_start;
+    slept = timeout_us != 0;
+    if (got && busy_poll_us > 0 && slept_us < (uint64_t)busy_poll_us) {
+      // spinning would have caught this packet
+      busy_poll_cur_us = busy_poll_us;
+    }
+  }
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  sock->stats.spin_us += spun_us;
+  if (spin_hit) {
+    sock->stats.spin_hits += 1;
+  }
+  if (slept) {
+    sock->stats.sleep_us += slept_us;
+    sock->stats.sleeps += 1;
+  }
+  // unless the application set another budget meanwhile
+  if (sock->busy_poll_us == busy_poll_us) {
+    sock->busy_poll_cur_us = busy_poll_cur_us;
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  // handle what is already queued before deciding what to send
+  for (int i = 0; got && i < MAX_PACKETS_PER_WAKEUP; i++) {
+    got = check_for_data(sock, NO_WAIT);
   }
 }
 
-// try to send data that was not previously sent before
-// do so by calculating 'next_byte_written_index - last_byte_sent_index'
+// send what the window allows : first the segments presumed lost (SACK), then data that
+// was never sent, by calculating 'next_byte_written_index - last_byte_sent_index'
 // timeout resend is not handled here
 void multiple_send(cmu_socket_t *sock) {
-  uint8_t *msg;
-  int sockfd = sock->socket;
-  size_t conn_len = sizeof(sock->conn);
+  uint32_t window = send_window(sock);
+  pacer_t *pacer = &(sock->pacer);
+  pacer_set_rate(pacer, cc_pacing_rate(&(sock->cc)), get_time_us());
+
+  uint32_t lost_seq;
+  uint32_t lost_len;
+  while (send_buffer_in_flight(sock->send_buf) < window &&
+         send_buffer_next_lost(sock->send_buf, &lost_seq, &lost_len)) {
+    uint64_t now_us = pacer_active(pacer) ? get_time_us() : 0;
+    if (pacer_active(pacer) && pacer_delay_us(pacer, MIN(lost_len, sock->window.mss), now_us) > 0) {
+      sock->stats.pacer_waits += 1;
+      return;
+    }
+    // a segment is longer than a full one only when the segment table was full, or when
+    // full segments got shorter since it was sent; it goes out whole
+    for (uint32_t off = 0; off < lost_len; off += sock->window.mss) {
+      send_segment(sock, lost_seq + off, MIN(lost_len - off, sock->window.mss));
+    }
+    pacer_consume(pacer, lost_len, now_us);
+  }
 
-  uint32_t curr_adv_window = recv_buffer_max_receive(sock->recv_buf);
- 
-  uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
-  if (num_unacknowledged < sock->window.rcvd_advertised_window) {
+  uint32_t in_flight = send_buffer_in_flight(sock->send_buf);
+  if (in_flight < window) {
     uint32_t num_fresh_data_available = send_buffer_max_new_dump(sock->send_buf);
-    uint32_t max_fresh_data_allowed = sock->window.rcvd_advertised_window - num_unacknowledged;
-    uint32_t target_send_len = num_fresh_data_available < max_fresh_data_allowed ? num_fresh_data_available : max_fresh_data_allowed;
-
-    // construction the packet to send
-    uint16_t payload_len;
-    uint16_t src = sock->my_port;
-    uint16_t dst = ntohs(sock->conn.sin_port);
-    uint32_t seq;
-    uint32_t ack = sock->window.next_seq_expected; // this field will not change during the execution of this function, since the lock is held
-    uint16_t hlen = sizeof(cmu_tcp_header_t);
-    uint16_t plen;
-    uint8_t flags = ACK_FLAG_MASK;
-    uint16_t adv_window = curr_adv_window;
-    uint16_t ext_len = 0;
-    uint8_t *ext_data = NULL;
-    uint8_t *payload;
-
+    uint32_t max_fresh_data_allowed = window - in_flight;
+    uint32_t target_send_len = MIN(num_fresh_data_available, max_fresh_data_allowed);
+    bool window_limited = num_fresh_data_available > max_fresh_data_allowed;
+
+    if (hold_small_segment(sock, target_send_len, window_limited)) {
+      // count the short segments the held bytes would have been sent as
+      if (target_send_len > sock->window.small_held) {
+        sock->window.small_holds += 1;
+      }
+      sock->window.small_held = target_send_len;
+      target_send_len = 0;
+    } else if (target_send_len > 0 && sock->window.small_holds > 0) {
+      // all of it goes out together; it would have taken one segment per hold otherwise
+      sock->stats.small_segs_avoided += sock->window.small_holds - 1;
+      sock->window.small_held = 0;
+      sock->window.small_holds = 0;
+    }
     while (target_send_len > 0) {
-      payload_len = MIN(target_send_len, (uint32_t)MSS);
-      seq = get_last_byte_sent_seqnum(sock->send_buf) + 1;
-      plen = hlen + payload_len;
-      uint32_t start_index = (sock->send_buf->last_byte_sent_index+1)%(sock->send_buf->capacity);
-      payload = malloc(payload_len * sizeof(uint8_t));
-      send_buffer_dump(sock->send_buf, start_index, payload_len, payload);
-    
-      msg = create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
-                          ext_len, ext_data, payload, payload_len);
-      
-      sendto(sockfd, msg, plen, 0, (struct sockaddr *)&(sock->conn),
-               conn_len);
-      
-      free(msg);
-      target_send_len -= payload_len;        
-      free(payload);
+      uint16_t payload_len = MIN(target_send_len, sock->window.mss);
+      if (payload_len < sock->window.mss && hold_small_segment(sock, payload_len, window_limited)) {
+        // the full segments before it went out; the rest waits for more data
+        sock->window.small_held = payload_len;
+        sock->window.small_holds = 1;
+        break;
+      }
+      uint64_t now_us = pacer_active(pacer) ? get_time_us() : 0;
+      if (pacer_active(pacer) && pacer_delay_us(pacer, payload_len, now_us) > 0) {
+        // next_timeout_us() wakes the backend up when the pacer lets it go
+        sock->stats.pacer_waits += 1;
+        return;
+      }
+      send_segment(sock, get_last_byte_sent_seqnum(sock->send_buf) + 1, payload_len);
+      pacer_consume(pacer, payload_len, now_us);
+      target_send_len -= payload_len;
+    }
+    if (max_fresh_data_allowed - target_send_len >= sock->window.mss &&
+        send_buffer_max_write(sock->send_buf) >= sock->window.mss) {
+      // the window has room for another full segment, for lack of data : the application
+      // is not writing fast enough (a full send buffer is a limit of the path's own)
+      send_buffer_mark_app_limited(sock->send_buf);
     }
-  } else {
-    // printf("num_unacknowledged : %d\n", num_unacknowledged);
-    // printf("sock->window.rcvd_advertised_window : %d\n", sock->window.rcvd_advertised_window);
   }
 }
 
-// send_lock already hold by the caller before calling this function
-void resend_unacknowledged(cmu_socket_t *sock) {
-  uint8_t *msg;
-  int sockfd = sock->socket;
-  size_t conn_len = sizeof(sock->conn);
-
-  uint16_t payload_len;
-  uint16_t src = sock->my_port;
-  uint16_t dst = ntohs(sock->conn.sin_port);
+// the probe timer fired (RFC 8985 7.3) : send one new segment if the advertised window allows
+// it, or else the last segment again. the ACK it draws lets RACK find what was lost at the
+// tail of the flight without waiting for the retransmission timer
+// send_lock already hold by the caller
+void send_tail_probe(cmu_socket_t *sock, uint64_t now_us) {
+  uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
+  uint32_t num_fresh = send_buffer_max_new_dump(sock->send_buf);
   uint32_t seq;
-  uint32_t ack = sock->window.next_seq_expected; // this field will not change during the execution of this function, since the lock is held
-  uint16_t hlen = sizeof(cmu_tcp_header_t);
-  uint16_t plen;
-  uint8_t flags = ACK_FLAG_MASK;
-  uint16_t adv_window = recv_buffer_max_receive(sock->recv_buf); // not holding recv_lock here; hopefully this will not cause problem
-  uint16_t ext_len = 0;
-  uint8_t *ext_data = NULL;
+  uint32_t len;
+  sock->window.tlp_deadline_us = 0;
+  if (num_fresh > 0 &&
+      num_unacknowledged + MIN(num_fresh, sock->window.mss) <= sock->window.rcvd_advertised_window) {
+    seq = get_last_byte_sent_seqnum(sock->send_buf) + 1;
+    len = MIN(num_fresh, sock->window.mss);
+    sock->window.tlp_retransmit = false;
+  } else if (send_buffer_last_segment(sock->send_buf, &seq, &len)) {
+    if (len > sock->window.mss) {
+      seq += len - sock->window.mss;
+      len = sock->window.mss;
+    }
+    sock->window.tlp_retransmit = true;
+  } else {
+    return;
+  }
+  sock->window.tlp_in_flight = true;
+  send_segment(sock, seq, len);
+  sock->window.tlp_end_seq = sock->window.high_seq_sent;
+  sock->stats.tail_probes += 1;
+  // the retransmission timer starts over from the probe
+  sock->send_buf->last_byte_acked_us = now_us;
+}
 
+// resend after a timeout; send_lock already hold by the caller before calling this function
+// with a zero advertised window, a single byte is sent as a probe. with SACK, every segment
+// not sacked is marked lost and resent as the window allows. otherwise everything
+// unacknowledged is considered lost and sent again from the first unacknowledged byte on,
+// as far as the window allows (go-back-N); the rest follows as ACKs open the window
+void resend_unacknowledged(cmu_socket_t *sock) {
   uint32_t num_unacknowledged = get_unacknowledged_count(sock->send_buf);
   assert(num_unacknowledged > 0);
-  uint32_t target_send_len = MIN(num_unacknowledged, sock->window.rcvd_advertised_window);
-  if (target_send_len == 0) {
-    // the advertised window is 0, do zero window probe, send a single byte
-    payload_len = 1;
-    seq = sock->send_buf->last_byte_acked_seqnum + 1;
-    plen = hlen + payload_len;
-    uint32_t start_index = (sock->send_buf->last_byte_acked_index+1)%(sock->send_buf->capacity);
-    // no need to use send_buffer_dump here because we don't want to update the last_sent_index
-    msg = create_packet(src, dst, seq, ack, hlen, plen, flags, adv_window,
-                          ext_len, ext_data, sock->send_buf->buffer+start_index, payload_len);
-
-    sendto(sockfd, msg, plen, 0, (struct sockaddr *)&(sock->conn),
-               conn_len);
-
-    free(msg);
-  } else {
-    uint32_t start_index = (sock->send_buf->last_byte_acked_index+1)%(sock->send_buf->capacity);
-    uint32_t start_seq = sock->send_buf->last_byte_acked_seqnum + 1;
-    uint32_t num_sent = 0;
-
-    while (target_send_len > 0) {
-      uint32_t curr_index = (start_index + num_sent)%(sock->send_buf->capacity);
-      uint32_t curr_seq = start_seq + num_sent;
-
-      payload_len = MIN(target_send_len, (uint32_t)MSS);
-      plen = hlen + payload_len;
-      // no need to use send_buffer_dump here because we don't want to update the last_sent_index
-      msg = create_packet(src, dst, curr_seq, ack, hlen, plen, flags, adv_window,
-                          ext_len, ext_data, sock->send_buf->buffer+curr_index, payload_len);
-
-      sendto(sockfd, msg, plen, 0, (struct sockaddr *)&(sock->conn),
-               conn_len);
-
-      free(msg);
-
-      num_sent += payload_len;
-      target_send_len -= payload_len;
-    }
+  if (sock->window.sack_ok) {
+    // a second timeout in a row : the other side may have dropped what it sacked
+    send_buffer_mark_all_lost(sock->send_buf, sock->rto.backoff > 1);
+    sock->window.in_loss = true;
+    sock->window.recover_seq = sock->window.high_seq_sent;
+    multiple_send(sock);
+    return;
   }
+  send_buffer_rewind(sock->send_buf);
+  multiple_send(sock);
 }
 
 void *begin_backend(void *in) {
@@ -528,6 +1454,7 @@ void *begin_backend(void *in) {
   } else {
     init_handshake_server(in);
   }
+  io_engine_flush(&(sock->io));
 
   while (1) {
     // printf("start the while loop\n");
@@ -543,43 +1470,108 @@ void *begin_backend(void *in) {
     pthread_mutex_unlock(&(sock->send_lock));
 
     if (death && (num_unacknowledged + num_fresh) == 0) {
+      // the other side may still wait for the ACK held back for its last data
+      if (sock->window.segs_unacked > 0) {
+        send_ack(sock);
+        io_engine_flush(&(sock->io));
+      }
       break;
     }
 
-    // check if any data arrives, and update sock->window.ack and such.    
-    check_for_data(sock, NO_WAIT);
+    // wait for data (or a timer, or the application), and update sock->window.ack and such.
+    wait_for_packets(sock, next_timeout_us(sock));
 
     // check if need to resend due to timeout
-    long last_ack_ts;
     while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
     }
     num_unacknowledged = get_unacknowledged_count(sock->send_buf);
     num_fresh = send_buffer_max_new_dump(sock->send_buf);
-    last_ack_ts = sock->send_buf->last_byte_acked_ts;
-    long curr_ts = get_time_ms();
-
-    if (curr_ts - last_ack_ts > DEFAULT_TIMEOUT && num_unacknowledged > 0) {
+    uint64_t curr_us = get_time_us();
+
+    if (sock->window.persist_deadline_us != 0) {
+      if (curr_us >= sock->window.persist_deadline_us && num_unacknowledged + num_fresh > 0) {
+        send_window_probe(sock);
+        sock->window.persist_backoff += 1;
+        arm_persist_timer(sock, curr_us);
+      } else if (curr_us >= sock->window.persist_deadline_us) {
+        // nothing to send yet : no probe, and no backoff
+        arm_persist_timer(sock, curr_us);
+      }
+    } else if (num_unacknowledged > 0 &&
+        curr_us >= sock->send_buf->last_byte_acked_us + sock->rto.rto_us) {
       // printf("got here 2\n");
+      sock->stats.timeouts += 1;
+      cc_on_rto(&(sock->cc), num_unacknowledged);
+      sock->window.in_recovery = false;
+      sock->window.dup_acks = 0;
+      sock->window.rack_deadline_us = 0;
+      sock->window.tlp_deadline_us = 0;
+      sock->window.tlp_in_flight = false;
+      rto_on_timeout(&(sock->rto));
+      if (pmtu_on_timeout(&(sock->pmtu), curr_us)) {
+        // full segments keep getting lost : back to ones every path carries
+        update_mss(sock);
+      }
       resend_unacknowledged(sock);
+      // restart the retransmission timer, with the backed off timeout
+      sock->send_buf->last_byte_acked_us = curr_us;
     } else {
+      if (sock->window.rack_deadline_us != 0 && curr_us >= sock->window.rack_deadline_us) {
+        // a reordering window ran out : what RACK now finds lost goes out below
+        rack_detect_loss(sock, curr_us);
+        check_sack_loss(sock);
+      }
+      // a path MTU probe goes first, to let the data that follows use what it finds. there
+      // is no point in probing an idle connection, nor beyond what the window lets a
+      // segment take
+      uint32_t probe_size = 0;
+      if (num_unacknowledged + num_fresh > 0 && sock->window.max_rcvd_window / 2 > sock->pmtu.mss) {
+        probe_size = pmtu_probe_due(&(sock->pmtu), curr_us);
+      }
+      if (probe_size > 0) {
+        send_pmtu_probe(sock, probe_size, curr_us);
+      }
       // otherwise, send 'fresh' data on the buffer
       // printf("trying to send");
       multiple_send(sock);
+      if (sock->window.tlp_deadline_us != 0 && curr_us >= sock->window.tlp_deadline_us) {
+        send_tail_probe(sock, curr_us);
+      }
     }
     pthread_mutex_unlock(&(sock->send_lock));
 
-    // TODO : zero window probe
-
     // alert the application of receiving new data
     uint32_t available_to_read;
+    uint32_t available_to_receive;
     while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
     }
     available_to_read = recv_buffer_max_read(sock->recv_buf);
+    available_to_receive = recv_buffer_max_receive(sock->recv_buf);
     pthread_mutex_unlock(&(sock->recv_lock));
 
+    // the application made room : tell the other side once the right edge of the window
+    // moves by a useful amount, so that it neither waits for a probe or an ACK held back
+    // nor sends a sliver (RFC 9293 3.8.6.2.2). an ACK owed that no data carried goes out
+    // now; one held back when it is due
+    bool window_update = window_update_due(sock, sock->window.next_seq_expected, available_to_receive);
+    bool delack_due = sock->window.delack_deadline_us != 0 &&
+                      get_time_us() >= sock->window.delack_deadline_us;
+    if (window_update || sock->window.ack_now || delack_due) {
+      if (!sock->window.ack_now && !delack_due) {
+        while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+        }
+        sock->stats.window_updates += 1;
+        pthread_mutex_unlock(&(sock->send_lock));
+      }
+      send_ack(sock);
+    }
+
     if (available_to_read > 0) {
       pthread_cond_signal(&(sock->wait_cond));
     }
+
+    // push the packets queued during this iteration to the kernel
+    io_engine_flush(&(sock->io));
   }
 
   pthread_exit(NULL);
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "packet_pool.h"
+
 uint16_t get_src(cmu_tcp_header_t* header) {
   return ntohs(header->source_port);
 }
@@ -137,7 +139,8 @@ uint8_t* create_packet(uint16_t src, uint16_t dst, uint32_t seq, uint32_t ack,
     return NULL;
   }
 
-  uint8_t* packet = malloc(sizeof(cmu_tcp_header_t) + payload_len);
+  uint8_t* packet =
+      packet_pool_alloc(sizeof(cmu_tcp_header_t) + ext_len + payload_len);
   if (packet == NULL) {
     return NULL;
   }
@@ -146,8 +149,12 @@ uint8_t* create_packet(uint16_t src, uint16_t dst, uint32_t seq, uint32_t ack,
   set_header(header, src, dst, seq, ack, hlen, plen, flags, adv_window, ext_len,
              ext_data);
 
-  uint8_t* pkt_payload = get_payload(packet);
-  memcpy(pkt_payload, payload, payload_len);
+  if (payload_len > 0) {
+    uint8_t* pkt_payload = get_payload(packet);
+    memcpy(pkt_payload, payload, payload_len);
+  }
 
   return packet;
 }
+
+void free_packet(uint8_t* pkt) { packet_pool_free(pkt); }
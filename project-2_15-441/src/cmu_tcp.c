@@ -14,6 +14,7 @@
 #include "cmu_tcp.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,10 +24,80 @@
 #include <time.h>
 
 #include "backend.h"
+#include "extension.h"
+#include "fastopen.h"
 #include "recv_buffer.h"
 #include "send_buffer.h"
 
-uint32_t DEFAULT_BUFF_SIZE = 1024;
+// computes the absolute CLOCK_MONOTONIC deadline of the TIMEOUT mode,
+// timeout_ms from now; another thread may set timeout_ms meanwhile
+static void timeout_deadline(cmu_socket_t *sock, struct timespec *deadline) {
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  int ms = sock->timeout_ms;
+  pthread_mutex_unlock(&(sock->send_lock));
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += ms / 1000;
+  deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec += 1;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+// waits on 'cond' (whose mutex is held) according to the read/write mode
+// return 0 if woken up, ETIMEDOUT if the deadline passed
+static int wait_with_mode(pthread_cond_t *cond, pthread_mutex_t *lock,
+                          cmu_read_mode_t flags,
+                          const struct timespec *deadline) {
+  if (flags == TIMEOUT) {
+    return pthread_cond_timedwait(cond, lock, deadline);
+  }
+  pthread_cond_wait(cond, lock);
+  return 0;
+}
+
+// block until the handshake is done, instead of spinning on 'initialized'
+static int wait_for_handshake(cmu_socket_t *sock, cmu_read_mode_t flags,
+                              const struct timespec *deadline) {
+  int ret = 0;
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while (!sock->initialized && ret == 0) {
+    if (flags == NO_WAIT) {
+      ret = ETIMEDOUT;
+    } else {
+      ret = wait_with_mode(&(sock->wait_cond), &(sock->recv_lock), flags,
+                           deadline);
+    }
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+  return ret;
+}
+
+// a fast open client with a cookie takes writes before the handshake : its SYN carries the
+// first one
+static bool writes_before_handshake(cmu_socket_t *sock) {
+  return sock->type == TCP_INITIATOR && sock->window.fastopen_len != 0;
+}
+
+// the first read, write or close of an initiator : its buffers get the sizes set by then, and
+// its SYN goes out. a fast open write leaves the SYN for the backend to send with the data
+static void send_deferred_syn(cmu_socket_t *sock, bool writing) {
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  if (sock->type == TCP_INITIATOR && sock->send_buf == NULL) {
+    create_buffers(sock);
+  }
+  bool deferred = sock->syn_deferred;
+  if (!writing || !writes_before_handshake(sock)) {
+    sock->syn_deferred = false;
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  if (deferred) {
+    io_engine_wake(&(sock->io));
+  }
+}
 
 int cmu_socket(cmu_socket_t *sock, const cmu_socket_type_t socket_type,
                const int port, const char *server_ip) {
@@ -42,37 +113,101 @@ int cmu_socket(cmu_socket_t *sock, const cmu_socket_type_t socket_type,
   }
   sock->socket = sockfd;
   sock->type = socket_type;
+  // path MTU discovery needs datagrams that are dropped, not fragmented, when they are too
+  // large for the path; the kernel's own PMTU estimate is not used either
+  optval = IP_PMTUDISC_PROBE;
+  setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, (const void *)&optval, sizeof(int));
 
   sock->dying = 0;
   pthread_mutex_init(&(sock->death_lock), NULL);
 
-  if (pthread_cond_init(&sock->wait_cond, NULL) != 0) {
+  // TIMEOUT deadlines are measured on the monotonic clock
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  if (pthread_cond_init(&sock->wait_cond, &cond_attr) != 0) {
     perror("ERROR condition variable not set\n");
     return EXIT_ERROR;
   }
-
-  // if (pthread_cond_init(&sock->wait_cond2, NULL) != 0) {
-  //   perror("ERROR condition variable not set\n");
-  //   return EXIT_ERROR;
-  // }
+  if (pthread_cond_init(&sock->send_cond, &cond_attr) != 0) {
+    perror("ERROR condition variable not set\n");
+    return EXIT_ERROR;
+  }
+  pthread_condattr_destroy(&cond_attr);
+  sock->timeout_ms = DEFAULT_TIMEOUT;
 
   srand(time(NULL));
   sock->window.last_ack_received = (uint32_t)rand();    // randomly initialized to be used as ISN
   sock->window.next_seq_expected = 0;                   // NOT USED; set by the Sequence number of the SYN packet of the other end
   sock->window.rcvd_advertised_window = CP1_WINDOW_SIZE;
+  sock->window.adv_window_sent = CP1_WINDOW_SIZE;
+  sock->window.max_rcvd_window = 0;
+  sock->window.dup_acks = 0;
+  sock->window.high_seq_sent = sock->window.last_ack_received;
+  sock->window.in_recovery = false;
+  sock->window.recover_seq = 0;
+  sock->window.ts_ok = ext_timestamps_enabled();
+  sock->window.ts_recent = 0;
+  sock->window.sack_ok = ext_sack_enabled();
+  sock->window.wscale_ok = ext_wscale_enabled();
+  sock->window.snd_wscale = 0;
+  sock->window.rcv_wscale = 0;
+  sock->window.in_loss = false;
+  sock->window.rack_deadline_us = 0;
+  sock->window.tlp_deadline_us = 0;
+  sock->window.persist_deadline_us = 0;
+  sock->window.persist_backoff = 0;
+  sock->window.tlp_in_flight = false;
+  sock->window.tlp_retransmit = false;
+  sock->window.tlp_end_seq = 0;
+  sock->window.last_ack_sent = 0;
+  sock->window.segs_unacked = 0;
+  sock->window.delack_deadline_us = 0;
+  sock->window.ack_now = false;
+  sock->window.small_end_seq = sock->window.last_ack_received;
+  sock->window.small_held = 0;
+  sock->window.small_holds = 0;
+  sock->window.quick_acks = DELACK_QUICK_ACKS;
+  sock->window.mss = MSS;
+  sock->window.mss_offer = ext_mss_limit(MSS, MAX_MSS);
+  sock->window.probe_ack = 0;
+  sock->window.fastopen_ok = fastopen_enabled();
+  sock->window.fastopen_len = 0;
+  pacer_init(&(sock->pacer), MSS);
+  rto_init(&(sock->rto));
+  pmtu_init(&(sock->pmtu), MSS);
+  if (cc_init(&(sock->cc), NULL, MSS) < 0) {
+    perror("ERROR allocating congestion control state");
+    return EXIT_ERROR;
+  }
 
-  sock->recv_buf = recv_buffer_create(DEFAULT_BUFF_SIZE);
+  if (sock->window.wscale_ok) {
+    // enough to advertise the whole receive buffer
+    sock->window.rcv_wscale = ext_window_scale_for(DEFAULT_BUFF_SIZE);
+  }
   // receive buffer needs to be initialize during the handshake SYN
   // recv_buffer_initialize( .. );
+  // a listener allocates its buffers when it accepts a connection : a SYN costs it nothing.
+  // an initiator when it is first used, for CMU_SO_RCVBUF and CMU_SO_SNDBUF set before to apply
+  sock->recv_buf = NULL;
+  sock->send_buf = NULL;
+  sock->rcvbuf_size = DEFAULT_BUFF_SIZE;
+  sock->sndbuf_size = DEFAULT_BUFF_SIZE;
+  sock->buff_size_fixed = false;
   pthread_mutex_init(&(sock->recv_lock), NULL);
-
-  sock->send_buf = send_buffer_create(DEFAULT_BUFF_SIZE);
-  send_buffer_initialize(sock->send_buf, sock->window.last_ack_received);
   pthread_mutex_init(&(sock->send_lock), NULL);
 
   sock->state = CLOSED;
   sock->initialized = false;
+  sock->syn_deferred = socket_type == TCP_INITIATOR;
   sock->last_send_ms = 0;
+  sock->busy_poll_us = 0;
+  sock->busy_poll_cur_us = 0;
+  sock->ack_frequency = ACK_FREQUENCY_DEFAULT;
+  sock->delack_us = DELACK_DEFAULT_US;
+  sock->nodelay = false;
+  sock->cork = false;
+  memset(&(sock->stats), 0, sizeof(sock->stats));
 
   switch (socket_type) {
     case TCP_INITIATOR:
@@ -85,6 +220,10 @@ int cmu_socket(cmu_socket_t *sock, const cmu_socket_type_t socket_type,
       conn.sin_addr.s_addr = inet_addr(server_ip);
       conn.sin_port = htons(port);
       sock->conn = conn;
+      if (sock->window.fastopen_ok) {
+        // with a cookie from this server, the SYN waits for the first write, to carry its data
+        sock->window.fastopen_len = fastopen_cache_get(&conn, sock->window.fastopen_cookie);
+      }
 
       my_addr.sin_family = AF_INET;
       my_addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -118,18 +257,43 @@ int cmu_socket(cmu_socket_t *sock, const cmu_socket_type_t socket_type,
   }
   getsockname(sockfd, (struct sockaddr *)&my_addr, &len);
   sock->my_port = ntohs(my_addr.sin_port);
+  // no segment this end sends or accepts is longer than its MSS offer
+  uint32_t max_seg =
+      sock->window.mss_offer > MSS ? sock->window.mss_offer : MSS;
+  io_engine_init(&(sock->io), sockfd,
+                 sizeof(cmu_tcp_header_t) + EXT_MAX_LEN + max_seg);
 
   pthread_create(&(sock->thread_id), NULL, begin_backend, (void *)sock);
   return EXIT_SUCCESS;
 }
 
+// send_lock already hold by the caller
+void create_buffers(cmu_socket_t *sock) {
+  sock->buff_size_fixed = true;
+  sock->recv_buf = recv_buffer_create(sock->rcvbuf_size);
+  sock->send_buf = send_buffer_create(sock->sndbuf_size);
+  send_buffer_initialize(sock->send_buf, sock->window.last_ack_received);
+
+  // the kernel queues a receive window of datagrams at least, which grow with the segments
+  uint64_t want = 2 * (uint64_t)sock->rcvbuf_size + MAX_DATAGRAM_LEN;
+  int rcvbuf;
+  socklen_t rcvbuf_len = sizeof(rcvbuf);
+  int optval = want < INT32_MAX ? (int)want : INT32_MAX;
+  if (getsockopt(sock->socket, SOL_SOCKET, SO_RCVBUF, (void *)&rcvbuf, &rcvbuf_len) == 0 &&
+      rcvbuf < optval) {
+    setsockopt(sock->socket, SOL_SOCKET, SO_RCVBUF, (const void *)&optval, sizeof(int));
+  }
+}
+
 int cmu_close(cmu_socket_t *sock) {
-  while (!sock->initialized) {}
+  send_deferred_syn(sock, false);
+  wait_for_handshake(sock, NO_FLAG, NULL);
   
   while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
   }
   sock->dying = 1;
   pthread_mutex_unlock(&(sock->death_lock));
+  io_engine_wake(&(sock->io));
 
   pthread_join(sock->thread_id, NULL);
 
@@ -139,6 +303,8 @@ int cmu_close(cmu_socket_t *sock) {
   if (sock != NULL) {
     recv_buffer_clean(sock->recv_buf);
     send_buffer_clean(sock->send_buf);
+    io_engine_destroy(&(sock->io));
+    cc_destroy(&(sock->cc));
   } else {
     perror("ERROR null socket\n");
     return EXIT_ERROR;
@@ -147,59 +313,90 @@ int cmu_close(cmu_socket_t *sock) {
 }
 
 int cmu_read(cmu_socket_t *sock, void *buf, int length, cmu_read_mode_t flags) {
-  while (!sock->initialized) {}
-  
-  // printf("begin to read\n");
-
   int read_len = 0;
+  struct timespec deadline = {0, 0};
 
   if (length < 0) {
     perror("ERROR negative length");
     return EXIT_ERROR;
   }
+  if (flags != NO_FLAG && flags != NO_WAIT && flags != TIMEOUT) {
+    perror("ERROR Unknown flag.\n");
+    return EXIT_ERROR;
+  }
+  if (flags == TIMEOUT) {
+    timeout_deadline(sock, &deadline);
+  }
+  send_deferred_syn(sock, false);
+  if (wait_for_handshake(sock, flags, &deadline) != 0) {
+    errno = ETIMEDOUT;
+    return 0;
+  }
 
   while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
   }
 
-  switch (flags) {
-    case NO_FLAG:
-      while (recv_buffer_max_read(sock->recv_buf) == 0) {
-        // printf("stuck in recv_buffer_max_read(sock->recv_buf) == 0 \n");
-        pthread_cond_wait(&(sock->wait_cond), &(sock->recv_lock));
-      }
-    // Fall through.
-    case NO_WAIT:
-      if (recv_buffer_max_read(sock->recv_buf) > 0) {
-        // printf("recv_buffer_max_read(sock->recv_buf) : %d\n", recv_buffer_max_read(sock->recv_buf));
-        if (recv_buffer_max_read(sock->recv_buf) > (uint32_t)length) {
-          read_len = length;
-        } else {
-          read_len = recv_buffer_max_read(sock->recv_buf);
-        }
-        recv_buffer_read(sock->recv_buf, buf, read_len);
+  if (flags != NO_WAIT) {
+    while (recv_buffer_max_read(sock->recv_buf) == 0) {
+      if (wait_with_mode(&(sock->wait_cond), &(sock->recv_lock), flags,
+                         &deadline) == ETIMEDOUT) {
+        break;
       }
-      break;
-    default:
-      perror("ERROR Unknown flag.\n");
-      read_len = EXIT_ERROR;
+    }
+  }
+
+  if (recv_buffer_max_read(sock->recv_buf) > 0) {
+    if (recv_buffer_max_read(sock->recv_buf) > (uint32_t)length) {
+      read_len = length;
+    } else {
+      read_len = recv_buffer_max_read(sock->recv_buf);
+    }
+    recv_buffer_read(sock->recv_buf, buf, read_len);
+    if (window_update_due(sock, get_next_byte_expected_seqnum(sock->recv_buf),
+                          recv_buffer_max_receive(sock->recv_buf))) {
+      // let the backend tell the other side that the window opened
+      io_engine_wake(&(sock->io));
+    }
+  } else if (flags == TIMEOUT) {
+    errno = ETIMEDOUT;
   }
   pthread_mutex_unlock(&(sock->recv_lock));
   return read_len;
 }
 
 int cmu_write(cmu_socket_t *sock, const void *buf, int length) {
-  while (!sock->initialized) {}
-  
-  // printf("begin to write\n");
+  if (cmu_write_mode(sock, buf, length, NO_FLAG) < 0) {
+    return EXIT_ERROR;
+  }
+  return EXIT_SUCCESS;
+}
 
+int cmu_write_mode(cmu_socket_t *sock, const void *buf, int length,
+                   cmu_read_mode_t flags) {
   uint32_t written = 0;
+  struct timespec deadline = {0, 0};
 
-  while (length > 0) {
-    // printf("stuck in here\n");
-
-    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
-    }
+  if (length < 0) {
+    perror("ERROR negative length");
+    return EXIT_ERROR;
+  }
+  if (flags != NO_FLAG && flags != NO_WAIT && flags != TIMEOUT) {
+    perror("ERROR Unknown flag.\n");
+    return EXIT_ERROR;
+  }
+  if (flags == TIMEOUT) {
+    timeout_deadline(sock, &deadline);
+  }
+  send_deferred_syn(sock, true);
+  if (!writes_before_handshake(sock) && wait_for_handshake(sock, flags, &deadline) != 0) {
+    // nothing was buffered : unlike a short write, not a count of bytes
+    errno = ETIMEDOUT;
+    return EXIT_ERROR;
+  }
 
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  while (length > 0) {
     uint32_t write_len;
     if ((uint32_t)length > send_buffer_max_write(sock->send_buf)) {
       write_len = send_buffer_max_write(sock->send_buf);
@@ -210,14 +407,307 @@ int cmu_write(cmu_socket_t *sock, const void *buf, int length) {
       send_buffer_write(sock->send_buf, (uint8_t*)buf+written, write_len);
       written += write_len;
       length -= write_len;
-    } 
-    
-    // else {
-    //   pthread_cond_wait(&(sock->wait_cond2), &(sock->send_lock));
-    // }
+      io_engine_wake(&(sock->io));
+    } else if (flags == NO_WAIT) {
+      break;
+    } else if (wait_with_mode(&(sock->send_cond), &(sock->send_lock), flags,
+                              &deadline) == ETIMEDOUT) {
+      errno = ETIMEDOUT;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  return written;
+}
+
+// reads a non-negative int option value
+static int get_int_optval(const void *val, socklen_t len, int *out) {
+  if (len != sizeof(int) || *(const int *)val < 0) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  *out = *(const int *)val;
+  return EXIT_SUCCESS;
+}
+
+// stores an int option value
+static int put_int_optval(void *val, socklen_t *len, int in) {
+  if (*len < sizeof(int)) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  *(int *)val = in;
+  *len = sizeof(int);
+  return EXIT_SUCCESS;
+}
 
+// switches the socket to the congestion control algorithm named by 'val'
+static int set_congestion(cmu_socket_t *sock, const void *val, socklen_t len) {
+  char name[CC_NAME_MAX];
+  cc_t cc;
+
+  if (len == 0 || len >= CC_NAME_MAX) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  memcpy(name, val, len);
+  name[len] = '\0';
+  // the socket keeps its algorithm if the new one cannot be set up
+  if (cc_init(&cc, name, MSS) < 0) {
+    return EXIT_ERROR;
+  }
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  cc.sack = sock->cc.sack;
+  cc.mss = sock->window.mss;
+  cc_destroy(&(sock->cc));
+  sock->cc = cc;
+  pthread_mutex_unlock(&(sock->send_lock));
+  io_engine_wake(&(sock->io));
+  return EXIT_SUCCESS;
+}
+
+// stores the name of the socket's congestion control algorithm
+static int get_congestion(cmu_socket_t *sock, void *val, socklen_t *len) {
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  const char *name = sock->cc.ops->name;
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  socklen_t name_len = strlen(name);
+  if (*len < name_len) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  memcpy(val, name, name_len);
+  *len = name_len;
+  return EXIT_SUCCESS;
+}
+
+// sets the size of the receive or send buffer, until the handshake starts
+static int set_buff_size(cmu_socket_t *sock, cmu_sockopt_t opt, const void *val,
+                         socklen_t len) {
+  int intval;
+
+  if (get_int_optval(val, len, &intval) < 0) {
+    return EXIT_ERROR;
+  }
+  if (intval < 1 || (uint32_t)intval > MAX_BUFF_SIZE) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  if (sock->buff_size_fixed) {
     pthread_mutex_unlock(&(sock->send_lock));
+    errno = EISCONN;
+    return EXIT_ERROR;
+  }
+  if (opt == CMU_SO_RCVBUF) {
+    sock->rcvbuf_size = intval;
+    if (sock->window.wscale_ok) {
+      // enough to advertise the whole receive buffer
+      sock->window.rcv_wscale = ext_window_scale_for(intval);
+    }
+  } else {
+    sock->sndbuf_size = intval;
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  return EXIT_SUCCESS;
+}
+
+int cmu_setsockopt(cmu_socket_t *sock, cmu_sockopt_t opt, const void *val,
+                   socklen_t len) {
+  int intval;
+
+  if (sock == NULL || val == NULL) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+
+  switch (opt) {
+    case CMU_SO_TIMEOUT:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      sock->timeout_ms = intval;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return EXIT_SUCCESS;
+    case CMU_SO_BUSY_POLL:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      sock->busy_poll_us = intval;
+      sock->busy_poll_cur_us = intval;
+      pthread_mutex_unlock(&(sock->send_lock));
+      io_engine_wake(&(sock->io));
+      return EXIT_SUCCESS;
+    case CMU_SO_KERNEL_BUSY_POLL:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      if (setsockopt(sock->socket, SOL_SOCKET, SO_BUSY_POLL, &intval,
+                     sizeof(int)) < 0) {
+        perror("ERROR setting SO_BUSY_POLL");
+        return EXIT_ERROR;
+      }
+      return EXIT_SUCCESS;
+    case CMU_SO_CONGESTION:
+      return set_congestion(sock, val, len);
+    case CMU_SO_MAX_PACING_RATE:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      pacer_set_max_rate(&(sock->pacer), (uint64_t)intval, get_time_us());
+      pthread_mutex_unlock(&(sock->send_lock));
+      io_engine_wake(&(sock->io));
+      return EXIT_SUCCESS;
+    case CMU_SO_RTO_MIN:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      rto_set_min(&(sock->rto), (uint32_t)intval);
+      pthread_mutex_unlock(&(sock->send_lock));
+      io_engine_wake(&(sock->io));
+      return EXIT_SUCCESS;
+    case CMU_SO_ACK_FREQUENCY:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      if (intval < 1) {
+        errno = EINVAL;
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      sock->ack_frequency = intval;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return EXIT_SUCCESS;
+    case CMU_SO_DELACK_TIMEOUT:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      sock->delack_us = intval;
+      pthread_mutex_unlock(&(sock->send_lock));
+      io_engine_wake(&(sock->io));
+      return EXIT_SUCCESS;
+    case CMU_SO_NODELAY:
+    case CMU_SO_CORK:
+      if (get_int_optval(val, len, &intval) < 0) {
+        return EXIT_ERROR;
+      }
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      if (opt == CMU_SO_NODELAY) {
+        sock->nodelay = intval != 0;
+      } else {
+        sock->cork = intval != 0;
+      }
+      pthread_mutex_unlock(&(sock->send_lock));
+      // data held back may go out now
+      io_engine_wake(&(sock->io));
+      return EXIT_SUCCESS;
+    case CMU_SO_RCVBUF:
+    case CMU_SO_SNDBUF:
+      return set_buff_size(sock, opt, val, len);
+    default:
+      errno = ENOPROTOOPT;
+      return EXIT_ERROR;
+  }
+}
+
+int cmu_getsockopt(cmu_socket_t *sock, cmu_sockopt_t opt, void *val,
+                   socklen_t *len) {
+  int intval;
+  socklen_t intlen = sizeof(int);
+
+  if (sock == NULL || val == NULL || len == NULL) {
+    errno = EINVAL;
+    return EXIT_ERROR;
   }
 
+  switch (opt) {
+    case CMU_SO_TIMEOUT:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = sock->timeout_ms;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    case CMU_SO_BUSY_POLL:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = sock->busy_poll_us;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    case CMU_SO_KERNEL_BUSY_POLL:
+      if (getsockopt(sock->socket, SOL_SOCKET, SO_BUSY_POLL, &intval,
+                     &intlen) < 0) {
+        return EXIT_ERROR;
+      }
+      return put_int_optval(val, len, intval);
+    case CMU_SO_CONGESTION:
+      return get_congestion(sock, val, len);
+    case CMU_SO_MAX_PACING_RATE:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = (int)sock->pacer.max_rate;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    case CMU_SO_RTO_MIN:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = (int)sock->rto.min_us;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    case CMU_SO_ACK_FREQUENCY:
+    case CMU_SO_DELACK_TIMEOUT:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = opt == CMU_SO_ACK_FREQUENCY ? sock->ack_frequency : sock->delack_us;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    case CMU_SO_NODELAY:
+      return put_int_optval(val, len, sock->nodelay);
+    case CMU_SO_CORK:
+      return put_int_optval(val, len, sock->cork);
+    case CMU_SO_RCVBUF:
+    case CMU_SO_SNDBUF:
+      while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+      }
+      intval = opt == CMU_SO_RCVBUF ? sock->rcvbuf_size : sock->sndbuf_size;
+      pthread_mutex_unlock(&(sock->send_lock));
+      return put_int_optval(val, len, intval);
+    default:
+      errno = ENOPROTOOPT;
+      return EXIT_ERROR;
+  }
+}
+
+int cmu_get_stats(cmu_socket_t *sock, cmu_socket_stats_t *stats) {
+  if (sock == NULL || stats == NULL) {
+    errno = EINVAL;
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  *stats = sock->stats;
+  stats->srtt_us = sock->rto.srtt_us;
+  stats->rttvar_us = sock->rto.rttvar_us;
+  stats->rto_us = sock->rto.rto_us;
+  stats->rto_backoff = sock->rto.backoff;
+  stats->mss = sock->window.mss;
+  pthread_mutex_unlock(&(sock->send_lock));
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,816 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmu_packet.h"
+#include "congestion.h"
+#include "grading.h"
+
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+/* ********************************** */
+/* ************** none ************** */
+/* ********************************** */
+
+// no congestion control : the window never limits sending
+
+static int none_init(cc_t* cc) {
+  cc->cwnd = UINT32_MAX;
+  cc->ssthresh = UINT32_MAX;
+  cc->state = NULL;
+  return 0;
+}
+
+static void none_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  (void)cc;
+  (void)ack;
+}
+
+static void none_on_dupack(cc_t* cc, uint32_t count, uint32_t inflight) {
+  (void)cc;
+  (void)count;
+  (void)inflight;
+}
+
+static void none_on_event(cc_t* cc, uint32_t inflight) {
+  (void)cc;
+  (void)inflight;
+}
+
+static void none_on_send(cc_t* cc, uint32_t bytes, uint32_t inflight,
+                         bool retransmit) {
+  (void)cc;
+  (void)bytes;
+  (void)inflight;
+  (void)retransmit;
+}
+
+static uint64_t none_pacing_rate(cc_t* cc) {
+  (void)cc;
+  return 0;
+}
+
+static void none_destroy(cc_t* cc) { (void)cc; }
+
+const cc_ops_t cc_none_ops = {
+    .name = "none",
+    .init = none_init,
+    .on_ack = none_on_ack,
+    .on_dupack = none_on_dupack,
+    .on_loss = none_on_event,
+    .on_rto = none_on_event,
+    .on_send = none_on_send,
+    .pacing_rate = none_pacing_rate,
+    .destroy = none_destroy,
+};
+
+/* ********************************** */
+/* ********** loss-based ************ */
+/* ********************************** */
+
+// the window during fast recovery (RFC 6582) is managed the same way by every
+// loss-based algorithm below; only the reduction on loss and the growth differ.
+// with SACK (cc->sack), what left the network is already out of 'inflight', so
+// the window stays at ssthresh instead of being inflated and deflated (RFC
+// 6675)
+
+// whether the window limited sending before this ACK; cwnd does not grow when
+// the advertised window or the application is the limit (RFC 7661), or it
+// would end up far above anything that was ever in flight
+static bool cwnd_limited(cc_t* cc, const cc_ack_t* ack) {
+  uint32_t prior_inflight = ack->inflight + ack->acked;
+  if (cc->cwnd < cc->ssthresh) {
+    return cc->cwnd < 2 * prior_inflight;
+  }
+  return prior_inflight + cc->mss > cc->cwnd;
+}
+
+// handles an ACK that arrives in fast recovery or ends it
+// returns false if not in fast recovery, i.e. the algorithm should grow cwnd
+static bool recovery_on_ack(cc_t* cc, const cc_ack_t* ack, bool* in_recovery) {
+  if (ack->recovery == CC_RECOVERY_PARTIAL) {
+    if (!cc->sack) {
+      // deflate by what was acknowledged, then add back the segment that is
+      // resent right away
+      cc->cwnd = (cc->cwnd > ack->acked ? cc->cwnd - ack->acked : 0) + cc->mss;
+    }
+    return true;
+  }
+  if (ack->recovery == CC_RECOVERY_DONE || *in_recovery) {
+    // deflate the window inflated by the duplicate ACKs
+    *in_recovery = false;
+    cc->cwnd = cc->ssthresh;
+    return true;
+  }
+  return false;
+}
+
+// each duplicate ACK during fast recovery means a segment left the network
+static void recovery_on_dupack(cc_t* cc, bool in_recovery) {
+  if (in_recovery && !cc->sack) {
+    cc->cwnd += cc->mss;
+  }
+}
+
+// after the reduction, the 3 duplicate ACKs are 3 segments that left the
+// network
+static void recovery_on_loss(cc_t* cc, bool* in_recovery) {
+  cc->cwnd = cc->ssthresh + (cc->sack ? 0 : CC_DUPACK_THRESHOLD * cc->mss);
+  *in_recovery = true;
+}
+
+// appropriate byte counting with L = 2 MSS (RFC 3465) : an ACK delayed to cover
+// two segments still grows the window by both
+static void slow_start_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  cc->cwnd += MIN(ack->acked, 2 * cc->mss);
+}
+
+/* ********************************** */
+/* ************** reno ************** */
+/* ********************************** */
+
+// NewReno (RFC 5681, RFC 6582) : slow start, congestion avoidance, and fast
+// recovery that stays until everything outstanding at the loss is acknowledged
+
+typedef struct {
+  uint32_t ca_acked;  // bytes acknowledged towards the next cwnd increase
+                      // in congestion avoidance
+  bool in_recovery;
+} reno_state_t;
+
+static int reno_init(cc_t* cc) {
+  cc->cwnd = WINDOW_INITIAL_WINDOW_SIZE;
+  cc->ssthresh = WINDOW_INITIAL_SSTHRESH;
+  cc->state = calloc(1, sizeof(reno_state_t));
+  if (cc->state == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+static void reno_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  reno_state_t* st = (reno_state_t*)cc->state;
+
+  if (recovery_on_ack(cc, ack, &st->in_recovery)) {
+    st->ca_acked = 0;
+    return;
+  }
+  if (!cwnd_limited(cc, ack)) {
+    return;
+  }
+  if (cc->cwnd < cc->ssthresh) {
+    slow_start_on_ack(cc, ack);
+    return;
+  }
+  // congestion avoidance : one MSS per window of acknowledged data
+  st->ca_acked += ack->acked;
+  if (st->ca_acked >= cc->cwnd) {
+    st->ca_acked -= cc->cwnd;
+    cc->cwnd += cc->mss;
+  }
+}
+
+static void reno_on_dupack(cc_t* cc, uint32_t count, uint32_t inflight) {
+  reno_state_t* st = (reno_state_t*)cc->state;
+  (void)count;
+  (void)inflight;
+
+  recovery_on_dupack(cc, st->in_recovery);
+}
+
+// half of what is in flight, but no less than 2 segments
+static uint32_t reno_reduced_ssthresh(cc_t* cc, uint32_t inflight) {
+  return MAX(inflight / 2, 2 * cc->mss);
+}
+
+static void reno_on_loss(cc_t* cc, uint32_t inflight) {
+  reno_state_t* st = (reno_state_t*)cc->state;
+
+  cc->ssthresh = reno_reduced_ssthresh(cc, inflight);
+  recovery_on_loss(cc, &st->in_recovery);
+  st->ca_acked = 0;
+}
+
+static void reno_on_rto(cc_t* cc, uint32_t inflight) {
+  reno_state_t* st = (reno_state_t*)cc->state;
+
+  cc->ssthresh = reno_reduced_ssthresh(cc, inflight);
+  cc->cwnd = cc->mss;
+  st->in_recovery = false;
+  st->ca_acked = 0;
+}
+
+static void reno_destroy(cc_t* cc) { free(cc->state); }
+
+const cc_ops_t cc_reno_ops = {
+    .name = "reno",
+    .init = reno_init,
+    .on_ack = reno_on_ack,
+    .on_dupack = reno_on_dupack,
+    .on_loss = reno_on_loss,
+    .on_rto = reno_on_rto,
+    .on_send = none_on_send,
+    .pacing_rate = none_pacing_rate,
+    .destroy = reno_destroy,
+};
+
+/* ********************************** */
+/* ************* cubic ************** */
+/* ********************************** */
+
+// CUBIC (RFC 9438) : after a reduction, cwnd follows a cubic function of the
+// time since the reduction that quickly grows back to the window where the
+// loss happened (w_max), stays flat around it, then probes beyond it. Windows
+// below are in segments, as in the RFC.
+// HyStart (delay increase only) leaves slow start once the RTT of a round is
+// clearly above the one of the previous round, before the queue overflows.
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+// additive increase of the TCP-friendly estimate while below w_max
+#define CUBIC_ALPHA (3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA))
+
+// HyStart is not used below this window, in segments
+#define HYSTART_LOW_WINDOW 16
+// bounds on the RTT increase, in microseconds, that ends slow start
+#define HYSTART_MIN_ETA_US 4000
+#define HYSTART_MAX_ETA_US 16000
+
+typedef struct {
+  bool in_recovery;
+  double cwnd_frac;  // bytes of increase not yet added to cwnd
+  double w_max;      // window just before the last reduction
+  double k;          // seconds the cubic function takes to reach w_max
+  double origin;     // window at the plateau of the cubic function
+  double w_est;      // window a Reno flow would have (TCP-friendly region)
+  uint64_t epoch_start_us;  // start of the current epoch, 0 before the first
+                            // ACK of congestion avoidance
+  uint32_t min_rtt_us;      // 0 until the first RTT sample
+
+  // HyStart rounds : a round ends once a window of data was acknowledged
+  uint32_t round_acked;
+  uint32_t round_window;
+  uint32_t round_min_rtt_us;
+  uint32_t last_round_min_rtt_us;
+} cubic_state_t;
+
+static void cubic_reset_epoch(cubic_state_t* st) {
+  st->epoch_start_us = 0;
+  st->cwnd_frac = 0;
+}
+
+static int cubic_init(cc_t* cc) {
+  cubic_state_t* st = calloc(1, sizeof(cubic_state_t));
+  if (st == NULL) {
+    cc->state = NULL;
+    return -1;
+  }
+  cc->cwnd = WINDOW_INITIAL_WINDOW_SIZE;
+  cc->ssthresh = WINDOW_INITIAL_SSTHRESH;
+  st->round_window = cc->cwnd;
+  cc->state = st;
+  return 0;
+}
+
+// leave slow start if this round's RTT grew past the previous one's by eta
+static void hystart_on_ack(cc_t* cc, cubic_state_t* st, const cc_ack_t* ack) {
+  if (ack->rtt_us > 0 &&
+      (st->round_min_rtt_us == 0 || ack->rtt_us < st->round_min_rtt_us)) {
+    st->round_min_rtt_us = ack->rtt_us;
+  }
+  st->round_acked += ack->acked;
+  if (st->round_acked < st->round_window) {
+    return;
+  }
+
+  if (st->round_min_rtt_us != 0 && st->last_round_min_rtt_us != 0 &&
+      cc->cwnd >= HYSTART_LOW_WINDOW * cc->mss) {
+    uint32_t eta = MIN(MAX(st->last_round_min_rtt_us / 8, HYSTART_MIN_ETA_US),
+                       HYSTART_MAX_ETA_US);
+    if (st->round_min_rtt_us >= st->last_round_min_rtt_us + eta) {
+      cc->ssthresh = cc->cwnd;
+    }
+  }
+  if (st->round_min_rtt_us != 0) {
+    st->last_round_min_rtt_us = st->round_min_rtt_us;
+  }
+  st->round_min_rtt_us = 0;
+  st->round_acked = 0;
+  st->round_window = cc->cwnd;
+}
+
+static void cubic_congestion_avoidance(cc_t* cc, cubic_state_t* st,
+                                       const cc_ack_t* ack) {
+  double cwnd = (double)cc->cwnd / cc->mss;
+  double acked = (double)ack->acked / cc->mss;
+
+  if (st->epoch_start_us == 0) {
+    st->epoch_start_us = ack->now_us;
+    if (cwnd < st->w_max) {
+      st->k = cbrt((st->w_max - cwnd) / CUBIC_C);
+      st->origin = st->w_max;
+    } else {
+      st->k = 0;
+      st->origin = cwnd;
+    }
+    st->w_est = cwnd;
+  }
+
+  // aim for the window the cubic function gives one RTT from now
+  double t =
+      (double)(ack->now_us - st->epoch_start_us + st->min_rtt_us) / 1e6 - st->k;
+  double target = st->origin + CUBIC_C * t * t * t;
+  target = MIN(MAX(target, cwnd), 1.5 * cwnd);
+
+  // the window of a Reno flow with the same reduction, grown per ACK
+  st->w_est += (st->w_est >= st->w_max ? 1.0 : CUBIC_ALPHA) * acked / cwnd;
+
+  double inc;
+  if (target < st->w_est) {
+    // TCP-friendly region : do at least as well as Reno
+    inc = (st->w_est - cwnd) * cc->mss;
+  } else {
+    inc = (target - cwnd) / cwnd * ack->acked;
+  }
+  st->cwnd_frac += MAX(inc, 0);
+  uint32_t whole = (uint32_t)st->cwnd_frac;
+  cc->cwnd += whole;
+  st->cwnd_frac -= whole;
+}
+
+static void cubic_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  cubic_state_t* st = (cubic_state_t*)cc->state;
+
+  if (ack->rtt_us > 0 &&
+      (st->min_rtt_us == 0 || ack->rtt_us < st->min_rtt_us)) {
+    st->min_rtt_us = ack->rtt_us;
+  }
+  if (recovery_on_ack(cc, ack, &st->in_recovery)) {
+    return;
+  }
+  if (!cwnd_limited(cc, ack)) {
+    return;
+  }
+  if (cc->cwnd < cc->ssthresh) {
+    slow_start_on_ack(cc, ack);
+    hystart_on_ack(cc, st, ack);
+    return;
+  }
+  cubic_congestion_avoidance(cc, st, ack);
+}
+
+static void cubic_on_dupack(cc_t* cc, uint32_t count, uint32_t inflight) {
+  cubic_state_t* st = (cubic_state_t*)cc->state;
+  (void)count;
+  (void)inflight;
+
+  recovery_on_dupack(cc, st->in_recovery);
+}
+
+// multiplicative decrease, remembering where the loss happened
+static void cubic_reduce(cc_t* cc, cubic_state_t* st) {
+  double cwnd = (double)cc->cwnd / cc->mss;
+
+  // fast convergence : a flow that lost before reaching its previous w_max
+  // is likely competing with a new flow, so it gives up more bandwidth
+  if (cwnd < st->w_max) {
+    st->w_max = cwnd * (1.0 + CUBIC_BETA) / 2.0;
+  } else {
+    st->w_max = cwnd;
+  }
+  cc->ssthresh = MAX((uint32_t)(cc->cwnd * CUBIC_BETA), 2 * cc->mss);
+  cubic_reset_epoch(st);
+}
+
+static void cubic_on_loss(cc_t* cc, uint32_t inflight) {
+  cubic_state_t* st = (cubic_state_t*)cc->state;
+  (void)inflight;
+
+  cubic_reduce(cc, st);
+  recovery_on_loss(cc, &st->in_recovery);
+}
+
+static void cubic_on_rto(cc_t* cc, uint32_t inflight) {
+  cubic_state_t* st = (cubic_state_t*)cc->state;
+  (void)inflight;
+
+  cubic_reduce(cc, st);
+  cc->cwnd = cc->mss;
+  st->in_recovery = false;
+  st->round_acked = 0;
+  st->round_window = cc->cwnd;
+}
+
+static void cubic_destroy(cc_t* cc) { free(cc->state); }
+
+const cc_ops_t cc_cubic_ops = {
+    .name = "cubic",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_dupack = cubic_on_dupack,
+    .on_loss = cubic_on_loss,
+    .on_rto = cubic_on_rto,
+    .on_send = none_on_send,
+    .pacing_rate = none_pacing_rate,
+    .destroy = cubic_destroy,
+};
+
+/* ********************************** */
+/* ************** bbr *************** */
+/* ********************************** */
+
+// BBR (v1, draft-cardwell-iccrg-bbr-congestion-control-00) : instead of
+// reacting to losses, keep a model of the path, the bottleneck bandwidth
+// (windowed max of the delivery rate) and the min RTT, and pace at that
+// bandwidth with about one bandwidth-delay product in flight. It goes through
+//   startup   : doubles the rate each round until the bandwidth stops growing
+//   drain     : empties the queue startup built
+//   probe-bw  : cycles the rate gain 1.25, 0.75, then 1 for 6 rounds
+//   probe-rtt : drops to 4 segments for 200 ms if the min RTT is 10 s old
+
+#define BBR_HIGH_GAIN 2.885  // 2/ln(2)
+#define BBR_DRAIN_GAIN (1.0 / BBR_HIGH_GAIN)
+#define BBR_CWND_GAIN 2.0
+#define BBR_GAIN_CYCLE_LEN 8
+// rounds over which the bandwidth samples are kept
+#define BBR_BW_ROUNDS 10
+#define BBR_MIN_RTT_WINDOW_US 10000000
+#define BBR_PROBE_RTT_US 200000
+#define BBR_MIN_CWND_SEGMENTS 4
+// startup ends after this many rounds without 25% more bandwidth
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_FULL_BW_GROWTH 1.25
+// the RTT assumed before the first sample
+#define BBR_DEFAULT_RTT_US 1000
+
+static const double bbr_pacing_gain_cycle[BBR_GAIN_CYCLE_LEN] = {
+    1.25, 0.75, 1, 1, 1, 1, 1, 1,
+};
+
+typedef enum {
+  BBR_STARTUP,
+  BBR_DRAIN,
+  BBR_PROBE_BW,
+  BBR_PROBE_RTT,
+} bbr_mode_t;
+
+typedef struct {
+  bbr_mode_t mode;
+  double pacing_gain;
+  double cwnd_gain;
+  uint64_t pacing_rate;  // bytes per second
+  bool rate_measured;    // pacing_rate comes from a bandwidth sample
+
+  // max delivery rate of each of the last BBR_BW_ROUNDS rounds
+  uint64_t bw_samples[BBR_BW_ROUNDS];
+  uint32_t min_rtt_us;  // 0 until the first RTT sample
+  uint64_t min_rtt_stamp_us;
+
+  // a round ends when a segment sent after the previous round ended is
+  // acknowledged
+  uint64_t round_count;
+  uint64_t next_round_delivered;
+  bool round_start;
+
+  uint64_t full_bw;
+  uint32_t full_bw_rounds;
+  bool filled_pipe;
+
+  uint32_t cycle_index;
+  uint64_t cycle_stamp_us;
+
+  // 0 until the 4 segments are all that is in flight
+  uint64_t probe_rtt_done_us;
+  bool probe_rtt_round_done;
+  uint32_t prior_cwnd;  // restored after probe-rtt and recovery
+  bool in_recovery;
+} bbr_state_t;
+
+static uint64_t bbr_bw(bbr_state_t* st) {
+  uint64_t bw = 0;
+  for (int i = 0; i < BBR_BW_ROUNDS; i++) {
+    bw = MAX(bw, st->bw_samples[i]);
+  }
+  return bw;
+}
+
+// bytes in flight for 'gain' times the bandwidth-delay product
+static uint32_t bbr_inflight(cc_t* cc, bbr_state_t* st, double gain) {
+  uint64_t bw = bbr_bw(st);
+  if (bw == 0 || st->min_rtt_us == 0) {
+    return WINDOW_INITIAL_WINDOW_SIZE;
+  }
+  double bdp = (double)bw * st->min_rtt_us / 1e6;
+  // a few more segments for delayed and stretched ACKs
+  return (uint32_t)(gain * bdp) + 3 * cc->mss;
+}
+
+static void bbr_set_pacing_rate(cc_t* cc, bbr_state_t* st) {
+  uint64_t bw = bbr_bw(st);
+  if (bw == 0) {
+    // no sample yet : the initial window over the RTT, or a nominal RTT
+    uint32_t rtt_us = st->min_rtt_us ? st->min_rtt_us : BBR_DEFAULT_RTT_US;
+    st->pacing_rate = (uint64_t)(st->pacing_gain * cc->cwnd * 1000000 / rtt_us);
+    return;
+  }
+  uint64_t rate = (uint64_t)(st->pacing_gain * bw);
+  // once measured, the rate never goes down in startup
+  if (st->filled_pipe || !st->rate_measured || rate > st->pacing_rate) {
+    st->pacing_rate = rate;
+    st->rate_measured = true;
+  }
+}
+
+static void bbr_enter_probe_bw(bbr_state_t* st, uint64_t now_us) {
+  st->mode = BBR_PROBE_BW;
+  st->cwnd_gain = BBR_CWND_GAIN;
+  // start at any phase but the 0.75 one
+  st->cycle_index = (uint32_t)(now_us % (BBR_GAIN_CYCLE_LEN - 1));
+  if (st->cycle_index >= 1) {
+    st->cycle_index++;
+  }
+  st->cycle_stamp_us = now_us;
+  st->pacing_gain = bbr_pacing_gain_cycle[st->cycle_index];
+}
+
+static void bbr_enter_startup(bbr_state_t* st) {
+  st->mode = BBR_STARTUP;
+  st->pacing_gain = BBR_HIGH_GAIN;
+  st->cwnd_gain = BBR_HIGH_GAIN;
+}
+
+static int bbr_init(cc_t* cc) {
+  bbr_state_t* st = calloc(1, sizeof(bbr_state_t));
+  if (st == NULL) {
+    cc->state = NULL;
+    return -1;
+  }
+  cc->cwnd = WINDOW_INITIAL_WINDOW_SIZE;
+  cc->ssthresh = UINT32_MAX;
+  cc->state = st;
+  bbr_enter_startup(st);
+  bbr_set_pacing_rate(cc, st);
+  return 0;
+}
+
+static void bbr_update_round(bbr_state_t* st, const cc_ack_t* ack) {
+  st->round_start = false;
+  if (ack->delivery_rate > 0 &&
+      ack->prior_delivered >= st->next_round_delivered) {
+    st->next_round_delivered = ack->delivered;
+    st->round_count++;
+    st->round_start = true;
+    st->bw_samples[st->round_count % BBR_BW_ROUNDS] = 0;
+  }
+}
+
+static void bbr_update_bw(bbr_state_t* st, const cc_ack_t* ack) {
+  if (ack->delivery_rate == 0) {
+    return;
+  }
+  // an interval shorter than the RTT is ACK compression, not the path
+  if (st->min_rtt_us != 0 && ack->interval_us < st->min_rtt_us) {
+    return;
+  }
+  // an app-limited sample only counts if it is above the estimate anyway
+  if (ack->app_limited && ack->delivery_rate < bbr_bw(st)) {
+    return;
+  }
+  uint64_t* slot = &st->bw_samples[st->round_count % BBR_BW_ROUNDS];
+  *slot = MAX(*slot, ack->delivery_rate);
+}
+
+static void bbr_check_full_pipe(bbr_state_t* st, const cc_ack_t* ack) {
+  if (st->filled_pipe || !st->round_start || ack->app_limited) {
+    return;
+  }
+  uint64_t bw = bbr_bw(st);
+  if (bw >= st->full_bw * BBR_FULL_BW_GROWTH) {
+    st->full_bw = bw;
+    st->full_bw_rounds = 0;
+    return;
+  }
+  st->full_bw_rounds++;
+  if (st->full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+    st->filled_pipe = true;
+  }
+}
+
+static void bbr_update_cycle(cc_t* cc, bbr_state_t* st, const cc_ack_t* ack) {
+  if (st->mode != BBR_PROBE_BW) {
+    return;
+  }
+  bool next = ack->now_us - st->cycle_stamp_us > st->min_rtt_us;
+  uint32_t prior_inflight = ack->inflight + ack->acked;
+  if (st->pacing_gain > 1) {
+    // probe until the extra data is really in flight
+    next = next && prior_inflight >= bbr_inflight(cc, st, st->pacing_gain);
+  } else if (st->pacing_gain < 1) {
+    // drain as soon as the queue is gone
+    next = next || prior_inflight <= bbr_inflight(cc, st, 1);
+  }
+  if (next) {
+    st->cycle_index = (st->cycle_index + 1) % BBR_GAIN_CYCLE_LEN;
+    st->cycle_stamp_us = ack->now_us;
+    st->pacing_gain = bbr_pacing_gain_cycle[st->cycle_index];
+  }
+}
+
+static void bbr_update_mode(cc_t* cc, bbr_state_t* st, const cc_ack_t* ack) {
+  if (st->mode == BBR_STARTUP && st->filled_pipe) {
+    st->mode = BBR_DRAIN;
+    st->pacing_gain = BBR_DRAIN_GAIN;
+    st->cwnd_gain = BBR_HIGH_GAIN;
+  }
+  if (st->mode == BBR_DRAIN && ack->inflight <= bbr_inflight(cc, st, 1)) {
+    bbr_enter_probe_bw(st, ack->now_us);
+  }
+}
+
+static void bbr_update_min_rtt(cc_t* cc, bbr_state_t* st, const cc_ack_t* ack) {
+  bool expired = st->min_rtt_us != 0 &&
+                 ack->now_us > st->min_rtt_stamp_us + BBR_MIN_RTT_WINDOW_US;
+  if (ack->rtt_us > 0 &&
+      (st->min_rtt_us == 0 || ack->rtt_us <= st->min_rtt_us || expired)) {
+    st->min_rtt_us = ack->rtt_us;
+    st->min_rtt_stamp_us = ack->now_us;
+  }
+
+  if (expired && st->mode != BBR_PROBE_RTT) {
+    st->mode = BBR_PROBE_RTT;
+    st->pacing_gain = 1;
+    st->cwnd_gain = 1;
+    st->prior_cwnd = MAX(st->prior_cwnd, cc->cwnd);
+    st->probe_rtt_done_us = 0;
+  }
+  if (st->mode != BBR_PROBE_RTT) {
+    return;
+  }
+  if (st->probe_rtt_done_us == 0 &&
+      ack->inflight <= BBR_MIN_CWND_SEGMENTS * cc->mss) {
+    st->probe_rtt_done_us = ack->now_us + BBR_PROBE_RTT_US;
+    st->probe_rtt_round_done = false;
+    st->next_round_delivered = ack->delivered;
+  } else if (st->probe_rtt_done_us != 0) {
+    if (st->round_start) {
+      st->probe_rtt_round_done = true;
+    }
+    if (st->probe_rtt_round_done && ack->now_us > st->probe_rtt_done_us) {
+      st->min_rtt_stamp_us = ack->now_us;
+      cc->cwnd = MAX(cc->cwnd, st->prior_cwnd);
+      st->prior_cwnd = 0;
+      if (st->filled_pipe) {
+        bbr_enter_probe_bw(st, ack->now_us);
+      } else {
+        bbr_enter_startup(st);
+      }
+    }
+  }
+}
+
+static void bbr_set_cwnd(cc_t* cc, bbr_state_t* st, const cc_ack_t* ack) {
+  uint32_t min_cwnd = BBR_MIN_CWND_SEGMENTS * cc->mss;
+  uint32_t target = bbr_inflight(cc, st, st->cwnd_gain);
+
+  if (st->in_recovery) {
+    // packet conservation : send one segment per segment delivered
+    cc->cwnd = MAX(cc->cwnd, ack->inflight + ack->acked);
+  } else if (st->filled_pipe) {
+    cc->cwnd = MIN(cc->cwnd + ack->acked, target);
+  } else if (cc->cwnd < target || ack->delivered < WINDOW_INITIAL_WINDOW_SIZE) {
+    cc->cwnd += ack->acked;
+  }
+  cc->cwnd = MAX(cc->cwnd, min_cwnd);
+  if (st->mode == BBR_PROBE_RTT) {
+    cc->cwnd = MIN(cc->cwnd, min_cwnd);
+  }
+}
+
+static void bbr_on_ack(cc_t* cc, const cc_ack_t* ack) {
+  bbr_state_t* st = (bbr_state_t*)cc->state;
+
+  if (ack->recovery == CC_RECOVERY_DONE ||
+      (st->in_recovery && ack->recovery == CC_RECOVERY_NONE)) {
+    st->in_recovery = false;
+    cc->cwnd = MAX(cc->cwnd, st->prior_cwnd);
+    st->prior_cwnd = 0;
+  }
+  bbr_update_round(st, ack);
+  bbr_update_bw(st, ack);
+  bbr_update_cycle(cc, st, ack);
+  bbr_check_full_pipe(st, ack);
+  bbr_update_mode(cc, st, ack);
+  bbr_update_min_rtt(cc, st, ack);
+  bbr_set_pacing_rate(cc, st);
+  bbr_set_cwnd(cc, st, ack);
+}
+
+static void bbr_on_dupack(cc_t* cc, uint32_t count, uint32_t inflight) {
+  (void)cc;
+  (void)count;
+  (void)inflight;
+}
+
+// losses are not a congestion signal to BBR, only a reason to stop adding data
+static void bbr_on_loss(cc_t* cc, uint32_t inflight) {
+  bbr_state_t* st = (bbr_state_t*)cc->state;
+
+  st->prior_cwnd = MAX(st->prior_cwnd, cc->cwnd);
+  st->in_recovery = true;
+  cc->cwnd = MAX(inflight + cc->mss, BBR_MIN_CWND_SEGMENTS * cc->mss);
+  // a queue that overflows in startup is full too, even if the bandwidth
+  // samples were app-limited and could not tell
+  if (!st->filled_pipe && st->rate_measured &&
+      ++st->full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+    st->filled_pipe = true;
+  }
+}
+
+static void bbr_on_rto(cc_t* cc, uint32_t inflight) {
+  bbr_state_t* st = (bbr_state_t*)cc->state;
+  (void)inflight;
+
+  // everything in flight is presumed lost
+  st->prior_cwnd = MAX(st->prior_cwnd, cc->cwnd);
+  st->in_recovery = true;
+  cc->cwnd = cc->mss;
+}
+
+static uint64_t bbr_pacing_rate(cc_t* cc) {
+  bbr_state_t* st = (bbr_state_t*)cc->state;
+  return st->pacing_rate;
+}
+
+static void bbr_destroy(cc_t* cc) { free(cc->state); }
+
+const cc_ops_t cc_bbr_ops = {
+    .name = "bbr",
+    .init = bbr_init,
+    .on_ack = bbr_on_ack,
+    .on_dupack = bbr_on_dupack,
+    .on_loss = bbr_on_loss,
+    .on_rto = bbr_on_rto,
+    .on_send = none_on_send,
+    .pacing_rate = bbr_pacing_rate,
+    .destroy = bbr_destroy,
+};
+
+/* ********************************** */
+/* *********** Interface *********** */
+/* ********************************** */
+
+static const cc_ops_t* const cc_algorithms[] = {
+    &cc_none_ops,
+    &cc_reno_ops,
+    &cc_cubic_ops,
+    &cc_bbr_ops,
+};
+
+const cc_ops_t* cc_find(const char* name) {
+  for (size_t i = 0; i < sizeof(cc_algorithms) / sizeof(cc_algorithms[0]);
+       i++) {
+    if (strcmp(cc_algorithms[i]->name, name) == 0) {
+      return cc_algorithms[i];
+    }
+  }
+  return NULL;
+}
+
+int cc_init(cc_t* cc, const char* name, uint32_t mss) {
+  const cc_ops_t* ops;
+
+  if (name != NULL) {
+    ops = cc_find(name);
+    if (ops == NULL) {
+      errno = ENOENT;
+      return -1;
+    }
+  } else {
+    name = getenv(CC_ENV);
+    ops = name != NULL ? cc_find(name) : NULL;
+    if (name != NULL && ops == NULL) {
+      fprintf(stderr, "unknown congestion control '%s', using %s\n", name,
+              CC_DEFAULT);
+    }
+    if (ops == NULL) {
+      ops = cc_find(CC_DEFAULT);
+    }
+  }
+
+  cc->ops = ops;
+  cc->mss = mss;
+  cc->sack = false;
+  if (cc->ops->init(cc) < 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+void cc_destroy(cc_t* cc) {
+  cc->ops->destroy(cc);
+  cc->state = NULL;
+}
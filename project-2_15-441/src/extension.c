@@ -0,0 +1,182 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "extension.h"
+
+static void put_u32(uint8_t* buf, uint32_t val) {
+  val = htonl(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+static void put_u16(uint8_t* buf, uint16_t val) {
+  val = htons(val);
+  memcpy(buf, &val, sizeof(val));
+}
+
+static uint16_t get_u16(const uint8_t* buf) {
+  uint16_t val;
+  memcpy(&val, buf, sizeof(val));
+  return ntohs(val);
+}
+
+static uint32_t get_u32(const uint8_t* buf) {
+  uint32_t val;
+  memcpy(&val, buf, sizeof(val));
+  return ntohl(val);
+}
+
+uint16_t ext_put_timestamp(uint8_t* buf, uint16_t len, uint32_t ts_val,
+                           uint32_t ts_ecr) {
+  buf[len] = EXT_KIND_TIMESTAMP;
+  buf[len + 1] = EXT_TIMESTAMP_LEN;
+  put_u32(buf + len + 2, ts_val);
+  put_u32(buf + len + 6, ts_ecr);
+  return len + EXT_TIMESTAMP_LEN;
+}
+
+uint16_t ext_put_mss(uint8_t* buf, uint16_t len, uint16_t mss) {
+  buf[len] = EXT_KIND_MSS;
+  buf[len + 1] = EXT_MSS_LEN;
+  put_u16(buf + len + 2, mss);
+  return len + EXT_MSS_LEN;
+}
+
+uint16_t ext_put_probe(uint8_t* buf, uint16_t len, uint8_t kind,
+                       uint16_t size) {
+  buf[len] = kind;
+  buf[len + 1] = EXT_PROBE_LEN;
+  put_u16(buf + len + 2, size);
+  return len + EXT_PROBE_LEN;
+}
+
+uint16_t ext_put_fastopen(uint8_t* buf, uint16_t len, const uint8_t* cookie,
+                          uint8_t cookie_len) {
+  buf[len] = EXT_KIND_FASTOPEN;
+  buf[len + 1] = 2 + cookie_len;
+  memcpy(buf + len + 2, cookie, cookie_len);
+  return len + 2 + cookie_len;
+}
+
+uint16_t ext_put_window_scale(uint8_t* buf, uint16_t len, uint8_t shift) {
+  buf[len] = EXT_KIND_WINDOW_SCALE;
+  buf[len + 1] = EXT_WINDOW_SCALE_LEN;
+  buf[len + 2] = shift;
+  return len + EXT_WINDOW_SCALE_LEN;
+}
+
+uint16_t ext_put_sack_permitted(uint8_t* buf, uint16_t len) {
+  buf[len] = EXT_KIND_SACK_PERMITTED;
+  buf[len + 1] = EXT_SACK_PERMITTED_LEN;
+  return len + EXT_SACK_PERMITTED_LEN;
+}
+
+uint16_t ext_put_sack(uint8_t* buf, uint16_t len, uint16_t room,
+                      const sack_block_t* blocks, uint32_t count) {
+  if (room < len + 2) {
+    return len;
+  }
+  uint32_t fit = (room - len - 2) / EXT_SACK_BLOCK_LEN;
+  count = count < fit ? count : fit;
+  count = count < EXT_MAX_SACK_BLOCKS ? count : EXT_MAX_SACK_BLOCKS;
+  if (count == 0) {
+    return len;
+  }
+  buf[len] = EXT_KIND_SACK;
+  buf[len + 1] = 2 + count * EXT_SACK_BLOCK_LEN;
+  for (uint32_t i = 0; i < count; i++) {
+    put_u32(buf + len + 2 + i * EXT_SACK_BLOCK_LEN, blocks[i].start);
+    put_u32(buf + len + 6 + i * EXT_SACK_BLOCK_LEN, blocks[i].end);
+  }
+  return len + 2 + count * EXT_SACK_BLOCK_LEN;
+}
+
+int ext_parse(const uint8_t* data, uint16_t len, ext_opts_t* opts) {
+  memset(opts, 0, sizeof(ext_opts_t));
+  uint16_t i = 0;
+  while (i < len) {
+    if (len - i < 2 || data[i + 1] < 2 || data[i + 1] > len - i) {
+      return -1;
+    }
+    uint8_t kind = data[i];
+    uint8_t opt_len = data[i + 1];
+    if (kind == EXT_KIND_MSS && opt_len == EXT_MSS_LEN) {
+      opts->mss = get_u16(data + i + 2);
+    } else if (kind == EXT_KIND_PROBE && opt_len == EXT_PROBE_LEN) {
+      opts->probe = get_u16(data + i + 2);
+    } else if (kind == EXT_KIND_PROBE_ACK && opt_len == EXT_PROBE_LEN) {
+      opts->probe_ack = get_u16(data + i + 2);
+    } else if (kind == EXT_KIND_WINDOW_SCALE &&
+               opt_len == EXT_WINDOW_SCALE_LEN) {
+      // a larger shift is taken as the largest (RFC 7323 2.3)
+      opts->has_wscale = true;
+      opts->wscale = data[i + 2] < EXT_MAX_WINDOW_SCALE ? data[i + 2]
+                                                        : EXT_MAX_WINDOW_SCALE;
+    } else if (kind == EXT_KIND_TIMESTAMP && opt_len == EXT_TIMESTAMP_LEN) {
+      opts->has_timestamp = true;
+      opts->ts_val = get_u32(data + i + 2);
+      opts->ts_ecr = get_u32(data + i + 6);
+    } else if (kind == EXT_KIND_SACK_PERMITTED &&
+               opt_len == EXT_SACK_PERMITTED_LEN) {
+      opts->sack_permitted = true;
+    } else if (kind == EXT_KIND_SACK &&
+               (opt_len - 2) % EXT_SACK_BLOCK_LEN == 0) {
+      uint32_t count = (opt_len - 2) / EXT_SACK_BLOCK_LEN;
+      count = count < EXT_MAX_SACK_BLOCKS ? count : EXT_MAX_SACK_BLOCKS;
+      for (uint32_t j = 0; j < count; j++) {
+        opts->sack[j].start = get_u32(data + i + 2 + j * EXT_SACK_BLOCK_LEN);
+        opts->sack[j].end = get_u32(data + i + 6 + j * EXT_SACK_BLOCK_LEN);
+      }
+      opts->sack_count = count;
+    } else if (kind == EXT_KIND_FASTOPEN &&
+               (opt_len == 2 || (opt_len - 2 >= EXT_FASTOPEN_MIN_COOKIE &&
+                                 opt_len - 2 <= EXT_FASTOPEN_MAX_COOKIE))) {
+      opts->has_fastopen = true;
+      opts->fastopen_len = opt_len - 2;
+      memcpy(opts->fastopen_cookie, data + i + 2, opt_len - 2);
+    }
+    // anything else is not ours to understand
+    i += opt_len;
+  }
+  return 0;
+}
+
+// an option is on unless its environment variable is "0"
+static bool env_enabled(const char* name) {
+  const char* env = getenv(name);
+  return env == NULL || strcmp(env, "0") != 0;
+}
+
+bool ext_timestamps_enabled() { return env_enabled(EXT_TIMESTAMPS_ENV); }
+
+bool ext_sack_enabled() { return env_enabled(EXT_SACK_ENV); }
+
+bool ext_wscale_enabled() { return env_enabled(EXT_WSCALE_ENV); }
+
+uint32_t ext_mss_limit(uint32_t base, uint32_t max) {
+  const char* env = getenv(EXT_MSS_ENV);
+  if (env == NULL) {
+    return max;
+  }
+  long mss = strtol(env, NULL, 10);
+  if (mss == 0) {
+    return 0;
+  }
+  return mss < (long)base ? base : (mss > (long)max ? max : (uint32_t)mss);
+}
+
+uint8_t ext_window_scale_for(uint32_t bytes) {
+  uint8_t shift = 0;
+  while (shift < EXT_MAX_WINDOW_SCALE && (bytes >> shift) > UINT16_MAX) {
+    shift++;
+  }
+  return shift;
+}
+
+uint32_t ext_timestamp_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint32_t now = (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+  return now != 0 ? now : 1;
+}
@@ -0,0 +1,96 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extension.h"
+#include "fastopen.h"
+#include "siphash.h"
+
+typedef struct {
+  uint32_t addr;  // network byte order, like the port
+  uint16_t port;
+  uint8_t len;  // 0 : free
+  uint8_t cookie[EXT_FASTOPEN_MAX_COOKIE];
+} cache_entry_t;
+
+static cache_entry_t cache[FASTOPEN_CACHE_SIZE];
+static uint32_t cache_next;  // the entry to replace when the cache is full
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void fastopen_cookie(const struct sockaddr_in* client, uint8_t* cookie) {
+  uint64_t hash =
+      siphash(&(client->sin_addr.s_addr), sizeof(client->sin_addr.s_addr));
+  memcpy(cookie, &hash, FASTOPEN_COOKIE_LEN);
+}
+
+bool fastopen_cookie_valid(const struct sockaddr_in* client,
+                           const uint8_t* cookie, uint8_t len) {
+  uint8_t expected[FASTOPEN_COOKIE_LEN];
+  if (len != FASTOPEN_COOKIE_LEN) {
+    return false;
+  }
+  fastopen_cookie(client, expected);
+  return memcmp(cookie, expected, FASTOPEN_COOKIE_LEN) == 0;
+}
+
+// the entry of the server at 'server', NULL if there is none; cache_lock held
+// by the caller
+static cache_entry_t* cache_find(const struct sockaddr_in* server) {
+  for (int i = 0; i < FASTOPEN_CACHE_SIZE; i++) {
+    if (cache[i].len != 0 && cache[i].addr == server->sin_addr.s_addr &&
+        cache[i].port == server->sin_port) {
+      return &cache[i];
+    }
+  }
+  return NULL;
+}
+
+uint8_t fastopen_cache_get(const struct sockaddr_in* server, uint8_t* cookie) {
+  uint8_t len = 0;
+  pthread_mutex_lock(&cache_lock);
+  cache_entry_t* entry = cache_find(server);
+  if (entry != NULL) {
+    len = entry->len;
+    memcpy(cookie, entry->cookie, len);
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return len;
+}
+
+void fastopen_cache_put(const struct sockaddr_in* server, const uint8_t* cookie,
+                        uint8_t len) {
+  if (len == 0 || len > EXT_FASTOPEN_MAX_COOKIE) {
+    return;
+  }
+  pthread_mutex_lock(&cache_lock);
+  cache_entry_t* entry = cache_find(server);
+  for (int i = 0; entry == NULL && i < FASTOPEN_CACHE_SIZE; i++) {
+    if (cache[i].len == 0) {
+      entry = &cache[i];
+    }
+  }
+  if (entry == NULL) {
+    // full : the entries take turns being replaced
+    entry = &cache[cache_next];
+    cache_next = (cache_next + 1) % FASTOPEN_CACHE_SIZE;
+  }
+  entry->addr = server->sin_addr.s_addr;
+  entry->port = server->sin_port;
+  entry->len = len;
+  memcpy(entry->cookie, cookie, len);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void fastopen_cache_drop(const struct sockaddr_in* server) {
+  pthread_mutex_lock(&cache_lock);
+  cache_entry_t* entry = cache_find(server);
+  if (entry != NULL) {
+    entry->len = 0;
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+bool fastopen_enabled() {
+  const char* env = getenv(FASTOPEN_ENV);
+  return env != NULL && strcmp(env, "0") != 0;
+}
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE  // ppoll()
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "io_engine.h"
+
+/* ********************************** */
+/* ****** sendto/recvfrom engine ***** */
+/* ********************************** */
+
+static int sendto_init(io_engine_t* engine) {
+  engine->state = NULL;
+  return 0;
+}
+
+static int sendto_send(io_engine_t* engine, const uint8_t* pkt, uint16_t len,
+                       const struct sockaddr_in* to) {
+  ssize_t n = sendto(engine->sockfd, pkt, len, 0, (const struct sockaddr*)to,
+                     sizeof(struct sockaddr_in));
+  return n == len ? 0 : -1;
+}
+
+static void sendto_flush(io_engine_t* engine) { (void)engine; }
+
+static ssize_t sendto_recv(io_engine_t* engine, uint8_t* buf, uint32_t cap,
+                           struct sockaddr_in* from, int64_t timeout_us) {
+  socklen_t from_len = sizeof(struct sockaddr_in);
+
+  if (timeout_us != 0) {
+    // wait for a datagram or a wakeup from the application
+    struct pollfd fds[2];
+    fds[0].fd = engine->sockfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = engine->wake_fd;
+    fds[1].events = POLLIN;
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    if (ppoll(fds, 2, timeout_us < 0 ? NULL : &ts, NULL) <= 0) {
+      return 0;
+    }
+    if (fds[1].revents & POLLIN) {
+      io_engine_clear_wake(engine);
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      return 0;
+    }
+  }
+
+  ssize_t n = recvfrom(engine->sockfd, buf, cap, MSG_DONTWAIT,
+                       (struct sockaddr*)from, &from_len);
+  return n < 0 ? 0 : n;
+}
+
+static void sendto_destroy(io_engine_t* engine) { (void)engine; }
+
+const io_engine_ops_t sendto_engine_ops = {
+    .name = "sendto",
+    .init = sendto_init,
+    .send = sendto_send,
+    .flush = sendto_flush,
+    .recv = sendto_recv,
+    .destroy = sendto_destroy,
+};
+
+/* ********************************** */
+/* *********** Interface *********** */
+/* ********************************** */
+
+void io_engine_init(io_engine_t* engine, int sockfd, uint32_t max_len) {
+  engine->sockfd = sockfd;
+  engine->max_len = max_len;
+  engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  engine->wake_pending = 0;
+  engine->ops = &sendto_engine_ops;
+
+  const char* name = getenv(IO_ENGINE_ENV);
+  if (name != NULL && strcmp(name, "io_uring") == 0) {
+#ifdef CMU_TCP_IO_URING
+    engine->ops = &io_uring_engine_ops;
+    if (engine->ops->init(engine) == 0) {
+      return;
+    }
+    fprintf(stderr, "io_uring unavailable, falling back to sendto\n");
+    engine->ops = &sendto_engine_ops;
+#else
+    fprintf(stderr, "built without io_uring (make IO_URING=1), using sendto\n");
+#endif
+  }
+  engine->ops->init(engine);
+}
+
+void io_engine_wake(io_engine_t* engine) {
+  uint64_t one = 1;
+  __atomic_store_n(&engine->wake_pending, 1, __ATOMIC_RELEASE);
+  if (write(engine->wake_fd, &one, sizeof(one)) < 0) {
+    // already signaled; the counter only saturates
+  }
+}
+
+void io_engine_clear_wake(io_engine_t* engine) {
+  uint64_t count;
+  __atomic_store_n(&engine->wake_pending, 0, __ATOMIC_RELEASE);
+  if (read(engine->wake_fd, &count, sizeof(count)) < 0) {
+    // nothing pending
+  }
+}
+
+void io_engine_destroy(io_engine_t* engine) {
+  engine->ops->destroy(engine);
+  close(engine->wake_fd);
+}
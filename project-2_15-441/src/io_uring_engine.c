@@ -0,0 +1,530 @@
+// io_uring I/O engine; only compiled with `make IO_URING=1`
+//
+// receives : one multishot recvmsg is kept armed on the socket; the kernel
+//            picks a buffer from a provided buffer ring for every datagram, so
+//            no syscall is needed per received packet while completions are
+//            queued
+// sends    : datagrams are copied into send slots and queued as sendmsg SQEs;
+//            everything queued during one backend iteration is submitted with
+//            a single io_uring_enter()
+// timeouts : io_uring_enter() waits for one completion at most that long
+// wakeups  : a multishot IORING_OP_POLL_ADD watches the engine's eventfd
+//
+// liburing is not required; the rings are set up with the raw syscalls.
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmu_packet.h"
+#include "io_engine.h"
+
+#define URING_ENTRIES 128
+// receive buffers and send slots each take about this much memory, in
+// URING_MIN_BUFS to URING_MAX_BUFS buffers (powers of 2) of the largest
+// datagram the socket sends or receives
+#define URING_BUF_BUDGET (256 * 1024)
+#define URING_MIN_BUFS 8
+#define URING_MAX_BUFS 64
+#define URING_RECV_HDR_SIZE \
+  (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in))
+#define URING_BGID 0
+
+// user_data tags; send completions carry UD_SEND + slot index
+#define UD_RECV 1
+#define UD_WAKE 2
+#define UD_SEND 16
+
+typedef struct {
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_in to;
+  uint8_t* data;  // max_len bytes
+} send_slot_t;
+
+typedef struct {
+  int ring_fd;
+
+  // submission queue
+  void* sq_ptr;
+  size_t sq_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned sq_local_tail;
+  unsigned to_submit;
+  bool taskrun_flag;  // the kernel flags pending completions in sq_flags
+  unsigned* sq_flags;
+
+  // completion queue
+  void* cq_ptr;
+  size_t cq_size;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  uint32_t max_len;   // of a datagram
+  unsigned num_bufs;  // receive buffers, and send slots
+
+  // receive side
+  struct io_uring_buf_ring* buf_ring;
+  size_t buf_ring_size;
+  uint16_t buf_ring_tail;
+  uint8_t* recv_bufs;
+  size_t recv_buf_size;
+  struct msghdr recv_msg;
+  bool recv_armed;
+  uint16_t pending[URING_MAX_BUFS];  // filled buffers not yet handed out
+  unsigned pending_head;
+  unsigned pending_tail;
+
+  // send side
+  send_slot_t* slots;
+  uint8_t* slot_data;
+  int free_slots[URING_MAX_BUFS];
+  int num_free_slots;
+
+  bool wake_armed;
+  bool woken;
+} uring_state_t;
+
+/* ring helpers */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void* arg, size_t arg_size) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg,
+                                 unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int64_t time_us_monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// return a zeroed SQE, submitting what is queued if the SQ is full
+static struct io_uring_sqe* get_sqe(uring_state_t* st) {
+  unsigned head = __atomic_load_n(st->sq_head, __ATOMIC_ACQUIRE);
+  if (st->sq_local_tail - head >= URING_ENTRIES) {
+    sys_io_uring_enter(st->ring_fd, st->to_submit, 0, 0, NULL, 0);
+    st->to_submit = 0;
+    head = __atomic_load_n(st->sq_head, __ATOMIC_ACQUIRE);
+    if (st->sq_local_tail - head >= URING_ENTRIES) {
+      return NULL;
+    }
+  }
+  unsigned idx = st->sq_local_tail & *st->sq_mask;
+  struct io_uring_sqe* sqe = &st->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  st->sq_array[idx] = idx;
+  st->sq_local_tail++;
+  st->to_submit++;
+  __atomic_store_n(st->sq_tail, st->sq_local_tail, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+static void submit(uring_state_t* st, unsigned min_complete) {
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  if (st->to_submit == 0 && min_complete == 0) {
+    return;
+  }
+  int ret = sys_io_uring_enter(st->ring_fd, st->to_submit, min_complete, flags,
+                               NULL, 0);
+  if (ret >= 0 || errno != EINTR) {
+    st->to_submit = 0;
+  }
+}
+
+// submit what is queued and wait at most 'timeout_us' for one completion
+static void submit_and_wait(uring_state_t* st, int64_t timeout_us) {
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (timeout_us >= 0) {
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+  unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  int ret = sys_io_uring_enter(st->ring_fd, st->to_submit, 1, flags, &arg,
+                               sizeof(arg));
+  if (ret >= 0 || errno == ETIME) {
+    st->to_submit = 0;
+  }
+}
+
+// submit what is queued and let the kernel post pending completions, without
+// waiting; completions are delivered as task work, which only runs once the
+// thread enters the kernel, so a spinning poller has to come through here,
+// unless the kernel tells there is nothing to run
+static void submit_and_poll(uring_state_t* st) {
+  if (st->to_submit == 0 && st->taskrun_flag &&
+      !(__atomic_load_n(st->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_TASKRUN)) {
+    return;
+  }
+  unsigned flags = IORING_ENTER_GETEVENTS;
+  int ret = sys_io_uring_enter(st->ring_fd, st->to_submit, 0, flags, NULL, 0);
+  if (ret >= 0 || errno != EINTR) {
+    st->to_submit = 0;
+  }
+}
+
+static void buf_ring_add(uring_state_t* st, uint16_t bid) {
+  struct io_uring_buf* buf =
+      &st->buf_ring->bufs[st->buf_ring_tail & (st->num_bufs - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(st->recv_bufs + bid * st->recv_buf_size);
+  buf->len = st->recv_buf_size;
+  buf->bid = bid;
+  st->buf_ring_tail++;
+  __atomic_store_n(&st->buf_ring->tail, st->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static void arm_recv(uring_state_t* st, int sockfd) {
+  struct io_uring_sqe* sqe = get_sqe(st);
+  if (sqe == NULL) {
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = sockfd;
+  sqe->addr = (uint64_t)(uintptr_t)&st->recv_msg;
+  sqe->len = 1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = UD_RECV;
+  st->recv_armed = true;
+}
+
+static void arm_wake(uring_state_t* st, int wake_fd) {
+  struct io_uring_sqe* sqe = get_sqe(st);
+  if (sqe == NULL) {
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = wake_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = UD_WAKE;
+  st->wake_armed = true;
+}
+
+// drain the completion queue : free the slots of completed sends and queue the
+// buffers of received datagrams, in arrival order, for recv()
+static void process_cqes(uring_state_t* st) {
+  unsigned head = *st->cq_head;
+  unsigned tail = __atomic_load_n(st->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe* cqe = &st->cqes[head & *st->cq_mask];
+    if (cqe->user_data == UD_RECV) {
+      if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        st->recv_armed = false;
+      }
+      if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res < 0) {
+          buf_ring_add(st, bid);
+        } else {
+          st->pending[st->pending_tail++ % URING_MAX_BUFS] = bid;
+        }
+      }
+    } else if (cqe->user_data == UD_WAKE) {
+      if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        st->wake_armed = false;
+      }
+      st->woken = true;
+    } else if (cqe->user_data >= UD_SEND) {
+      // a send that failed lost its datagram, as the network could have
+      st->free_slots[st->num_free_slots++] = (int)(cqe->user_data - UD_SEND);
+    }
+  }
+  __atomic_store_n(st->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// copy the oldest received datagram out of its provided buffer and recycle
+// the buffer; return the datagram length, or 0 if there is none
+static ssize_t pop_pending(uring_state_t* st, uint8_t* buf, uint32_t cap,
+                           struct sockaddr_in* from) {
+  while (st->pending_head != st->pending_tail) {
+    uint16_t bid = st->pending[st->pending_head++ % URING_MAX_BUFS];
+    uint8_t* rbuf = st->recv_bufs + bid * st->recv_buf_size;
+    struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)rbuf;
+    uint8_t* name = (uint8_t*)(out + 1);
+    uint8_t* payload =
+        name + st->recv_msg.msg_namelen + st->recv_msg.msg_controllen;
+    ssize_t len = 0;
+
+    // truncated or oversized datagrams are dropped
+    if (!(out->flags & MSG_TRUNC) && out->payloadlen <= cap) {
+      len = out->payloadlen;
+      memcpy(buf, payload, len);
+      if (from != NULL && out->namelen >= sizeof(struct sockaddr_in)) {
+        memcpy(from, name, sizeof(struct sockaddr_in));
+      }
+    }
+    buf_ring_add(st, bid);
+    if (len > 0) {
+      return len;
+    }
+  }
+  return 0;
+}
+
+/* ********************************** */
+/* *********** Engine ops *********** */
+/* ********************************** */
+
+static void uring_destroy(io_engine_t* engine);
+
+static int uring_init(io_engine_t* engine) {
+  uring_state_t* st = calloc(1, sizeof(uring_state_t));
+  struct io_uring_params p;
+  engine->state = st;
+  if (st == NULL) {
+    return -1;
+  }
+  st->ring_fd = -1;
+
+  // completions wait for the backend to enter the kernel anyway, rather than
+  // interrupt it; older kernels take neither flag
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+  st->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  if (st->ring_fd < 0 && errno == EINVAL) {
+    memset(&p, 0, sizeof(p));
+    st->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  }
+  if (st->ring_fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_EXT_ARG)) {
+    goto fail;
+  }
+  st->taskrun_flag = (p.flags & IORING_SETUP_TASKRUN_FLAG) != 0;
+
+  st->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  st->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (st->cq_size > st->sq_size) {
+    st->sq_size = st->cq_size;
+  }
+  st->sq_ptr = mmap(NULL, st->sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, st->ring_fd, IORING_OFF_SQ_RING);
+  if (st->sq_ptr == MAP_FAILED) {
+    st->sq_ptr = NULL;
+    goto fail;
+  }
+  st->cq_ptr = st->sq_ptr;
+  st->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  st->sqes = mmap(NULL, st->sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, st->ring_fd, IORING_OFF_SQES);
+  if (st->sqes == MAP_FAILED) {
+    st->sqes = NULL;
+    goto fail;
+  }
+
+  uint8_t* sq = st->sq_ptr;
+  st->sq_head = (unsigned*)(sq + p.sq_off.head);
+  st->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  st->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+  st->sq_array = (unsigned*)(sq + p.sq_off.array);
+  st->sq_flags = (unsigned*)(sq + p.sq_off.flags);
+  st->sq_local_tail = *st->sq_tail;
+  uint8_t* cq = st->cq_ptr;
+  st->cq_head = (unsigned*)(cq + p.cq_off.head);
+  st->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  st->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+  st->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  st->max_len = engine->max_len;
+  st->num_bufs = URING_MAX_BUFS;
+  while (st->num_bufs > URING_MIN_BUFS &&
+         (size_t)st->num_bufs * st->max_len > URING_BUF_BUDGET) {
+    st->num_bufs /= 2;
+  }
+
+  // provided buffer ring for the multishot recvmsg
+  st->buf_ring_size = st->num_bufs * sizeof(struct io_uring_buf);
+  st->buf_ring = mmap(NULL, st->buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (st->buf_ring == MAP_FAILED) {
+    st->buf_ring = NULL;
+    goto fail;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)st->buf_ring;
+  reg.ring_entries = st->num_bufs;
+  reg.bgid = URING_BGID;
+  if (sys_io_uring_register(st->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) <
+      0) {
+    goto fail;
+  }
+  st->recv_buf_size = URING_RECV_HDR_SIZE + st->max_len;
+  st->recv_bufs = malloc(st->num_bufs * st->recv_buf_size);
+  st->slots = malloc(st->num_bufs * sizeof(send_slot_t));
+  st->slot_data = malloc((size_t)st->num_bufs * st->max_len);
+  if (st->recv_bufs == NULL || st->slots == NULL || st->slot_data == NULL) {
+    goto fail;
+  }
+  for (uint16_t bid = 0; bid < st->num_bufs; bid++) {
+    buf_ring_add(st, bid);
+  }
+  st->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+  for (unsigned i = 0; i < st->num_bufs; i++) {
+    st->slots[i].data = st->slot_data + (size_t)i * st->max_len;
+    st->free_slots[i] = (int)i;
+  }
+  st->num_free_slots = (int)st->num_bufs;
+
+  arm_recv(st, engine->sockfd);
+  arm_wake(st, engine->wake_fd);
+  submit(st, 0);
+  return 0;
+
+fail:
+  uring_destroy(engine);
+  return -1;
+}
+
+static int uring_send(io_engine_t* engine, const uint8_t* pkt, uint16_t len,
+                      const struct sockaddr_in* to) {
+  uring_state_t* st = engine->state;
+  if (len > st->max_len) {
+    return sendto_engine_ops.send(engine, pkt, len, to);
+  }
+
+  // all slots in flight : push what is queued and wait for completions
+  while (st->num_free_slots == 0) {
+    submit(st, 1);
+    process_cqes(st);
+  }
+
+  int slot_idx = st->free_slots[--st->num_free_slots];
+  send_slot_t* slot = &st->slots[slot_idx];
+  memcpy(slot->data, pkt, len);
+  slot->to = *to;
+  slot->iov.iov_base = slot->data;
+  slot->iov.iov_len = len;
+  memset(&slot->msg, 0, sizeof(slot->msg));
+  slot->msg.msg_name = &slot->to;
+  slot->msg.msg_namelen = sizeof(struct sockaddr_in);
+  slot->msg.msg_iov = &slot->iov;
+  slot->msg.msg_iovlen = 1;
+
+  struct io_uring_sqe* sqe = get_sqe(st);
+  if (sqe == NULL) {
+    st->free_slots[st->num_free_slots++] = slot_idx;
+    return sendto_engine_ops.send(engine, pkt, len, to);
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = engine->sockfd;
+  sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+  sqe->len = 1;
+  // not linked to the sends before it : datagrams do not depend on each other,
+  // and a failed one (e.g. a path MTU probe too large for the interface) must
+  // not cancel the rest of the batch
+  sqe->user_data = UD_SEND + slot_idx;
+  return 0;
+}
+
+static void uring_flush(io_engine_t* engine) { submit(engine->state, 0); }
+
+static ssize_t uring_recv(io_engine_t* engine, uint8_t* buf, uint32_t cap,
+                          struct sockaddr_in* from, int64_t timeout_us) {
+  uring_state_t* st = engine->state;
+  int64_t deadline = time_us_monotonic() + timeout_us;
+
+  while (1) {
+    process_cqes(st);
+    ssize_t len = pop_pending(st, buf, cap, from);
+    if (len > 0) {
+      return len;
+    }
+    if (!st->recv_armed) {
+      arm_recv(st, engine->sockfd);
+    }
+    if (!st->wake_armed) {
+      arm_wake(st, engine->wake_fd);
+    }
+
+    if (timeout_us == 0) {
+      // submit the queued sends and pick up anything already completed;
+      // a wakeup stays pending for the next blocking call
+      submit_and_poll(st);
+      process_cqes(st);
+      return pop_pending(st, buf, cap, from);
+    }
+
+    if (st->woken) {
+      st->woken = false;
+      io_engine_clear_wake(engine);
+      submit(st, 0);
+      return 0;
+    }
+
+    int64_t remaining = -1;
+    if (timeout_us > 0) {
+      remaining = deadline - time_us_monotonic();
+      if (remaining <= 0) {
+        submit(st, 0);
+        return 0;
+      }
+    }
+    submit_and_wait(st, remaining);
+  }
+}
+
+static void uring_destroy(io_engine_t* engine) {
+  uring_state_t* st = engine->state;
+  if (st == NULL) {
+    return;
+  }
+  if (st->ring_fd >= 0) {
+    close(st->ring_fd);
+  }
+  if (st->sq_ptr != NULL) {
+    munmap(st->sq_ptr, st->sq_size);
+  }
+  if (st->sqes != NULL) {
+    munmap(st->sqes, st->sqes_size);
+  }
+  if (st->buf_ring != NULL) {
+    munmap(st->buf_ring, st->buf_ring_size);
+  }
+  free(st->recv_bufs);
+  free(st->slots);
+  free(st->slot_data);
+  free(st);
+  engine->state = NULL;
+}
+
+const io_engine_ops_t io_uring_engine_ops = {
+    .name = "io_uring",
+    .init = uring_init,
+    .send = uring_send,
+    .flush = uring_flush,
+    .recv = uring_recv,
+    .destroy = uring_destroy,
+};
@@ -0,0 +1,87 @@
+#include "pacer.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define US_PER_S 1000000
+
+// add the tokens that came in since last_us
+static void refill(pacer_t* pacer, uint64_t now_us) {
+  if (now_us <= pacer->last_us) {
+    return;
+  }
+  if (pacer->rate > 0) {
+    // past the time to fill the bucket, the exact time does not matter
+    // (and the product below could overflow)
+    uint64_t elapsed =
+        MIN(now_us - pacer->last_us, pacer->depth / pacer->rate + 1);
+    pacer->tokens = MIN(pacer->tokens + elapsed * pacer->rate, pacer->depth);
+  }
+  pacer->last_us = now_us;
+}
+
+// recompute the rate in effect and the bucket size
+static void update_rate(pacer_t* pacer, uint64_t cc_rate, uint64_t now_us) {
+  uint64_t rate = cc_rate;
+  if (pacer->max_rate > 0 && (rate == 0 || rate > pacer->max_rate)) {
+    rate = pacer->max_rate;
+  }
+  // what came in at the old rate is kept
+  refill(pacer, now_us);
+  if (rate == pacer->rate) {
+    return;
+  }
+  if (pacer->rate == 0) {
+    // start with a full bucket, as an idle connection would have
+    pacer->tokens = UINT64_MAX;
+  }
+  pacer->rate = rate;
+  pacer->depth = MAX((uint64_t)PACER_MIN_BURST_SEGMENTS * pacer->mss * US_PER_S,
+                     rate * PACER_BURST_US);
+  pacer->tokens = MIN(pacer->tokens, pacer->depth);
+}
+
+void pacer_init(pacer_t* pacer, uint32_t mss) {
+  pacer->rate = 0;
+  pacer->max_rate = 0;
+  pacer->cc_rate = 0;
+  pacer->mss = mss;
+  pacer->tokens = 0;
+  pacer->depth = 0;
+  pacer->last_us = 0;
+}
+
+void pacer_set_rate(pacer_t* pacer, uint64_t rate, uint64_t now_us) {
+  pacer->cc_rate = rate;
+  update_rate(pacer, rate, now_us);
+}
+
+void pacer_set_max_rate(pacer_t* pacer, uint64_t max_rate, uint64_t now_us) {
+  pacer->max_rate = max_rate;
+  update_rate(pacer, pacer->cc_rate, now_us);
+}
+
+uint64_t pacer_delay_us(pacer_t* pacer, uint32_t len, uint64_t now_us) {
+  if (pacer->rate == 0) {
+    return 0;
+  }
+  refill(pacer, now_us);
+  uint64_t need = (uint64_t)len * US_PER_S;
+  if (need > pacer->depth) {
+    // a segment larger than the bucket goes out once the bucket is full
+    need = pacer->depth;
+  }
+  if (pacer->tokens >= need) {
+    return 0;
+  }
+  return (need - pacer->tokens + pacer->rate - 1) / pacer->rate;
+}
+
+void pacer_consume(pacer_t* pacer, uint32_t len, uint64_t now_us) {
+  if (pacer->rate == 0) {
+    return;
+  }
+  refill(pacer, now_us);
+  uint64_t used = (uint64_t)len * US_PER_S;
+  pacer->tokens = pacer->tokens > used ? pacer->tokens - used : 0;
+}
@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "packet_pool.h"
+
+// a free slot stores the link to the next free slot in its own bytes. 'size'
+// tells the slots of the pool from the larger buffers malloc'ed one by one,
+// which have the same header
+typedef struct pool_slot {
+  size_t size;  // PACKET_POOL_SLOT_SIZE for a slot of the pool, what was asked
+                // for otherwise
+  union {
+    struct pool_slot* next;
+    uint8_t data[PACKET_POOL_SLOT_SIZE];
+  } u;
+} pool_slot_t;
+
+#define SLOT_OF(PKT) ((pool_slot_t*)((PKT)-offsetof(pool_slot_t, u)))
+
+typedef struct {
+  pool_slot_t* head;
+  int count;
+} slot_list_t;
+
+static __thread slot_list_t thread_cache;
+
+static slot_list_t shared_slots;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void push_slot(slot_list_t* list, pool_slot_t* slot) {
+  slot->u.next = list->head;
+  list->head = slot;
+  list->count++;
+}
+
+static pool_slot_t* pop_slot(slot_list_t* list) {
+  pool_slot_t* slot = list->head;
+  list->head = slot->u.next;
+  list->count--;
+  return slot;
+}
+
+// move up to 'num' slots from 'from' to 'to'
+static void move_slots(slot_list_t* from, slot_list_t* to, int num) {
+  while (num > 0 && from->head != NULL) {
+    push_slot(to, pop_slot(from));
+    num--;
+  }
+}
+
+// hand the slots of an exiting thread back to the shared list
+static void release_thread_cache(void* in) {
+  slot_list_t* cache = (slot_list_t*)in;
+  pthread_mutex_lock(&shared_lock);
+  move_slots(cache, &shared_slots, cache->count);
+  pthread_mutex_unlock(&shared_lock);
+}
+
+static void create_cache_key() {
+  pthread_key_create(&cache_key, release_thread_cache);
+}
+
+// make sure release_thread_cache() runs when the calling thread exits
+static void register_thread_cache() {
+  pthread_once(&cache_key_once, create_cache_key);
+  if (pthread_getspecific(cache_key) == NULL) {
+    pthread_setspecific(cache_key, &thread_cache);
+  }
+}
+
+// refill the calling thread's empty free list, from the shared list if
+// possible, otherwise with a newly allocated batch of slots
+static void refill_thread_cache() {
+  register_thread_cache();
+  pthread_mutex_lock(&shared_lock);
+  move_slots(&shared_slots, &thread_cache, PACKET_POOL_BATCH);
+  pthread_mutex_unlock(&shared_lock);
+  if (thread_cache.head != NULL) {
+    return;
+  }
+
+  pool_slot_t* batch = malloc(PACKET_POOL_BATCH * sizeof(pool_slot_t));
+  if (batch == NULL) {
+    return;
+  }
+  for (int i = 0; i < PACKET_POOL_BATCH; i++) {
+    batch[i].size = PACKET_POOL_SLOT_SIZE;
+    push_slot(&thread_cache, &batch[i]);
+  }
+}
+
+uint8_t* packet_pool_alloc(size_t len) {
+  if (len > PACKET_POOL_SLOT_SIZE) {
+    pool_slot_t* large = malloc(offsetof(pool_slot_t, u) + len);
+    if (large == NULL) {
+      return NULL;
+    }
+    large->size = len;
+    return large->u.data;
+  }
+  if (thread_cache.head == NULL) {
+    refill_thread_cache();
+    if (thread_cache.head == NULL) {
+      return NULL;
+    }
+  }
+  return pop_slot(&thread_cache)->u.data;
+}
+
+void packet_pool_free(uint8_t* pkt) {
+  if (pkt == NULL) {
+    return;
+  }
+  pool_slot_t* slot = SLOT_OF(pkt);
+  if (slot->size > PACKET_POOL_SLOT_SIZE) {
+    free(slot);
+    return;
+  }
+  if (thread_cache.head == NULL) {
+    register_thread_cache();
+  }
+  push_slot(&thread_cache, slot);
+
+  if (thread_cache.count > PACKET_POOL_CACHE_MAX) {
+    pthread_mutex_lock(&shared_lock);
+    move_slots(&thread_cache, &shared_slots, PACKET_POOL_BATCH);
+    pthread_mutex_unlock(&shared_lock);
+  }
+}
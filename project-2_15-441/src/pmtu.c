@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmtu.h"
+
+// nothing left between the largest size that got through and the smallest that
+// did not
+static bool search_done(pmtu_t* pmtu) {
+  return pmtu->lo >= pmtu->max_mss || pmtu->hi - pmtu->lo <= PMTU_SEARCH_STEP;
+}
+
+// stop probing; search again later if the size found is not the largest
+// possible
+static void finish_search(pmtu_t* pmtu, uint64_t now_us) {
+  pmtu->probe_size = 0;
+  pmtu->probes = 0;
+  pmtu->deadline_us = pmtu->lo < pmtu->max_mss ? now_us + PMTU_RAISE_US : 0;
+}
+
+void pmtu_init(pmtu_t* pmtu, uint32_t base_mss) {
+  pmtu->mss = base_mss;
+  pmtu->base_mss = base_mss;
+  pmtu->max_mss = base_mss;
+  pmtu->lo = base_mss;
+  pmtu->hi = base_mss + 1;
+  pmtu->probe_size = 0;
+  pmtu->probes = 0;
+  pmtu->deadline_us = 0;
+  pmtu->timeouts = 0;
+}
+
+void pmtu_start(pmtu_t* pmtu, uint32_t max_mss, bool search, uint64_t now_us) {
+  pmtu->max_mss = max_mss > pmtu->base_mss ? max_mss : pmtu->base_mss;
+  pmtu->hi = pmtu->max_mss + 1;
+  if (!search) {
+    pmtu->mss = pmtu->max_mss;
+    pmtu->lo = pmtu->max_mss;
+    pmtu->deadline_us = 0;
+    return;
+  }
+  pmtu->deadline_us = search_done(pmtu) ? 0 : now_us;
+}
+
+uint32_t pmtu_probe_due(pmtu_t* pmtu, uint64_t now_us) {
+  if (pmtu->deadline_us == 0 || now_us < pmtu->deadline_us) {
+    return 0;
+  }
+  if (pmtu->probe_size != 0 && pmtu->probes < PMTU_MAX_PROBES) {
+    // no answer yet : once more
+    return pmtu->probe_size;
+  }
+  if (pmtu->probe_size != 0) {
+    // never answered : too large
+    pmtu->hi = pmtu->probe_size;
+  } else if (search_done(pmtu)) {
+    // the last search is old : the path may carry more now
+    pmtu->hi = pmtu->max_mss + 1;
+  }
+  if (search_done(pmtu)) {
+    finish_search(pmtu, now_us);
+    return 0;
+  }
+  // the largest size first, then halves of what is left
+  pmtu->probe_size = pmtu->hi > pmtu->max_mss
+                         ? pmtu->max_mss
+                         : pmtu->lo + (pmtu->hi - pmtu->lo) / 2;
+  pmtu->probes = 0;
+  return pmtu->probe_size;
+}
+
+void pmtu_on_probe_sent(pmtu_t* pmtu, uint32_t size, uint64_t timeout_us,
+                        uint64_t now_us) {
+  if (size != pmtu->probe_size) {
+    return;
+  }
+  pmtu->probes++;
+  pmtu->deadline_us = now_us + timeout_us;
+}
+
+bool pmtu_on_probe_ack(pmtu_t* pmtu, uint32_t size, uint64_t now_us) {
+  if (size <= pmtu->lo || size > pmtu->max_mss) {
+    // older news, or not ours
+    return false;
+  }
+  pmtu->lo = size;
+  if (pmtu->hi <= size) {
+    pmtu->hi = pmtu->max_mss + 1;
+  }
+  pmtu->mss = size;
+  pmtu->timeouts = 0;
+  if (size == pmtu->probe_size || search_done(pmtu)) {
+    pmtu->probe_size = 0;
+    pmtu->probes = 0;
+    pmtu->deadline_us = now_us;
+    if (search_done(pmtu)) {
+      finish_search(pmtu, now_us);
+    }
+  }
+  return true;
+}
+
+void pmtu_on_ack(pmtu_t* pmtu) { pmtu->timeouts = 0; }
+
+bool pmtu_on_timeout(pmtu_t* pmtu, uint64_t now_us) {
+  if (pmtu->mss <= pmtu->base_mss) {
+    return false;
+  }
+  pmtu->timeouts++;
+  if (pmtu->timeouts < PMTU_BLACK_HOLE_TIMEOUTS) {
+    return false;
+  }
+  // full segments do not get through any more : start over from what always
+  // does
+  pmtu->mss = pmtu->base_mss;
+  pmtu->lo = pmtu->base_mss;
+  pmtu->hi = pmtu->max_mss + 1;
+  pmtu->probe_size = 0;
+  pmtu->probes = 0;
+  pmtu->timeouts = 0;
+  pmtu->deadline_us = now_us;
+  return true;
+}
+
+bool pmtu_probe_enabled() {
+  const char* env = getenv(PMTU_PROBE_ENV);
+  return env == NULL || strcmp(env, "0") != 0;
+}
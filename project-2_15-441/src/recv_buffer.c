@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include "cmu_packet.h"
 #include "recv_buffer.h"
 
 /* min / max */
@@ -85,111 +86,72 @@ void safe_memcpy_from_recvbuf(recv_buffer_t* recv_buffer, uint32_t len, uint8_t*
     }
 }
 
-/* segment */
+/* out-of-order bitmap */
 
-void segment_disconnect(segment_t* seg) {
-    if (seg->prev != NULL) {
-        seg->prev->next = seg->next;
-    }
-    if (seg->next != NULL) {
-        seg->next->prev = seg->prev;
-    }
-}
+#define BITMAP_WORD_BITS 64
 
-// return the merged block
-// assume 'start' != NULL && 'end' != NULL
-segment_t* segment_merge(segment_t* start, segment_t* end, uint32_t seg_start_seq, uint32_t seg_end_seq) {
-    segment_t* left_end = start;
-    while (left_end != NULL && left_end->end_seqnum_inclusive < seg_start_seq) {
-        left_end = left_end->next;
-    }
-
-    segment_t* right_end = end;
-    while (right_end != NULL && right_end->start_seqnum_inclusive > seg_end_seq) {
-        right_end = right_end->prev;
-    }
-
-    segment_t* seg = malloc(sizeof(segment_t));
-
-    if (left_end == NULL) {
-        // the segment doesn't intersect with any existing segment
-        // should be placed on the right-most
-        seg->start_seqnum_inclusive = seg_start_seq;
-        seg->end_seqnum_inclusive = seg_end_seq;
-        seg->prev = end;
-        end->next = seg;
-        
-        return seg;
-    }
-
-    if (right_end == NULL) {
-        // the segment doesn't intersect with any existing segment
-        // should be placed on the left-most
-        seg->start_seqnum_inclusive = seg_start_seq;
-        seg->end_seqnum_inclusive = seg_end_seq;
-        seg->next = start;
-        start->prev = seg;
-
-        return seg;
-    }
-
-
-    if (right_end->next == left_end) {
-        // the segment doesn't intersect with any existing segment
-        // it is in-between [right_end, left_end]
-        // can be directly inserted
-        seg->start_seqnum_inclusive = seg_start_seq;
-        seg->end_seqnum_inclusive = seg_end_seq;
-        seg->next = left_end;
-        left_end->prev = seg;
-        seg->prev = right_end;
-        right_end->next = seg;
-
-        return seg;
+// set or clear the bits [start, start + len) ; the range must not wrap around
+void bitmap_update_linear(uint64_t* bitmap, uint32_t start, uint32_t len, bool set) {
+    while (len > 0) {
+        uint32_t bit = start % BITMAP_WORD_BITS;
+        uint32_t n = min(len, BITMAP_WORD_BITS - bit);
+        uint64_t mask = n == BITMAP_WORD_BITS ? ~0ULL : ((1ULL << n) - 1) << bit;
+        if (set) {
+            bitmap[start / BITMAP_WORD_BITS] |= mask;
+        } else {
+            bitmap[start / BITMAP_WORD_BITS] &= ~mask;
+        }
+        start += n;
+        len -= n;
     }
+}
 
-    seg->start_seqnum_inclusive = min(left_end->start_seqnum_inclusive, seg_start_seq);
-    seg->end_seqnum_inclusive = max(right_end->end_seqnum_inclusive, seg_end_seq);
-    seg->next = right_end->next;
-    if (right_end->next != NULL) {
-        right_end->next->prev = seg;
-    }
-    seg->prev = left_end->prev;
-    if (left_end->prev != NULL) {
-        left_end->prev->next = seg;
+// set or clear the bits of 'len' bytes of the buffer starting at 'start_index', wrapping around
+void bitmap_update(recv_buffer_t* recv_buffer, uint32_t start_index, uint32_t len, bool set) {
+    uint32_t tail_len = min(len, recv_buffer->capacity - start_index);
+    bitmap_update_linear(recv_buffer->ooo_bitmap, start_index, tail_len, set);
+    if (len > tail_len) {
+        bitmap_update_linear(recv_buffer->ooo_bitmap, 0, len - tail_len, set);
     }
+}
 
-    // clean up left_end, ..., right_end
-    if (left_end == right_end) {
-        free(left_end);
-    } else {
-        left_end = left_end->next;
-        while (left_end != right_end) {
-            free(left_end->prev);
-            left_end = left_end->next;
+// return the number of bits equal to 'set' in a row starting at 'start', stopping at 'end' (exclusive)
+// a whole word is skipped at once when all its bits match
+uint32_t bitmap_run_linear(uint64_t* bitmap, uint32_t start, uint32_t end, bool set) {
+    uint32_t pos = start;
+    while (pos < end) {
+        uint32_t bit = pos % BITMAP_WORD_BITS;
+        // bits shifted in from the top are 0 : for a run of set bits, a word full from 'bit' up
+        // has no hole below them; for a run of clear bits they are no stop either
+        uint64_t word = bitmap[pos / BITMAP_WORD_BITS] >> bit;
+        uint64_t stops = set ? ~word : word;
+        uint32_t run = stops == 0 ? BITMAP_WORD_BITS : (uint32_t)__builtin_ctzll(stops);
+        if (run < BITMAP_WORD_BITS - bit) {
+            pos += run;
+            break;
         }
-        free(right_end->prev);
-        free(right_end);
+        pos += BITMAP_WORD_BITS - bit;
     }
-    
-    return seg;
+    return min(pos, end) - start;
 }
 
-void segment_clean(segment_t* start, segment_t* end) {
-    if (start == NULL || end == NULL) {
-        return;
-    }
-
-    if (start == end) {
-        free(start);
-        return;
+// return the number of bits equal to 'set' in a row for at most 'len' bytes of the buffer
+// starting at 'start_index', wrapping around
+uint32_t bitmap_run(recv_buffer_t* recv_buffer, uint32_t start_index, uint32_t len, bool set) {
+    uint32_t tail_len = min(len, recv_buffer->capacity - start_index);
+    uint32_t run = bitmap_run_linear(recv_buffer->ooo_bitmap, start_index, start_index + tail_len, set);
+    if (run == tail_len && len > tail_len) {
+        run += bitmap_run_linear(recv_buffer->ooo_bitmap, 0, len - tail_len, set);
     }
+    return run;
+}
 
-    while (start != end) {
-        start = start->next;
-        free(start->prev);
-    }
-    free(start);
+// clear the run of out-of-order bytes starting at 'start_index' and return its length,
+// i.e. how far the next byte expected moves once the bytes before 'start_index' are in order
+uint32_t bitmap_take_run(recv_buffer_t* recv_buffer, uint32_t start_index) {
+    uint32_t run = bitmap_run(recv_buffer, start_index, recv_buffer->capacity, true);
+    bitmap_update(recv_buffer, start_index, run, false);
+    return run;
 }
 
 /* ********************************** */
@@ -201,8 +163,7 @@ recv_buffer_t* recv_buffer_create(uint32_t capacity) {
     recv_buf->capacity = capacity;
     recv_buf->last_byte_read_seqnum = 0;
     recv_buf->buffer = malloc(capacity * sizeof(uint8_t));
-    recv_buf->start = NULL;
-    recv_buf->end = NULL;
+    recv_buf->ooo_bitmap = calloc((capacity + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS, sizeof(uint64_t));
     return recv_buf;
 }
 
@@ -212,6 +173,8 @@ void recv_buffer_initialize(recv_buffer_t* recv_buffer, uint32_t other_isn) {
     recv_buffer->last_byte_read_seqnum = other_isn;
     recv_buffer->last_byte_read_index = 0;
     recv_buffer->next_byte_expected_index = 1;
+    recv_buffer->last_ooo_seqnum = other_isn;
+    recv_buffer->ooo_end_seqnum = other_isn + 1;
 }
 
 uint32_t recv_buffer_max_read(recv_buffer_t* recv_buffer) {
@@ -226,7 +189,6 @@ uint32_t recv_buffer_max_receive(recv_buffer_t* recv_buffer) {
 }
 
 void recv_buffer_read(recv_buffer_t* recv_buffer, uint8_t* buf, uint32_t len) {
-    printf("recv_buffer_read.len : %d\n", len);
     assert(len <= recv_buffer_max_read(recv_buffer));
     if (len == 0) {
         return;
@@ -262,57 +224,75 @@ void recv_buffer_receive(recv_buffer_t* recv_buffer, uint32_t seqnum, uint32_t l
     assert(recv_buffer_can_receive(recv_buffer, seqnum, len) == 0);
 
     uint32_t next_expected_seq = get_next_byte_expected_seqnum(recv_buffer);
-    if (seqnum <= next_expected_seq && recv_buffer->start == NULL) {
-        // inorder data, no segmention existed
-        // directly write into the buffer 
-        uint32_t start_index = seqnum_to_index_recv(recv_buffer, seqnum);
-        safe_memcpy_to_recvbuf(recv_buffer, start_index, len, data);
-        recv_buffer->next_byte_expected_index = seqnum_to_index_recv(recv_buffer, seqnum+len);
+    uint32_t start_index = seqnum_to_index_recv(recv_buffer, seqnum);
+    safe_memcpy_to_recvbuf(recv_buffer, start_index, len, data);
+
+    if (seqnum > next_expected_seq) {
+        // out-of-order data, only remember which bytes arrived
+        bitmap_update(recv_buffer, start_index, len, true);
+        recv_buffer->last_ooo_seqnum = seqnum;
+        if (after(seqnum + len, recv_buffer->ooo_end_seqnum)) {
+            recv_buffer->ooo_end_seqnum = seqnum + len;
+        }
         return;
     }
 
-    if (recv_buffer->start == NULL) {
-        // no segmention existed, but out-of-order data
-        uint32_t start_index = seqnum_to_index_recv(recv_buffer, seqnum);
-        safe_memcpy_to_recvbuf(recv_buffer, start_index, len, data);
+    // in-order data : the bytes up to 'end_seq' are now in order, and so is the run of
+    // out-of-order bytes right after them
+    uint32_t end_seq = seqnum + len;
+    bitmap_update(recv_buffer, seqnum_to_index_recv(recv_buffer, next_expected_seq), end_seq - next_expected_seq, false);
+    end_seq += bitmap_take_run(recv_buffer, seqnum_to_index_recv(recv_buffer, end_seq));
+    recv_buffer->next_byte_expected_index = seqnum_to_index_recv(recv_buffer, end_seq);
+}
 
-        segment_t* seg = malloc(sizeof(segment_t));
-        seg->start_seqnum_inclusive = seqnum;
-        seg->end_seqnum_inclusive = seqnum + len - 1;
-        recv_buffer->start = seg;
-        recv_buffer->end = seg;
-        return;
-    } 
-
-    // segmention existed, don't care if in-order
-    segment_t* seg = segment_merge(recv_buffer->start, recv_buffer->end, seqnum, seqnum + len - 1);
-    if (seg->start_seqnum_inclusive <= next_expected_seq) {
-        // the merged block can be further merged with the existing in-order data
-        recv_buffer->next_byte_expected_index = seqnum_to_index_recv(recv_buffer, seg->end_seqnum_inclusive+1);
-        if (seg->prev == NULL) {
-            recv_buffer->start = seg->next;
-        }
-        if (seg->next == NULL) {
-            recv_buffer->end = seg->prev;
-        }
-        segment_disconnect(seg);
-        free(seg);
-    } else {
-        // cannot be merged with the existing in-order data
-        if (seg->prev == NULL) {
-            recv_buffer->start = seg;
+bool recv_buffer_has_ooo(recv_buffer_t* recv_buffer) {
+    return after(recv_buffer->ooo_end_seqnum, get_next_byte_expected_seqnum(recv_buffer));
+}
+
+uint32_t recv_buffer_sack_blocks(recv_buffer_t* recv_buffer, sack_block_t* blocks, uint32_t max_blocks) {
+    if (max_blocks == 0) {
+        return 0;
+    }
+    if (!recv_buffer_has_ooo(recv_buffer)) {
+        return 0;
+    }
+    uint32_t next_expected_seq = get_next_byte_expected_seqnum(recv_buffer);
+    // out-of-order bytes can only be between the next byte expected and the highest one
+    // received out of order : a large buffer is not scanned to its end
+    uint32_t window = min(recv_buffer_max_receive(recv_buffer), recv_buffer->ooo_end_seqnum - next_expected_seq);
+    // offsets from the next byte expected; the latest segment may be in order by now
+    uint32_t recent = recv_buffer->last_ooo_seqnum - next_expected_seq;
+    bool recent_found = recent >= window;
+    uint32_t count = 0;
+    uint32_t offset = 0;
+
+    while (offset < window && (count < max_blocks || !recent_found)) {
+        offset += bitmap_run(recv_buffer, seqnum_to_index_recv(recv_buffer, next_expected_seq + offset),
+                             window - offset, false);
+        if (offset >= window) {
+            break;
         }
-        if (seg->next == NULL) {
-            recv_buffer->end = seg;
+        uint32_t run = bitmap_run(recv_buffer, seqnum_to_index_recv(recv_buffer, next_expected_seq + offset),
+                                  window - offset, true);
+        sack_block_t block = {next_expected_seq + offset, next_expected_seq + offset + run};
+        if (!recent_found && recent >= offset && recent < offset + run) {
+            // the block of the latest segment goes first, the others keep their order
+            uint32_t keep = min(count, max_blocks - 1);
+            memmove(blocks + 1, blocks, keep * sizeof(sack_block_t));
+            blocks[0] = block;
+            count = keep + 1;
+            recent_found = true;
+        } else if (count + (recent_found ? 0 : 1) < max_blocks) {
+            // without the latest block yet, keep a slot for it
+            blocks[count++] = block;
         }
+        offset += run;
     }
-
-    uint32_t start_index = seqnum_to_index_recv(recv_buffer, seqnum);
-    safe_memcpy_to_recvbuf(recv_buffer, start_index, len, data);    
+    return count;
 }
 
 void recv_buffer_clean(recv_buffer_t* recv_buffer) {
     free(recv_buffer->buffer);
-    segment_clean(recv_buffer->start, recv_buffer->end);
+    free(recv_buffer->ooo_bitmap);
     free(recv_buffer);
 }
\ No newline at end of file
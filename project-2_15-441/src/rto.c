@@ -0,0 +1,52 @@
+#include "rto.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// the RTO from SRTT and RTTVAR, clamped, before backoff
+static uint32_t base_rto(rto_t* rto) {
+  if (rto->srtt_us == 0) {
+    return MAX(RTO_INITIAL_US, rto->min_us);
+  }
+  uint64_t value = (uint64_t)rto->srtt_us +
+                   MAX(RTO_GRANULARITY_US, 4 * (uint64_t)rto->rttvar_us);
+  return (uint32_t)MIN(MAX(value, rto->min_us), rto->max_us);
+}
+
+void rto_init(rto_t* rto) {
+  rto->srtt_us = 0;
+  rto->rttvar_us = 0;
+  rto->min_us = RTO_MIN_US;
+  rto->max_us = RTO_MAX_US;
+  rto->backoff = 0;
+  rto->rto_us = base_rto(rto);
+}
+
+void rto_on_sample(rto_t* rto, uint32_t rtt_us) {
+  rtt_us = MAX(rtt_us, 1);
+  if (rto->srtt_us == 0) {
+    rto->srtt_us = rtt_us;
+    rto->rttvar_us = rtt_us / 2;
+  } else {
+    uint32_t delta =
+        rtt_us > rto->srtt_us ? rtt_us - rto->srtt_us : rto->srtt_us - rtt_us;
+    // RTTVAR first, it uses the old SRTT
+    rto->rttvar_us = rto->rttvar_us - rto->rttvar_us / 4 + delta / 4;
+    rto->srtt_us = rto->srtt_us - rto->srtt_us / 8 + rtt_us / 8;
+    rto->srtt_us = MAX(rto->srtt_us, 1);
+  }
+  rto->backoff = 0;
+  rto->rto_us = base_rto(rto);
+}
+
+void rto_on_timeout(rto_t* rto) {
+  rto->backoff++;
+  rto->rto_us = (uint32_t)MIN((uint64_t)rto->rto_us * 2, rto->max_us);
+}
+
+void rto_set_min(rto_t* rto, uint32_t min_us) {
+  rto->min_us = min_us > 0 ? MIN(min_us, rto->max_us) : RTO_MIN_US;
+  if (rto->backoff == 0) {
+    rto->rto_us = base_rto(rto);
+  }
+}
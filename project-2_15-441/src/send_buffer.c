@@ -3,15 +3,25 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "cmu_packet.h"
 #include "send_buffer.h"
 
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
 long get_time_ms() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
     return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+uint64_t get_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /* seqnum and index */
 
 uint32_t seqnum_to_index_send(send_buffer_t* send_buffer, uint32_t seqnum) {
@@ -79,8 +89,7 @@ void safe_memcpy_to_sendbuf(send_buffer_t* send_buffer, uint32_t len, const uint
 }
 
 void safe_memcpy_from_sendbuf(send_buffer_t* send_buffer, uint32_t start_index, uint32_t len, uint8_t* data) {
-    uint32_t end_index = start_index + len - 1;
-    if (end_index > send_buffer->last_byte_acked_index) {
+    if (start_index + len <= send_buffer->capacity) {
         // no wrap around
         memcpy(data, send_buffer->buffer+start_index, len);
     } else {
@@ -91,6 +100,108 @@ void safe_memcpy_from_sendbuf(send_buffer_t* send_buffer, uint32_t start_index,
     }
 }
 
+/* segments */
+
+send_segment_t* segment_at(send_buffer_t* send_buffer, uint32_t i) {
+    return &send_buffer->segments[(send_buffer->segments_head + i) % send_buffer->segments_cap];
+}
+
+uint32_t segment_last_seq(send_segment_t* seg) {
+    return seg->seq + seg->len - 1;
+}
+
+// segment number 'id' holds the first byte of every chunk starting in [start, end) of the buffer
+void segment_index_range(send_buffer_t* send_buffer, uint32_t start, uint32_t end, uint32_t id) {
+    uint32_t chunk = (start + SEND_BUFFER_SEGMENT_BYTES - 1) / SEND_BUFFER_SEGMENT_BYTES;
+    for (; chunk * SEND_BUFFER_SEGMENT_BYTES < end; chunk++) {
+        send_buffer->segment_index[chunk] = id;
+    }
+}
+
+// remember that segment number 'id' now covers [seq, seq + len)
+void segment_index_add(send_buffer_t* send_buffer, uint32_t seq, uint32_t len, uint32_t id) {
+    uint32_t start = seqnum_to_index_send(send_buffer, seq);
+    uint32_t tail_len = MIN(len, send_buffer->capacity - start);
+    segment_index_range(send_buffer, start, start + tail_len, id);
+    if (len > tail_len) {
+        // wrap around
+        segment_index_range(send_buffer, 0, len - tail_len, id);
+    }
+}
+
+// position of the segment holding 'seq', or of the first one after it. the chunk 'seq'
+// falls in points at the segment holding the chunk's first byte, so only the segments
+// starting inside the chunk are scanned
+uint32_t segment_find(send_buffer_t* send_buffer, uint32_t seq) {
+    if (send_buffer->segments_count == 0 || !after(seq, send_buffer->last_byte_acked_seqnum)) {
+        return 0;
+    }
+    if (after(seq, get_last_byte_sent_seqnum(send_buffer))) {
+        return send_buffer->segments_count;
+    }
+    uint32_t chunk = seqnum_to_index_send(send_buffer, seq) / SEND_BUFFER_SEGMENT_BYTES;
+    uint32_t i = send_buffer->segment_index[chunk] - send_buffer->segments_removed;
+    if (i >= send_buffer->segments_count || after(segment_at(send_buffer, i)->seq, seq)) {
+        // the chunk's first byte was acknowledged, or sent in an earlier lap of the buffer;
+        // its segment is gone
+        i = 0;
+    }
+    while (i < send_buffer->segments_count && before(segment_last_seq(segment_at(send_buffer, i)), seq)) {
+        i++;
+    }
+    return i;
+}
+
+// move 'seg' to 'state', keeping sacked_bytes and lost_bytes in step
+void segment_set_state(send_buffer_t* send_buffer, send_segment_t* seg, send_segment_state_t state) {
+    if (seg->state == SEGMENT_SACKED) {
+        send_buffer->sacked_bytes -= seg->len;
+    } else if (seg->state == SEGMENT_LOST) {
+        send_buffer->lost_bytes -= seg->len;
+    }
+    seg->state = state;
+    if (state == SEGMENT_SACKED) {
+        send_buffer->sacked_bytes += seg->len;
+    } else if (state == SEGMENT_LOST) {
+        send_buffer->lost_bytes += seg->len;
+    }
+}
+
+void stamp_segment(send_buffer_t* send_buffer, send_segment_t* seg, uint64_t now_us) {
+    seg->sent_us = now_us;
+    seg->delivered = send_buffer->delivered;
+    seg->delivered_us = send_buffer->delivered_us;
+    seg->first_sent_us = send_buffer->first_sent_us;
+    seg->app_limited = send_buffer->app_limited != 0;
+}
+
+// RACK : 'seg' was just acknowledged or sacked (RFC 8985 6.2 step 2)
+void rack_on_delivered(send_buffer_t* send_buffer, send_segment_t* seg, uint64_t now_us) {
+    uint32_t end_seq = seg->seq + seg->len;
+    uint32_t rtt_us = (uint32_t)(now_us - seg->sent_us);
+    if (seg->tx_count > 1 && rtt_us < send_buffer->rack_min_rtt_us) {
+        // too soon for the retransmission : the original got there
+        return;
+    }
+    if (seg->tx_count == 1) {
+        if (send_buffer->rack_min_rtt_us == 0 || rtt_us < send_buffer->rack_min_rtt_us) {
+            send_buffer->rack_min_rtt_us = rtt_us > 0 ? rtt_us : 1;
+        }
+        if (before(end_seq, send_buffer->rack_fack)) {
+            send_buffer->rack_reordering_seen = true;
+        }
+    }
+    if (after(end_seq, send_buffer->rack_fack)) {
+        send_buffer->rack_fack = end_seq;
+    }
+    if (seg->sent_us > send_buffer->rack_xmit_us ||
+        (seg->sent_us == send_buffer->rack_xmit_us && after(end_seq, send_buffer->rack_end_seq))) {
+        send_buffer->rack_xmit_us = seg->sent_us;
+        send_buffer->rack_end_seq = end_seq;
+        send_buffer->rack_rtt_us = rtt_us;
+    }
+}
+
 /* ********************************** */
 /* *********** Interface *********** */
 /* ********************************** */
@@ -100,17 +211,36 @@ send_buffer_t* send_buffer_create(uint32_t capacity) {
     send_buf->capacity = capacity;
     send_buf->last_byte_acked_seqnum = 0;
     send_buf->buffer = malloc(capacity * sizeof(uint8_t));
+    send_buf->segments_cap = capacity / SEND_BUFFER_SEGMENT_BYTES + SEND_BUFFER_MIN_SEGMENTS;
+    send_buf->segments = malloc(send_buf->segments_cap * sizeof(send_segment_t));
+    send_buf->segments_head = 0;
+    send_buf->segments_count = 0;
+    send_buf->segments_removed = 0;
+    send_buf->segment_index = calloc(capacity / SEND_BUFFER_SEGMENT_BYTES + 1, sizeof(uint32_t));
+    send_buf->delivered = 0;
+    send_buf->dupack_delivered = 0;
+    send_buf->delivered_us = 0;
+    send_buf->first_sent_us = 0;
+    send_buf->app_limited = 0;
+    send_buf->sacked_bytes = 0;
+    send_buf->lost_bytes = 0;
+    send_buf->rack_xmit_us = 0;
+    send_buf->rack_end_seq = 0;
+    send_buf->rack_rtt_us = 0;
+    send_buf->rack_min_rtt_us = 0;
+    send_buf->rack_reordering_seen = false;
     return send_buf;
 }
 
 void send_buffer_initialize(send_buffer_t* send_buffer, uint32_t isn) {
     // printf("send_buffer->last_byte_acked_seqnum : %d\n", send_buffer->last_byte_acked_seqnum);
     assert(send_buffer->last_byte_acked_seqnum == 0);
-    send_buffer->last_byte_acked_ts = get_time_ms();
+    send_buffer->last_byte_acked_us = get_time_us();
     send_buffer->last_byte_acked_seqnum = isn;
     send_buffer->last_byte_acked_index = 0;
     send_buffer->last_byte_sent_index = 0;
     send_buffer->next_byte_written_index = 1;
+    send_buffer->rack_fack = isn + 1;
 }
 
 uint32_t send_buffer_max_write(send_buffer_t* send_buffer) {
@@ -160,7 +290,16 @@ void send_buffer_dump(send_buffer_t* send_buffer, uint32_t start_index, uint32_t
     }
 }
 
+void send_buffer_peek(send_buffer_t* send_buffer, uint32_t start_index, uint32_t len, uint8_t* data) {
+    if (len == 0) {
+        return;
+    }
+    safe_memcpy_from_sendbuf(send_buffer, start_index, len, data);
+}
+
 void send_buffer_clean(send_buffer_t* send_buffer) {
+    free(send_buffer->segments);
+    free(send_buffer->segment_index);
     free(send_buffer->buffer);
     free(send_buffer);
 }
@@ -169,10 +308,289 @@ void send_buffer_update_ack(send_buffer_t* send_buffer, uint32_t hdr_ack) {
     hdr_ack -= 1;
     if (hdr_ack > send_buffer->last_byte_acked_seqnum) {
         uint32_t idx = seqnum_to_index_send(send_buffer, hdr_ack);
+        if (hdr_ack > get_last_byte_sent_seqnum(send_buffer)) {
+            // bytes sent before send_buffer_rewind() reached the other side
+            send_buffer->last_byte_sent_index = idx;
+        }
         send_buffer->last_byte_acked_seqnum = hdr_ack;
         send_buffer->last_byte_acked_index = idx;
-        send_buffer->last_byte_acked_ts = get_time_ms();
+        send_buffer->last_byte_acked_us = get_time_us();
+    }
+}
+
+void send_buffer_on_send(send_buffer_t* send_buffer, uint32_t seq, uint32_t len, uint64_t now_us) {
+    uint32_t last_seq = seq + len - 1;
+
+    if (send_buffer->segments_count == 0) {
+        // nothing in flight : a new sampling interval starts with this segment
+        send_buffer->first_sent_us = now_us;
+        send_buffer->delivered_us = now_us;
+        send_buffer->dupack_delivered = 0;
+    }
+
+    // bytes sent before : refresh the segments they belong to
+    for (uint32_t i = segment_find(send_buffer, seq); i < send_buffer->segments_count; i++) {
+        send_segment_t* seg = segment_at(send_buffer, i);
+        if (after(seg->seq, last_seq)) {
+            break;
+        }
+        stamp_segment(send_buffer, seg, now_us);
+        seg->tx_count++;
+        if (seg->state == SEGMENT_LOST) {
+            segment_set_state(send_buffer, seg, SEGMENT_IN_FLIGHT);
+        }
     }
+
+    // bytes never sent before : a new segment at the end
+    if (send_buffer->segments_count > 0) {
+        send_segment_t* last = segment_at(send_buffer, send_buffer->segments_count - 1);
+        if (!after(last_seq, segment_last_seq(last))) {
+            return;
+        }
+        seq = after(seq, segment_last_seq(last)) ? seq : segment_last_seq(last) + 1;
+        if (send_buffer->segments_count == send_buffer->segments_cap) {
+            // no room left, make the last segment longer; the new bytes are neither sacked nor lost
+            segment_set_state(send_buffer, last, SEGMENT_IN_FLIGHT);
+            segment_index_add(send_buffer, seq, last_seq - seq + 1,
+                              send_buffer->segments_removed + send_buffer->segments_count - 1);
+            last->len = last_seq - last->seq + 1;
+            stamp_segment(send_buffer, last, now_us);
+            return;
+        }
+    }
+    send_segment_t* seg = segment_at(send_buffer, send_buffer->segments_count);
+    segment_index_add(send_buffer, seq, last_seq - seq + 1,
+                      send_buffer->segments_removed + send_buffer->segments_count);
+    send_buffer->segments_count++;
+    seg->seq = seq;
+    seg->len = last_seq - seq + 1;
+    seg->tx_count = 1;
+    seg->state = SEGMENT_IN_FLIGHT;
+    seg->orig_sent_us = now_us;
+    stamp_segment(send_buffer, seg, now_us);
+}
+
+void send_buffer_mark_app_limited(send_buffer_t* send_buffer) {
+    uint64_t mark = send_buffer->delivered + get_unacknowledged_count(send_buffer);
+    send_buffer->app_limited = mark > 0 ? mark : 1;
+}
+
+void send_buffer_on_dupack(send_buffer_t* send_buffer, uint32_t len, uint64_t now_us) {
+    // the first unacknowledged segment is the one missing
+    uint32_t unacked = get_unacknowledged_count(send_buffer);
+    uint32_t limit = send_buffer->segments_count > 0 ? unacked - segment_at(send_buffer, 0)->len : 0;
+    len = MIN(len, limit - MIN(limit, send_buffer->dupack_delivered));
+    send_buffer->dupack_delivered += len;
+    send_buffer->delivered += len;
+    send_buffer->delivered_us = now_us;
+}
+
+void send_buffer_ack_segments(send_buffer_t* send_buffer, uint32_t hdr_ack, uint64_t now_us,
+                              rate_sample_t* rs) {
+    uint32_t last_acked = hdr_ack - 1;
+    uint64_t acked = 0;
+    uint64_t sacked = 0;
+    uint32_t hole = 0;
+    uint64_t oldest_sent_us = 0;
+    bool retransmitted = false;
+    send_segment_t newest;
+    bool have_newest = false;
+
+    while (send_buffer->segments_count > 0) {
+        send_segment_t* seg = segment_at(send_buffer, 0);
+        if (before(last_acked, seg->seq)) {
+            break;
+        }
+        if (acked == 0) {
+            hole = seg->len;
+            oldest_sent_us = seg->sent_us;
+        }
+        retransmitted = retransmitted || seg->tx_count > 1;
+        if (before(last_acked, segment_last_seq(seg))) {
+            // partly acknowledged; the rest stays in flight
+            uint32_t part = last_acked - seg->seq + 1;
+            acked += part;
+            if (seg->state == SEGMENT_SACKED) {
+                sacked += part;
+                send_buffer->sacked_bytes -= part;
+            } else if (seg->state == SEGMENT_LOST) {
+                send_buffer->lost_bytes -= part;
+            }
+            seg->seq += part;
+            seg->len -= part;
+            break;
+        }
+        acked += seg->len;
+        if (seg->state == SEGMENT_SACKED) {
+            sacked += seg->len;
+        } else {
+            rack_on_delivered(send_buffer, seg, now_us);
+        }
+        segment_set_state(send_buffer, seg, SEGMENT_IN_FLIGHT);
+        // the sample comes from the most recently sent of the acknowledged segments
+        if (!have_newest || seg->delivered > newest.delivered ||
+            (seg->delivered == newest.delivered && seg->sent_us > newest.sent_us)) {
+            newest = *seg;
+            have_newest = true;
+        }
+        send_buffer->segments_head = (send_buffer->segments_head + 1) % send_buffer->segments_cap;
+        send_buffer->segments_count--;
+        send_buffer->segments_removed++;
+    }
+    // bytes already counted when they were sacked, or when their duplicate ACKs came in; the
+    // first segment is the one that was missing, so it is new either way
+    uint64_t fresh = acked - sacked;
+    uint32_t credited = (uint32_t)MIN(fresh - MIN(fresh, hole), send_buffer->dupack_delivered);
+    send_buffer->dupack_delivered -= credited;
+    send_buffer->delivered += fresh - credited;
+    send_buffer->delivered_us = now_us;
+    if (send_buffer->app_limited != 0 && send_buffer->delivered > send_buffer->app_limited) {
+        send_buffer->app_limited = 0;
+    }
+
+    rs->delivered = send_buffer->delivered;
+    rs->prior_delivered = 0;
+    rs->interval_us = 0;
+    rs->delivery_rate = 0;
+    rs->app_limited = false;
+    rs->rtt_us = 0;
+    if (acked > 0 && !retransmitted) {
+        rs->rtt_us = (uint32_t)(now_us - oldest_sent_us);
+        rs->rtt_us = rs->rtt_us > 0 ? rs->rtt_us : 1;
+    }
+    if (!have_newest) {
+        return;
+    }
+    send_buffer->first_sent_us = newest.sent_us;
+    if (newest.tx_count > 1) {
+        // the ACK for a retransmission also covers data that arrived long before
+        // it; the rate would be far too high
+        return;
+    }
+    // the slower of the send and ACK rates over the interval; an ACK rate alone
+    // would be too high when ACKs arrive compressed
+    uint64_t send_elapsed = newest.sent_us - newest.first_sent_us;
+    uint64_t ack_elapsed = now_us - newest.delivered_us;
+    rs->prior_delivered = newest.delivered;
+    rs->app_limited = newest.app_limited;
+    rs->interval_us = send_elapsed > ack_elapsed ? send_elapsed : ack_elapsed;
+    if (rs->interval_us > 0) {
+        rs->delivery_rate = (rs->delivered - rs->prior_delivered) * 1000000 / rs->interval_us;
+    }
+}
+
+uint32_t send_buffer_on_sack(send_buffer_t* send_buffer, const sack_block_t* blocks, uint32_t count,
+                             uint64_t now_us) {
+    uint32_t newly = 0;
+    for (uint32_t b = 0; b < count; b++) {
+        if (!after(blocks[b].end, blocks[b].start)) {
+            continue;
+        }
+        for (uint32_t i = segment_find(send_buffer, blocks[b].start); i < send_buffer->segments_count; i++) {
+            send_segment_t* seg = segment_at(send_buffer, i);
+            if (before(seg->seq, blocks[b].start)) {
+                // only partly inside the block
+                continue;
+            }
+            if (after(seg->seq + seg->len, blocks[b].end)) {
+                break;
+            }
+            if (seg->state != SEGMENT_SACKED) {
+                rack_on_delivered(send_buffer, seg, now_us);
+                segment_set_state(send_buffer, seg, SEGMENT_SACKED);
+                newly += seg->len;
+            }
+        }
+    }
+    if (newly > 0) {
+        send_buffer->delivered += newly;
+        send_buffer->delivered_us = now_us;
+    }
+    return newly;
+}
+
+uint32_t send_buffer_rack_mark_lost(send_buffer_t* send_buffer, uint32_t reo_wnd_us, uint64_t now_us,
+                                    uint64_t* wait_us) {
+    uint32_t newly = 0;
+    *wait_us = 0;
+    if (send_buffer->rack_xmit_us == 0) {
+        return 0;
+    }
+    // the ring is in sequence order, not in send order : every segment has to be looked at
+    for (uint32_t i = 0; i < send_buffer->segments_count; i++) {
+        send_segment_t* seg = segment_at(send_buffer, i);
+        if (seg->state != SEGMENT_IN_FLIGHT) {
+            continue;
+        }
+        if (seg->sent_us > send_buffer->rack_xmit_us ||
+            (seg->sent_us == send_buffer->rack_xmit_us &&
+             !before(seg->seq + seg->len, send_buffer->rack_end_seq))) {
+            // not sent before the one delivered
+            continue;
+        }
+        uint64_t deadline = seg->sent_us + send_buffer->rack_rtt_us + reo_wnd_us;
+        if (deadline <= now_us) {
+            segment_set_state(send_buffer, seg, SEGMENT_LOST);
+            newly += seg->len;
+        } else if (*wait_us == 0 || deadline - now_us < *wait_us) {
+            *wait_us = deadline - now_us;
+        }
+    }
+    return newly;
+}
+
+void send_buffer_mark_first_lost(send_buffer_t* send_buffer) {
+    if (send_buffer->segments_count == 0) {
+        return;
+    }
+    send_segment_t* seg = segment_at(send_buffer, 0);
+    if (seg->state == SEGMENT_IN_FLIGHT && seg->tx_count == 1) {
+        segment_set_state(send_buffer, seg, SEGMENT_LOST);
+    }
+}
+
+void send_buffer_mark_all_lost(send_buffer_t* send_buffer, bool forget_sacks) {
+    for (uint32_t i = 0; i < send_buffer->segments_count; i++) {
+        send_segment_t* seg = segment_at(send_buffer, i);
+        if (seg->state == SEGMENT_IN_FLIGHT || (forget_sacks && seg->state == SEGMENT_SACKED)) {
+            segment_set_state(send_buffer, seg, SEGMENT_LOST);
+        }
+    }
+}
+
+bool send_buffer_next_lost(send_buffer_t* send_buffer, uint32_t* seq, uint32_t* len) {
+    if (send_buffer->lost_bytes == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < send_buffer->segments_count; i++) {
+        send_segment_t* seg = segment_at(send_buffer, i);
+        if (seg->state == SEGMENT_LOST) {
+            *seq = seg->seq;
+            *len = seg->len;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool send_buffer_last_segment(send_buffer_t* send_buffer, uint32_t* seq, uint32_t* len) {
+    if (send_buffer->segments_count == 0) {
+        return false;
+    }
+    send_segment_t* seg = segment_at(send_buffer, send_buffer->segments_count - 1);
+    *seq = seg->seq;
+    *len = seg->len;
+    return true;
+}
+
+uint32_t send_buffer_in_flight(send_buffer_t* send_buffer) {
+    uint32_t unacked = get_unacknowledged_count(send_buffer);
+    uint32_t out = send_buffer->sacked_bytes + send_buffer->lost_bytes;
+    return unacked > out ? unacked - out : 0;
+}
+
+void send_buffer_rewind(send_buffer_t* send_buffer) {
+    send_buffer->last_byte_sent_index = send_buffer->last_byte_acked_index;
 }
 
 uint32_t get_unacknowledged_count(send_buffer_t* send_buffer) {
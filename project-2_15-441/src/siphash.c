@@ -0,0 +1,78 @@
+#include <pthread.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "siphash.h"
+
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+static uint64_t key[2];
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void init_key(void) {
+  if (getrandom(key, sizeof(key), 0) != sizeof(key)) {
+    // no entropy to be had : the clock and the pid still differ from one run to
+    // the next
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    key[0] = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    key[1] = ((uint64_t)getpid() << 32) ^ (uint64_t)clock();
+  }
+}
+
+static void sip_round(uint64_t* v) {
+  v[0] += v[1];
+  v[1] = ROTL(v[1], 13);
+  v[1] ^= v[0];
+  v[0] = ROTL(v[0], 32);
+  v[2] += v[3];
+  v[3] = ROTL(v[3], 16);
+  v[3] ^= v[2];
+  v[0] += v[3];
+  v[3] = ROTL(v[3], 21);
+  v[3] ^= v[0];
+  v[2] += v[1];
+  v[1] = ROTL(v[1], 17);
+  v[1] ^= v[2];
+  v[2] = ROTL(v[2], 32);
+}
+
+static void sip_block(uint64_t* v, uint64_t m) {
+  v[3] ^= m;
+  sip_round(v);
+  sip_round(v);
+  v[0] ^= m;
+}
+
+uint64_t siphash_keyed(const uint64_t k[2], const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint64_t v[4] = {
+      k[0] ^ 0x736f6d6570736575ull,
+      k[1] ^ 0x646f72616e646f6dull,
+      k[0] ^ 0x6c7967656e657261ull,
+      k[1] ^ 0x7465646279746573ull,
+  };
+  // 8 byte blocks, little endian; the last one is padded and its top byte is
+  // the length
+  uint64_t m = 0;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    m |= (uint64_t)bytes[i] << (8 * (i % 8));
+    if (i % 8 == 7) {
+      sip_block(v, m);
+      m = 0;
+    }
+  }
+  sip_block(v, m | ((uint64_t)len << 56));
+  v[2] ^= 0xff;
+  for (i = 0; i < 4; i++) {
+    sip_round(v);
+  }
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+uint64_t siphash(const void* data, size_t len) {
+  pthread_once(&key_once, init_key);
+  return siphash_keyed(key, data, len);
+}
@@ -0,0 +1,521 @@
+/**
+ * This file implements a loopback throughput benchmark for CMU-TCP.
+ *
+ * A listener and an initiator run in the same process on 127.0.0.1. The
+ * initiator writes a fixed amount of data and closes the socket, which returns
+ * once everything has been acknowledged; the listener checks the bytes it
+ * reads. The run is repeated for every I/O engine given on the command line.
+ *
+ * Usage: bench_loopback [-n bytes] [-p port] [-b busy_poll_us] [-l loss_pct]
+ *                       [-d rtt_ms] [-s seed] [-r rate_mbit] [-q queue_packets]
+ *                       [-c congestion] [-P pacing_mbit] [-R rto_min_us]
+ *                       [-B buffer_bytes] [-A ack_frequency] [-D delack_us]
+ *                       [-N] [engine ...]
+ *        engines: sendto (default) and io_uring (needs `make IO_URING=1`)
+ *        -b enables the busy-poll mode on both sockets (CMU_SO_BUSY_POLL).
+ *        -l puts a UDP proxy between the two sockets that drops that percentage
+ *        of the packets, in both directions.
+ *        -d makes the proxy delay the packets, adding that much to the RTT.
+ *        -s seeds the proxy's random losses.
+ *        -r makes the proxy a bottleneck of that rate, in each direction, with
+ *        a queue of -q packets (100 by default); what does not fit is dropped.
+ *        With the proxy, what it dropped and the segments the sender resent
+ *        are reported.
+ *        -c picks the congestion control algorithm of both sockets.
+ *        -P caps the sender's pacing rate (CMU_SO_MAX_PACING_RATE).
+ *        -R lowers the sender's minimum retransmission timeout
+ *        (CMU_SO_RTO_MIN).
+ *        -B sets the size of the send and receive buffers of both sockets
+ *        (CMU_SO_SNDBUF and CMU_SO_RCVBUF).
+ *        -A and -D set how many segments both sockets receive before they ACK
+ *        (CMU_SO_ACK_FREQUENCY) and how long they hold back an ACK otherwise
+ *        (CMU_SO_DELACK_TIMEOUT); -D 0 ACKs every segment.
+ *        -N turns Nagle's algorithm off on both sockets (CMU_SO_NODELAY).
+ *
+ * It only measures how fast the data goes through; `make check` runs the unit
+ * tests of the modules behind these options.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmu_tcp.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+typedef struct {
+  int num_bytes;
+  int busy_poll_us;
+  double loss_pct;
+  double delay_ms;    // round trip added by the proxy
+  unsigned int seed;  // of the proxy's losses
+  double rate_mbit;   // bottleneck of the proxy
+  uint32_t queue_pkts;
+  const char *congestion;
+  double pacing_mbit;  // static pacing cap of the sender
+  int rto_min_us;
+  int buff_bytes;     // 0 : the default
+  int ack_frequency;  // 0 : the default
+  int delack_us;      // -1 : the default
+  int nodelay;
+} bench_opts_t;
+
+typedef struct {
+  int port;
+  int num_bytes;
+  int busy_poll_us;
+  const char *congestion;
+  int buff_bytes;
+  int ack_frequency;
+  int delack_us;
+  int nodelay;
+  int ok;
+  int sender_done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} bench_run_t;
+
+// packets held back by the proxy in each direction
+#define PROXY_QUEUE_LEN 4096
+
+typedef struct {
+  uint64_t release_us;
+  int len;
+  // malloc'ed, most packets being much shorter than MAX_DATAGRAM_LEN
+  uint8_t *data;
+} proxy_packet_t;
+
+// one direction of the emulated path : a bottleneck with a queue, then a delay
+typedef struct {
+  proxy_packet_t *queue;  // FIFO, in release order
+  int head;
+  int count;
+  uint64_t busy_until_us;  // when the bottleneck is done with what is queued
+} proxy_link_t;
+
+typedef struct {
+  int fd;
+  int server_port;
+  double loss;
+  uint64_t delay_us;     // one way
+  uint64_t rate;         // bottleneck, bytes per second; 0 for none
+  uint32_t queue_bytes;  // bottleneck queue
+  unsigned int seed;
+  volatile int done;
+  proxy_link_t links[2];  // indexed by 'to_server'
+  uint64_t forwarded;
+  uint64_t dropped;     // random losses
+  uint64_t overflowed;  // bottleneck queue full
+} proxy_t;
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_s(struct timeval tv) { return tv.tv_sec + tv.tv_usec / 1e6; }
+
+// queues a packet that just arrived on 'link', or drops it
+static void proxy_enqueue(proxy_t *proxy, proxy_link_t *link,
+                          const uint8_t *data, int len) {
+  uint64_t now = now_us();
+  uint64_t release_us = now + proxy->delay_us;
+
+  if ((double)rand_r(&proxy->seed) / RAND_MAX < proxy->loss) {
+    proxy->dropped++;
+    return;
+  }
+  if (proxy->rate > 0) {
+    uint64_t start_us = MAX(now, link->busy_until_us);
+    uint64_t backlog = (start_us - now) * proxy->rate / 1000000;
+    if (backlog + len > proxy->queue_bytes) {
+      proxy->overflowed++;
+      return;
+    }
+    link->busy_until_us = start_us + (uint64_t)len * 1000000 / proxy->rate;
+    release_us = link->busy_until_us + proxy->delay_us;
+  }
+  if (link->count == PROXY_QUEUE_LEN - 1) {
+    proxy->overflowed++;
+    return;
+  }
+  proxy_packet_t *pkt =
+      &link->queue[(link->head + link->count) % PROXY_QUEUE_LEN];
+  pkt->release_us = release_us;
+  pkt->len = len;
+  pkt->data = malloc(len);
+  memcpy(pkt->data, data, len);
+  link->count++;
+}
+
+// forwards packets between the initiator and the listener on 'server_port'
+// over an emulated path : random losses, a bottleneck and a delay
+static void *proxy_run(void *in) {
+  proxy_t *proxy = (proxy_t *)in;
+  struct sockaddr_in addrs[2], from;
+  socklen_t from_len;
+  struct pollfd pfd;
+  int have_client = 0;
+
+  // addrs[0] : the initiator, learnt from its first packet
+  memset(addrs, 0, sizeof(addrs));
+  addrs[1].sin_family = AF_INET;
+  addrs[1].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addrs[1].sin_port = htons(proxy->server_port);
+  pfd.fd = proxy->fd;
+  pfd.events = POLLIN;
+
+  while (!proxy->done) {
+    // release what is due, and wait for the next release, a packet, or now
+    // and then to notice the end of the run
+    uint64_t now = now_us();
+    int timeout_ms = 100;
+    for (int to_server = 0; to_server < 2; to_server++) {
+      proxy_link_t *link = &proxy->links[to_server];
+      while (link->count > 0 && link->queue[link->head].release_us <= now) {
+        proxy_packet_t *pkt = &link->queue[link->head];
+        if (to_server || have_client) {
+          sendto(proxy->fd, pkt->data, pkt->len, 0,
+                 (struct sockaddr *)&addrs[to_server],
+                 sizeof(addrs[to_server]));
+          proxy->forwarded++;
+        }
+        free(pkt->data);
+        link->head = (link->head + 1) % PROXY_QUEUE_LEN;
+        link->count--;
+      }
+      if (link->count > 0) {
+        uint64_t release_us = link->queue[link->head].release_us;
+        timeout_ms = MIN(timeout_ms, (int)((release_us - now + 999) / 1000));
+      }
+    }
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+      continue;
+    }
+
+    uint8_t buf[MAX_DATAGRAM_LEN];
+    from_len = sizeof(from);
+    ssize_t len = recvfrom(proxy->fd, buf, sizeof(buf), 0,
+                           (struct sockaddr *)&from, &from_len);
+    if (len <= 0) {
+      continue;
+    }
+    int to_server = from.sin_port != addrs[1].sin_port;
+    if (to_server) {
+      addrs[0] = from;
+      have_client = 1;
+    }
+    proxy_enqueue(proxy, &proxy->links[to_server], buf, (int)len);
+  }
+  return NULL;
+}
+
+// binds the proxy to 'port' and starts forwarding to the listener
+static int start_proxy(proxy_t *proxy, pthread_t *thread, int port,
+                       int server_port, const bench_opts_t *opts) {
+  struct sockaddr_in addr;
+
+  memset(proxy, 0, sizeof(*proxy));
+  proxy->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (proxy->fd < 0) {
+    return -1;
+  }
+  // room for a window of large datagrams from both sides, as the path itself
+  // drops nothing
+  int rcvbuf = 4 << 20;
+  setsockopt(proxy->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(proxy->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(proxy->fd);
+    return -1;
+  }
+  proxy->server_port = server_port;
+  proxy->loss = opts->loss_pct / 100;
+  proxy->delay_us = (uint64_t)(opts->delay_ms * 1000 / 2);
+  proxy->rate = (uint64_t)(opts->rate_mbit * 1e6 / 8);
+  proxy->queue_bytes = opts->queue_pkts * MAX_LEN;
+  proxy->seed = opts->seed;
+  for (int i = 0; i < 2; i++) {
+    proxy->links[i].queue = malloc(PROXY_QUEUE_LEN * sizeof(proxy_packet_t));
+  }
+  pthread_create(thread, NULL, proxy_run, proxy);
+  return 0;
+}
+
+static void stop_proxy(proxy_t *proxy, pthread_t thread) {
+  proxy->done = 1;
+  pthread_join(thread, NULL);
+  close(proxy->fd);
+  for (int i = 0; i < 2; i++) {
+    proxy_link_t *link = &proxy->links[i];
+    for (; link->count > 0; link->count--) {
+      free(link->queue[link->head].data);
+      link->head = (link->head + 1) % PROXY_QUEUE_LEN;
+    }
+    free(link->queue);
+  }
+}
+
+static void set_congestion(cmu_socket_t *sock, const char *congestion) {
+  if (congestion != NULL && cmu_setsockopt(sock, CMU_SO_CONGESTION, congestion,
+                                           strlen(congestion)) < 0) {
+    fprintf(stderr, "unknown congestion control '%s'\n", congestion);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// applies the -B option to 'sock', before its handshake
+static void set_buff_size(cmu_socket_t *sock, int buff_bytes) {
+  if (buff_bytes > 0 &&
+      (cmu_setsockopt(sock, CMU_SO_RCVBUF, &buff_bytes, sizeof(int)) < 0 ||
+       cmu_setsockopt(sock, CMU_SO_SNDBUF, &buff_bytes, sizeof(int)) < 0)) {
+    perror("buffer size");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// applies the -A and -D options to 'sock'
+static void set_ack_policy(cmu_socket_t *sock, int ack_frequency,
+                           int delack_us) {
+  if (ack_frequency > 0) {
+    cmu_setsockopt(sock, CMU_SO_ACK_FREQUENCY, &ack_frequency, sizeof(int));
+  }
+  if (delack_us >= 0) {
+    cmu_setsockopt(sock, CMU_SO_DELACK_TIMEOUT, &delack_us, sizeof(int));
+  }
+}
+
+// reads exactly 'len' bytes into 'buf'
+static void read_full(cmu_socket_t *sock, uint8_t *buf, int len) {
+  int got = 0;
+  while (got < len) {
+    got += cmu_read(sock, buf + got, len - got, NO_FLAG);
+  }
+}
+
+static void *receiver(void *in) {
+  bench_run_t *run = (bench_run_t *)in;
+  cmu_socket_t sock;
+  uint8_t *buf = malloc(run->num_bytes);
+
+  if (cmu_socket(&sock, TCP_LISTENER, run->port, "127.0.0.1") < 0) {
+    exit(EXIT_FAILURE);
+  }
+  set_buff_size(&sock, run->buff_bytes);
+  cmu_setsockopt(&sock, CMU_SO_BUSY_POLL, &run->busy_poll_us, sizeof(int));
+  set_congestion(&sock, run->congestion);
+  set_ack_policy(&sock, run->ack_frequency, run->delack_us);
+  cmu_setsockopt(&sock, CMU_SO_NODELAY, &run->nodelay, sizeof(int));
+  read_full(&sock, buf, run->num_bytes);
+  run->ok = 1;
+  for (int i = 0; i < run->num_bytes; i++) {
+    if (buf[i] != (uint8_t)(i * 7)) {
+      run->ok = 0;
+      break;
+    }
+  }
+
+  // keep acknowledging until the sender has seen every ACK
+  pthread_mutex_lock(&run->lock);
+  while (!run->sender_done) {
+    pthread_cond_wait(&run->cond, &run->lock);
+  }
+  pthread_mutex_unlock(&run->lock);
+
+  cmu_close(&sock);
+  free(buf);
+  return NULL;
+}
+
+static int bench_engine(const char *engine, int port,
+                        const bench_opts_t *opts) {
+  bench_run_t run;
+  pthread_t thread;
+  proxy_t proxy;
+  pthread_t proxy_thread;
+  int use_proxy =
+      opts->loss_pct > 0 || opts->delay_ms > 0 || opts->rate_mbit > 0;
+  int connect_port = port;
+  int num_bytes = opts->num_bytes;
+  cmu_socket_t sock;
+  struct rusage ru_start, ru_end;
+  uint8_t *buf = malloc(num_bytes);
+
+  for (int i = 0; i < num_bytes; i++) {
+    buf[i] = (uint8_t)(i * 7);
+  }
+  memset(&run, 0, sizeof(run));
+  run.port = port;
+  run.num_bytes = num_bytes;
+  run.busy_poll_us = opts->busy_poll_us;
+  run.congestion = opts->congestion;
+  run.buff_bytes = opts->buff_bytes;
+  run.ack_frequency = opts->ack_frequency;
+  run.delack_us = opts->delack_us;
+  run.nodelay = opts->nodelay;
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_cond_init(&run.cond, NULL);
+
+  setenv(IO_ENGINE_ENV, engine, 1);
+  pthread_create(&thread, NULL, receiver, &run);
+  usleep(100000);
+  if (use_proxy) {
+    connect_port = port + 1000;
+    if (start_proxy(&proxy, &proxy_thread, connect_port, port, opts) < 0) {
+      perror("proxy");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  getrusage(RUSAGE_SELF, &ru_start);
+  double start = now_s();
+  if (cmu_socket(&sock, TCP_INITIATOR, connect_port, "127.0.0.1") < 0) {
+    exit(EXIT_FAILURE);
+  }
+  set_buff_size(&sock, opts->buff_bytes);
+  cmu_setsockopt(&sock, CMU_SO_BUSY_POLL, &opts->busy_poll_us, sizeof(int));
+  set_congestion(&sock, opts->congestion);
+  set_ack_policy(&sock, opts->ack_frequency, opts->delack_us);
+  cmu_setsockopt(&sock, CMU_SO_NODELAY, &opts->nodelay, sizeof(int));
+  if (opts->pacing_mbit > 0) {
+    int pacing_rate = (int)(opts->pacing_mbit * 1e6 / 8);
+    cmu_setsockopt(&sock, CMU_SO_MAX_PACING_RATE, &pacing_rate, sizeof(int));
+  }
+  if (opts->rto_min_us > 0) {
+    cmu_setsockopt(&sock, CMU_SO_RTO_MIN, &opts->rto_min_us, sizeof(int));
+  }
+  cmu_write(&sock, buf, num_bytes);
+  cmu_close(&sock);
+  cmu_socket_stats_t sender_stats;
+  cmu_get_stats(&sock, &sender_stats);
+  double elapsed = now_s() - start;
+  getrusage(RUSAGE_SELF, &ru_end);
+
+  pthread_mutex_lock(&run.lock);
+  run.sender_done = 1;
+  pthread_cond_signal(&run.cond);
+  pthread_mutex_unlock(&run.lock);
+  pthread_join(thread, NULL);
+  if (use_proxy) {
+    stop_proxy(&proxy, proxy_thread);
+  }
+
+  printf(
+      "%-10s %10d bytes %8.3f s %10.2f Mbit/s  user %6.3f s  sys %6.3f s  %s\n",
+      engine, num_bytes, elapsed, num_bytes * 8 / elapsed / 1e6,
+      cpu_s(ru_end.ru_utime) - cpu_s(ru_start.ru_utime),
+      cpu_s(ru_end.ru_stime) - cpu_s(ru_start.ru_stime),
+      run.ok ? "OK" : "CORRUPTED");
+  if (use_proxy) {
+    uint64_t total = proxy.forwarded + proxy.dropped + proxy.overflowed;
+    printf(
+        "%-10s proxy forwarded %llu packets, dropped %llu (%.1f%%), queue "
+        "overflows %llu (%.1f%%); sender resent %llu segments\n",
+        "", (unsigned long long)proxy.forwarded,
+        (unsigned long long)proxy.dropped, 100.0 * proxy.dropped / total,
+        (unsigned long long)proxy.overflowed, 100.0 * proxy.overflowed / total,
+        (unsigned long long)sender_stats.retransmits);
+  }
+  free(buf);
+  return run.ok ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  bench_opts_t opts;
+  int port = 15441;
+  int opt;
+  int failed = 0;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.num_bytes = 1 << 20;
+  opts.seed = 1;
+  opts.queue_pkts = 100;
+  opts.delack_us = -1;
+  while ((opt = getopt(argc, argv, "n:p:b:l:d:s:r:q:c:P:R:B:A:D:N")) != -1) {
+    switch (opt) {
+      case 'n':
+        opts.num_bytes = atoi(optarg);
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'b':
+        opts.busy_poll_us = atoi(optarg);
+        break;
+      case 'l':
+        opts.loss_pct = atof(optarg);
+        break;
+      case 'd':
+        opts.delay_ms = atof(optarg);
+        break;
+      case 's':
+        opts.seed = (unsigned int)atoi(optarg);
+        break;
+      case 'r':
+        opts.rate_mbit = atof(optarg);
+        break;
+      case 'q':
+        opts.queue_pkts = (uint32_t)atoi(optarg);
+        break;
+      case 'c':
+        opts.congestion = optarg;
+        break;
+      case 'P':
+        opts.pacing_mbit = atof(optarg);
+        break;
+      case 'R':
+        opts.rto_min_us = atoi(optarg);
+        break;
+      case 'B':
+        opts.buff_bytes = atoi(optarg);
+        break;
+      case 'A':
+        opts.ack_frequency = atoi(optarg);
+        break;
+      case 'D':
+        opts.delack_us = atoi(optarg);
+        break;
+      case 'N':
+        opts.nodelay = 1;
+        break;
+      default:
+        fprintf(
+            stderr,
+            "usage: %s [-n bytes] [-p port] [-b busy_poll_us] [-l loss_pct]\n"
+            "       [-d rtt_ms] [-s seed] [-r rate_mbit] [-q queue_packets]\n"
+            "       [-c congestion] [-P pacing_mbit] [-R rto_min_us]\n"
+            "       [-B buffer_bytes] [-A ack_frequency] [-D delack_us] [-N]\n"
+            "       [engine ...]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind == argc) {
+    failed |= bench_engine("sendto", port, &opts);
+  }
+  for (int i = optind; i < argc; i++) {
+    failed |= bench_engine(argv[i], port + i, &opts);
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
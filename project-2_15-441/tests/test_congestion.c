@@ -0,0 +1,293 @@
+/**
+ * This file checks the congestion control algorithms of CMU-TCP.
+ *
+ *   - cc_find() and cc_init() know every algorithm by name, and refuse an
+ *     unknown one with ENOENT; without a name, CMU_TCP_CC or CC_DEFAULT
+ *   - none never limits the window nor paces
+ *   - reno grows the window by the bytes acknowledged in slow start, at most
+ *     2 MSS an ACK, and by one MSS a window in congestion avoidance, not when
+ *     the window is not what limits sending
+ *   - reno halves what was in flight on a loss, inflates the window in fast
+ *     recovery without SACK, and drops to one MSS on a timeout
+ *   - cubic keeps 70% of the window on a loss and, on a long path, grows
+ *     back to where the loss happened sooner than reno
+ *   - HyStart ends slow start once the RTT of a round grows
+ *   - bbr paces before any sample, settles at the bottleneck bandwidth with
+ *     about two bandwidth-delay products in flight, and keeps sending what is
+ *     in flight through a loss
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_congestion
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmu_packet.h"
+#include "congestion.h"
+#include "grading.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+static int failed = 0;
+
+static void test_interface() {
+  const char* names[] = {"none", "reno", "cubic", "bbr"};
+  cc_t cc;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    CHECK(cc_find(names[i]) != NULL);
+    CHECK(cc_init(&cc, names[i], MSS) == 0);
+    CHECK(strcmp(cc.ops->name, names[i]) == 0);
+    CHECK(cc.mss == MSS && !cc.sack && cc.cwnd > 0);
+    cc_destroy(&cc);
+  }
+
+  CHECK(cc_find("vegas") == NULL);
+  errno = 0;
+  CHECK(cc_init(&cc, "vegas", MSS) == -1 && errno == ENOENT);
+
+  unsetenv(CC_ENV);
+  CHECK(cc_init(&cc, NULL, MSS) == 0);
+  CHECK(strcmp(cc.ops->name, CC_DEFAULT) == 0);
+  cc_destroy(&cc);
+  setenv(CC_ENV, "cubic", 1);
+  CHECK(cc_init(&cc, NULL, MSS) == 0);
+  CHECK(strcmp(cc.ops->name, "cubic") == 0);
+  cc_destroy(&cc);
+  unsetenv(CC_ENV);
+}
+
+static void test_none() {
+  cc_t cc;
+  CHECK(cc_init(&cc, "none", MSS) == 0);
+  CHECK(cc.cwnd == UINT32_MAX);
+  cc_on_loss(&cc, 10 * MSS);
+  cc_on_rto(&cc, 10 * MSS);
+  CHECK(cc.cwnd == UINT32_MAX);
+  CHECK(cc_pacing_rate(&cc) == 0);
+  cc_destroy(&cc);
+}
+
+// an ACK of 'acked' bytes, 'inflight' bytes left in flight
+static cc_ack_t ack_of(uint32_t acked, uint32_t inflight) {
+  cc_ack_t ack;
+  memset(&ack, 0, sizeof(ack));
+  ack.acked = acked;
+  ack.inflight = inflight;
+  return ack;
+}
+
+// acknowledges a full window, one segment an ACK spread over 'rtt_us'
+static void ack_round(cc_t* cc, uint64_t* now_us, uint32_t rtt_us) {
+  uint32_t segs = cc->cwnd / cc->mss;
+  for (uint32_t i = 0; i < segs; i++) {
+    cc_ack_t ack = ack_of(cc->mss, cc->cwnd - cc->mss);
+    ack.rtt_us = rtt_us;
+    ack.now_us = *now_us + (uint64_t)i * rtt_us / segs;
+    cc_on_ack(cc, &ack);
+  }
+  *now_us += rtt_us;
+}
+
+static void test_reno_growth() {
+  cc_t cc;
+  CHECK(cc_init(&cc, "reno", MSS) == 0);
+  CHECK(cc.cwnd == WINDOW_INITIAL_WINDOW_SIZE);
+  CHECK(cc.ssthresh == WINDOW_INITIAL_SSTHRESH);
+
+  cc_ack_t ack = ack_of(MSS, 0);
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd == 2 * MSS);
+  // an ACK covering 4 segments counts for 2
+  ack = ack_of(4 * MSS, 0);
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd == 4 * MSS);
+  // nothing was in flight but one segment : the window did not limit sending
+  ack = ack_of(MSS, 0);
+  cc.cwnd = 8 * MSS;
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd == 8 * MSS);
+
+  // congestion avoidance : a window of ACKs for one MSS
+  uint64_t now_us = 0;
+  cc.cwnd = cc.ssthresh = 10 * MSS;
+  ack_round(&cc, &now_us, 10000);
+  CHECK(cc.cwnd == 11 * MSS);
+  cc_destroy(&cc);
+}
+
+static void test_reno_loss() {
+  cc_t cc;
+  CHECK(cc_init(&cc, "reno", MSS) == 0);
+  cc.cwnd = 20 * MSS;
+  cc_on_loss(&cc, 20 * MSS);
+  CHECK(cc.ssthresh == 10 * MSS);
+  // the 3 duplicate ACKs, then one more, are segments that left
+  CHECK(cc.cwnd == 13 * MSS);
+  cc_on_dupack(&cc, 4, 20 * MSS);
+  CHECK(cc.cwnd == 14 * MSS);
+  // a partial ACK deflates by what it acknowledged, plus the segment resent
+  cc_ack_t ack = ack_of(4 * MSS, 16 * MSS);
+  ack.recovery = CC_RECOVERY_PARTIAL;
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd == 11 * MSS);
+  ack = ack_of(4 * MSS, 0);
+  ack.recovery = CC_RECOVERY_DONE;
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd == 10 * MSS);
+
+  // with SACK, 'inflight' already leaves out what left
+  cc.sack = true;
+  cc_on_loss(&cc, 10 * MSS);
+  CHECK(cc.cwnd == 5 * MSS && cc.ssthresh == 5 * MSS);
+  cc_on_dupack(&cc, 4, 10 * MSS);
+  CHECK(cc.cwnd == 5 * MSS);
+
+  // never below 2 MSS, and one MSS after a timeout
+  cc_on_rto(&cc, MSS);
+  CHECK(cc.ssthresh == 2 * MSS && cc.cwnd == MSS);
+  cc_destroy(&cc);
+}
+
+// cwnd 'rounds' RTTs after a loss at 100 segments, on a path of 'rtt_us'
+static uint32_t cwnd_after_loss(const char* name, int rounds, uint32_t rtt_us) {
+  cc_t cc;
+  uint64_t now_us = 1000000;
+  CHECK(cc_init(&cc, name, MSS) == 0);
+  cc.sack = true;
+  cc.cwnd = 100 * MSS;
+  cc.ssthresh = 50 * MSS;
+  cc_on_loss(&cc, 100 * MSS);
+  cc_ack_t ack = ack_of(MSS, 0);
+  ack.recovery = CC_RECOVERY_DONE;
+  ack.now_us = now_us;
+  cc_on_ack(&cc, &ack);
+  for (int i = 0; i < rounds; i++) {
+    ack_round(&cc, &now_us, rtt_us);
+  }
+  uint32_t cwnd = cc.cwnd;
+  cc_destroy(&cc);
+  return cwnd;
+}
+
+static void test_cubic() {
+  cc_t cc;
+  CHECK(cc_init(&cc, "cubic", MSS) == 0);
+  cc.sack = true;
+  cc.cwnd = 100 * MSS;
+  cc_on_loss(&cc, 100 * MSS);
+  CHECK(cc.ssthresh == 70 * MSS && cc.cwnd == 70 * MSS);
+  cc_on_rto(&cc, 70 * MSS);
+  CHECK(cc.cwnd == MSS && cc.ssthresh == 49 * MSS);
+  cc_destroy(&cc);
+
+  // 4 s after the loss, about the time the cubic function takes to get back
+  // to 100 segments from 70; reno only gained 40 from 50
+  uint32_t cubic = cwnd_after_loss("cubic", 40, 100000);
+  uint32_t reno = cwnd_after_loss("reno", 40, 100000);
+  CHECK(reno == 90 * MSS);
+  CHECK(cubic >= 95 * MSS && cubic <= 105 * MSS);
+}
+
+static void test_hystart() {
+  cc_t cc;
+  uint64_t now_us = 0;
+  CHECK(cc_init(&cc, "cubic", MSS) == 0);
+  // slow start on a steady RTT doubles the window each round, past the
+  // HyStart low window
+  for (int i = 0; i < 4; i++) {
+    ack_round(&cc, &now_us, 10000);
+  }
+  CHECK(cc.cwnd == 16 * MSS && cc.ssthresh == WINDOW_INITIAL_SSTHRESH);
+  // a round 10 ms slower ends it
+  for (int i = 0; i < 2 && cc.cwnd < cc.ssthresh; i++) {
+    ack_round(&cc, &now_us, 20000);
+  }
+  CHECK(cc.ssthresh < WINDOW_INITIAL_SSTHRESH && cc.cwnd == cc.ssthresh);
+  cc_destroy(&cc);
+}
+
+// a path of BW bytes a second and 10 ms of RTT
+#define BW 1000000
+#define RTT_US 10000
+
+// acknowledges a window over the path above, the sender going at the lower of
+// its pacing rate and a window per RTT, as the send buffer samples it
+static void bbr_round(cc_t* cc, uint64_t* now_us, uint64_t* delivered) {
+  uint32_t segs = cc->cwnd / cc->mss;
+  for (uint32_t i = 0; i < segs; i++) {
+    uint64_t rate =
+        MIN(cc_pacing_rate(cc), (uint64_t)cc->cwnd * 1000000 / RTT_US);
+    uint64_t delivery_rate = MIN(rate, BW);
+    uint32_t inflight = (uint32_t)MIN(cc->cwnd, rate * RTT_US / 1000000);
+    cc_ack_t ack = ack_of(cc->mss, inflight > cc->mss ? inflight - cc->mss : 0);
+    *delivered += cc->mss;
+    *now_us += (uint64_t)cc->mss * 1000000 / delivery_rate;
+    ack.rtt_us = RTT_US;
+    ack.now_us = *now_us;
+    ack.delivered = *delivered;
+    ack.prior_delivered = *delivered - MIN(*delivered, inflight);
+    ack.interval_us = RTT_US;
+    ack.delivery_rate = delivery_rate;
+    cc_on_ack(cc, &ack);
+  }
+}
+
+static void test_bbr() {
+  cc_t cc;
+  uint64_t now_us = 1000000;
+  uint64_t delivered = 0;
+  CHECK(cc_init(&cc, "bbr", MSS) == 0);
+  CHECK(cc.ssthresh == UINT32_MAX);
+  CHECK(cc_pacing_rate(&cc) > 0);
+
+  for (int i = 0; i < 50; i++) {
+    bbr_round(&cc, &now_us, &delivered);
+  }
+  // probe-bw : the pacing gain cycles between 0.75 and 1.25
+  uint64_t rate = cc_pacing_rate(&cc);
+  CHECK(rate >= BW * 3 / 4 && rate <= BW * 5 / 4);
+  uint32_t bdp = (uint32_t)((uint64_t)BW * RTT_US / 1000000);
+  CHECK(cc.cwnd <= 2 * bdp + 3 * MSS);
+  CHECK(cc.cwnd >= bdp);
+
+  // a loss holds the window at what is in flight, the end of the recovery
+  // gives it back
+  uint32_t cwnd = cc.cwnd;
+  cc_on_loss(&cc, 10 * MSS);
+  CHECK(cc.cwnd == 11 * MSS);
+  cc_ack_t ack = ack_of(MSS, 10 * MSS);
+  ack.recovery = CC_RECOVERY_DONE;
+  ack.now_us = now_us;
+  ack.delivered = delivered;
+  cc_on_ack(&cc, &ack);
+  CHECK(cc.cwnd >= cwnd);
+  cc_destroy(&cc);
+}
+
+int main() {
+  test_interface();
+  test_none();
+  test_reno_growth();
+  test_reno_loss();
+  test_cubic();
+  test_hystart();
+  test_bbr();
+  if (failed) {
+    fprintf(stderr, "test_congestion: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_congestion: all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/**
+ * This file checks the keyed hash and the SYN cookies of CMU-TCP.
+ *
+ *   - SipHash-2-4 against the known-answer vectors of the reference
+ *     implementation (key 00..0f, messages 00, 01, 02, ...)
+ *   - a SYN cookie round trip for every MSS size, with and without SACK, and
+ *     without window scale or with each shift
+ *   - a cookie is refused once SYNCOOKIE_MAX_AGE ticks old, for another
+ *     address, port or ISN, or with a bit of its hash changed
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_cookies
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmu_packet.h"
+#include "extension.h"
+#include "grading.h"
+#include "siphash.h"
+#include "syncookie.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+// every size a cookie can hold, in the order of the cookie's MSS bits
+static const uint16_t mss_sizes[] = {
+    0, MSS, 2048, 4096, 8192, 16384, 32768, MAX_MSS,
+};
+
+static void test_siphash() {
+  // key 00 01 .. 0f, little endian
+  const uint64_t key[2] = {0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull};
+  uint8_t msg[15];
+  for (uint8_t i = 0; i < sizeof(msg); i++) {
+    msg[i] = i;
+  }
+  CHECK(siphash_keyed(key, msg, 0) == 0x726fdb47dd0e0e31ull);
+  CHECK(siphash_keyed(key, msg, 1) == 0x74f839c593dc67fdull);
+  CHECK(siphash_keyed(key, msg, 7) == 0xab0200f58b01d137ull);
+  CHECK(siphash_keyed(key, msg, 8) == 0x93f5f5799a932462ull);
+  CHECK(siphash_keyed(key, msg, 15) == 0xa129ca6149be45e5ull);
+
+  // the process key stays the same from one call to the next
+  CHECK(siphash(msg, sizeof(msg)) == siphash(msg, sizeof(msg)));
+}
+
+static void make_client(struct sockaddr_in *client) {
+  memset(client, 0, sizeof(*client));
+  client->sin_family = AF_INET;
+  client->sin_addr.s_addr = inet_addr("10.0.0.1");
+  client->sin_port = htons(15441);
+}
+
+static void test_round_trip() {
+  struct sockaddr_in client;
+  make_client(&client);
+  uint64_t now_us = 1000 * SYNCOOKIE_PERIOD_US;
+  uint32_t client_isn = 0xdeadbeef;
+
+  for (size_t m = 0; m < sizeof(mss_sizes) / sizeof(mss_sizes[0]); m++) {
+    for (int sack = 0; sack <= 1; sack++) {
+      // -1 : no window scale option
+      for (int wscale = -1; wscale <= EXT_MAX_WINDOW_SCALE; wscale++) {
+        ext_opts_t syn;
+        memset(&syn, 0, sizeof(syn));
+        syn.mss = mss_sizes[m];
+        syn.sack_permitted = sack;
+        syn.has_wscale = wscale >= 0;
+        syn.wscale = wscale >= 0 ? (uint8_t)wscale : 0;
+
+        uint32_t cookie = syncookie_make(&client, client_isn, &syn, now_us);
+        ext_opts_t taken;
+        memset(&taken, 0xff, sizeof(taken));
+        CHECK(syncookie_check(&client, client_isn, cookie, now_us, &taken));
+        CHECK(taken.mss == syn.mss);
+        CHECK(taken.sack_permitted == syn.sack_permitted);
+        CHECK(taken.has_wscale == syn.has_wscale);
+        CHECK(taken.wscale == syn.wscale);
+      }
+    }
+  }
+}
+
+static void test_mss_rounding() {
+  struct sockaddr_in client;
+  make_client(&client);
+  uint64_t now_us = 1000 * SYNCOOKIE_PERIOD_US;
+  // offers between two sizes are rounded down, offers below MSS taken as MSS
+  const uint16_t offers[][2] = {
+      {536, MSS}, {MSS + 1, MSS}, {3000, 2048}, {9000, 8192}, {65535, MAX_MSS},
+  };
+  for (size_t i = 0; i < sizeof(offers) / sizeof(offers[0]); i++) {
+    ext_opts_t syn;
+    memset(&syn, 0, sizeof(syn));
+    syn.mss = offers[i][0];
+    uint32_t cookie = syncookie_make(&client, 1, &syn, now_us);
+    ext_opts_t taken;
+    CHECK(syncookie_check(&client, 1, cookie, now_us, &taken));
+    CHECK(taken.mss == offers[i][1]);
+  }
+}
+
+static void test_rejected() {
+  struct sockaddr_in client;
+  make_client(&client);
+  uint64_t now_us = 1000 * SYNCOOKIE_PERIOD_US;
+  uint32_t client_isn = 0xdeadbeef;
+  ext_opts_t syn;
+  memset(&syn, 0, sizeof(syn));
+  syn.mss = MSS;
+  syn.sack_permitted = true;
+  syn.has_wscale = true;
+  syn.wscale = 7;
+  uint32_t cookie = syncookie_make(&client, client_isn, &syn, now_us);
+  ext_opts_t taken;
+
+  // valid up to the end of the last tick of its life, not after
+  uint64_t last_us = now_us + SYNCOOKIE_MAX_AGE * SYNCOOKIE_PERIOD_US - 1;
+  CHECK(syncookie_check(&client, client_isn, cookie, last_us, &taken));
+  CHECK(!syncookie_check(&client, client_isn, cookie, last_us + 1, &taken));
+  CHECK(!syncookie_check(&client, client_isn, cookie,
+                         now_us + 10 * SYNCOOKIE_PERIOD_US, &taken));
+  // nor before it was made
+  CHECK(!syncookie_check(&client, client_isn, cookie,
+                         now_us - SYNCOOKIE_PERIOD_US, &taken));
+
+  struct sockaddr_in other = client;
+  other.sin_addr.s_addr = inet_addr("10.0.0.2");
+  CHECK(!syncookie_check(&other, client_isn, cookie, now_us, &taken));
+  other = client;
+  other.sin_port = htons(15442);
+  CHECK(!syncookie_check(&other, client_isn, cookie, now_us, &taken));
+  CHECK(!syncookie_check(&client, client_isn + 1, cookie, now_us, &taken));
+
+  // nor with a bit of its hash changed; a change to the other fields is
+  // caught by the hash as well, but only with probability 1 - 2^-19 under a
+  // random key, like the wrong address, port and ISN above
+  int accepted = 0;
+  for (int bit = 0; bit < 19; bit++) {
+    accepted += syncookie_check(&client, client_isn, cookie ^ (1u << bit),
+                                now_us, &taken);
+  }
+  CHECK(accepted == 0);
+  CHECK(!syncookie_check(&client, client_isn, cookie ^ (1u << 23), now_us,
+                         &taken));
+}
+
+static void test_mode() {
+  unsetenv(SYNCOOKIE_ENV);
+  CHECK(syncookie_mode() == SYNCOOKIE_WHEN_BUSY);
+  setenv(SYNCOOKIE_ENV, "0", 1);
+  CHECK(syncookie_mode() == SYNCOOKIE_NEVER);
+  setenv(SYNCOOKIE_ENV, "2", 1);
+  CHECK(syncookie_mode() == SYNCOOKIE_ALWAYS);
+  setenv(SYNCOOKIE_ENV, "7", 1);
+  CHECK(syncookie_mode() == SYNCOOKIE_ALWAYS);
+  setenv(SYNCOOKIE_ENV, "-1", 1);
+  CHECK(syncookie_mode() == SYNCOOKIE_NEVER);
+  unsetenv(SYNCOOKIE_ENV);
+}
+
+int main() {
+  test_siphash();
+  test_round_trip();
+  test_mss_rounding();
+  test_rejected();
+  test_mode();
+  if (failed) {
+    fprintf(stderr, "test_cookies: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_cookies: all checks passed\n");
+  return EXIT_SUCCESS;
+}
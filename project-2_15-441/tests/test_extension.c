@@ -0,0 +1,203 @@
+/**
+ * This file checks the parsing of CMU-TCP header extensions (options).
+ *
+ *   - each option the ext_put_* functions write parses back to its value
+ *   - options cut short, running past the data, or with a length under 2 are
+ *     refused
+ *   - options of a known kind but a length that does not fit it, unknown
+ *     options, and fast open cookies out of [4, 16] bytes are skipped
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_extension
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extension.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+static void test_empty() {
+  ext_opts_t opts;
+  memset(&opts, 0xff, sizeof(opts));
+  CHECK(ext_parse(NULL, 0, &opts) == 0);
+  CHECK(opts.mss == 0 && !opts.has_wscale && !opts.has_timestamp);
+  CHECK(!opts.sack_permitted && opts.sack_count == 0 && !opts.has_fastopen);
+}
+
+static void test_round_trip() {
+  const uint8_t cookie[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  uint8_t buf[64];
+  uint16_t len = 0;
+  len = ext_put_mss(buf, len, 1365);
+  len = ext_put_window_scale(buf, len, 7);
+  len = ext_put_sack_permitted(buf, len);
+  len = ext_put_timestamp(buf, len, 0x01020304, 0x05060708);
+  len = ext_put_fastopen(buf, len, cookie, sizeof(cookie));
+  CHECK(len == EXT_MSS_LEN + EXT_WINDOW_SCALE_LEN + EXT_SACK_PERMITTED_LEN +
+                   EXT_TIMESTAMP_LEN + 2 + sizeof(cookie));
+
+  ext_opts_t opts;
+  CHECK(ext_parse(buf, len, &opts) == 0);
+  CHECK(opts.mss == 1365);
+  CHECK(opts.has_wscale && opts.wscale == 7);
+  CHECK(opts.sack_permitted);
+  CHECK(opts.has_timestamp);
+  CHECK(opts.ts_val == 0x01020304 && opts.ts_ecr == 0x05060708);
+  CHECK(opts.has_fastopen && opts.fastopen_len == sizeof(cookie));
+  CHECK(memcmp(opts.fastopen_cookie, cookie, sizeof(cookie)) == 0);
+
+  // a fast open request carries no cookie
+  len = ext_put_fastopen(buf, 0, NULL, 0);
+  CHECK(ext_parse(buf, len, &opts) == 0);
+  CHECK(opts.has_fastopen && opts.fastopen_len == 0);
+
+  len = ext_put_probe(buf, 0, EXT_KIND_PROBE, 9000);
+  len = ext_put_probe(buf, len, EXT_KIND_PROBE_ACK, 4000);
+  CHECK(ext_parse(buf, len, &opts) == 0);
+  CHECK(opts.probe == 9000 && opts.probe_ack == 4000);
+}
+
+static void test_sack() {
+  const sack_block_t blocks[5] = {
+      {100, 200}, {300, 400}, {500, 600}, {700, 800}, {900, 1000},
+  };
+  uint8_t buf[64];
+  ext_opts_t opts;
+
+  // as many blocks as fit in 'room'
+  uint16_t len = ext_put_sack(buf, 0, EXT_MAX_LEN, blocks, 5);
+  CHECK(len == 2 + EXT_MAX_SACK_BLOCKS * EXT_SACK_BLOCK_LEN);
+  CHECK(ext_parse(buf, len, &opts) == 0);
+  CHECK(opts.sack_count == EXT_MAX_SACK_BLOCKS);
+  for (int i = 0; i < EXT_MAX_SACK_BLOCKS; i++) {
+    CHECK(opts.sack[i].start == blocks[i].start);
+    CHECK(opts.sack[i].end == blocks[i].end);
+  }
+  CHECK(ext_put_sack(buf, 0, 2 + EXT_SACK_BLOCK_LEN - 1, blocks, 5) == 0);
+
+  // more blocks than are kept : the first ones are
+  buf[0] = EXT_KIND_SACK;
+  buf[1] = 2 + 5 * EXT_SACK_BLOCK_LEN;
+  memset(buf + 2, 0, 5 * EXT_SACK_BLOCK_LEN);
+  CHECK(ext_parse(buf, buf[1], &opts) == 0);
+  CHECK(opts.sack_count == EXT_MAX_SACK_BLOCKS);
+
+  // a length that is not a whole number of blocks : skipped
+  buf[1] = 2 + EXT_SACK_BLOCK_LEN + 1;
+  CHECK(ext_parse(buf, buf[1], &opts) == 0);
+  CHECK(opts.sack_count == 0);
+}
+
+static void test_truncated() {
+  uint8_t buf[64];
+  uint16_t len = 0;
+  uint16_t ends[8];
+  int num_ends = 0;
+  len = ext_put_mss(buf, len, 1365);
+  ends[num_ends++] = len;
+  len = ext_put_timestamp(buf, len, 1, 2);
+  ends[num_ends++] = len;
+  len = ext_put_window_scale(buf, len, 3);
+  ends[num_ends++] = len;
+  len = ext_put_sack_permitted(buf, len);
+  ends[num_ends++] = len;
+
+  // every cut but one between two options leaves an option running past it
+  for (uint16_t cut = 1; cut <= len; cut++) {
+    int whole = 0;
+    for (int i = 0; i < num_ends; i++) {
+      whole |= cut == ends[i];
+    }
+    ext_opts_t opts;
+    int ret = ext_parse(buf, cut, &opts);
+    if (whole) {
+      CHECK(ret == 0);
+    } else {
+      CHECK(ret == -1);
+    }
+  }
+}
+
+static void test_bad_length() {
+  ext_opts_t opts;
+  // a length under 2 would not move past the option
+  const uint8_t zero[] = {EXT_KIND_MSS, 0, 0, 0};
+  CHECK(ext_parse(zero, sizeof(zero), &opts) == -1);
+  const uint8_t one[] = {99, 1, 0, 0};
+  CHECK(ext_parse(one, sizeof(one), &opts) == -1);
+  // a length past the data
+  const uint8_t past[] = {EXT_KIND_TIMESTAMP, EXT_TIMESTAMP_LEN, 0, 0, 0, 0};
+  CHECK(ext_parse(past, sizeof(past), &opts) == -1);
+  const uint8_t huge[] = {99, 255, 0, 0};
+  CHECK(ext_parse(huge, sizeof(huge), &opts) == -1);
+  // a kind with no length
+  const uint8_t lone[] = {EXT_KIND_SACK_PERMITTED, 2, EXT_KIND_MSS};
+  CHECK(ext_parse(lone, sizeof(lone), &opts) == -1);
+}
+
+static void test_skipped() {
+  ext_opts_t opts;
+  // known kinds with a length that does not fit them, and an unknown kind,
+  // all followed by an option that still counts
+  // clang-format off
+  const uint8_t odd[] = {
+      EXT_KIND_MSS, 6, 0x05, 0x55, 0, 0,
+      EXT_KIND_TIMESTAMP, 4, 0, 1,
+      EXT_KIND_WINDOW_SCALE, 4, 7, 0,
+      EXT_KIND_SACK_PERMITTED, 3, 0,
+      99, 5, 1, 2, 3,
+      EXT_KIND_MSS, EXT_MSS_LEN, 0x02, 0x00,
+  };
+  // clang-format on
+  CHECK(ext_parse(odd, sizeof(odd), &opts) == 0);
+  CHECK(opts.mss == 0x200);
+  CHECK(!opts.has_timestamp && !opts.has_wscale && !opts.sack_permitted);
+
+  // a shift past the largest is taken as the largest
+  const uint8_t shift[] = {EXT_KIND_WINDOW_SCALE, EXT_WINDOW_SCALE_LEN, 30};
+  CHECK(ext_parse(shift, sizeof(shift), &opts) == 0);
+  CHECK(opts.has_wscale && opts.wscale == EXT_MAX_WINDOW_SCALE);
+
+  // fast open cookies too short or too long for opts.fastopen_cookie
+  uint8_t fastopen[2 + EXT_FASTOPEN_MAX_COOKIE + 1];
+  memset(fastopen, 0xab, sizeof(fastopen));
+  fastopen[0] = EXT_KIND_FASTOPEN;
+  for (uint8_t cookie_len = 1; cookie_len <= EXT_FASTOPEN_MAX_COOKIE + 1;
+       cookie_len++) {
+    fastopen[1] = 2 + cookie_len;
+    CHECK(ext_parse(fastopen, fastopen[1], &opts) == 0);
+    if (cookie_len < EXT_FASTOPEN_MIN_COOKIE ||
+        cookie_len > EXT_FASTOPEN_MAX_COOKIE) {
+      CHECK(!opts.has_fastopen);
+    } else {
+      CHECK(opts.has_fastopen && opts.fastopen_len == cookie_len);
+    }
+  }
+}
+
+int main() {
+  test_empty();
+  test_round_trip();
+  test_sack();
+  test_truncated();
+  test_bad_length();
+  test_skipped();
+  if (failed) {
+    fprintf(stderr, "test_extension: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_extension: all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/**
+ * This file checks the fast open cookies and cookie cache of CMU-TCP.
+ *
+ *   - a cookie is FASTOPEN_COOKIE_LEN bytes, the same for every port of an
+ *     address, and refused for another address, at another length, or with a
+ *     bit changed
+ *   - the cache keeps a cookie by server address and port until it is dropped
+ *     or replaced, and ignores empty and oversized cookies
+ *   - a full cache replaces its FASTOPEN_CACHE_SIZE entries in turn
+ *   - fast open is off unless CMU_TCP_FASTOPEN turns it on
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_fastopen
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extension.h"
+#include "fastopen.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+static void make_addr(struct sockaddr_in* addr, const char* ip, uint16_t port) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = inet_addr(ip);
+  addr->sin_port = htons(port);
+}
+
+static void test_cookie() {
+  struct sockaddr_in client;
+  make_addr(&client, "10.0.0.1", 15441);
+  uint8_t cookie[FASTOPEN_COOKIE_LEN];
+  fastopen_cookie(&client, cookie);
+  CHECK(fastopen_cookie_valid(&client, cookie, FASTOPEN_COOKIE_LEN));
+
+  // a client keeps its cookie from one port to the next
+  struct sockaddr_in other;
+  make_addr(&other, "10.0.0.1", 15442);
+  CHECK(fastopen_cookie_valid(&other, cookie, FASTOPEN_COOKIE_LEN));
+  make_addr(&other, "10.0.0.2", 15441);
+  CHECK(!fastopen_cookie_valid(&other, cookie, FASTOPEN_COOKIE_LEN));
+
+  CHECK(!fastopen_cookie_valid(&client, cookie, 0));
+  CHECK(!fastopen_cookie_valid(&client, cookie, FASTOPEN_COOKIE_LEN - 1));
+  for (int bit = 0; bit < 8 * FASTOPEN_COOKIE_LEN; bit++) {
+    cookie[bit / 8] ^= 1 << (bit % 8);
+    CHECK(!fastopen_cookie_valid(&client, cookie, FASTOPEN_COOKIE_LEN));
+    cookie[bit / 8] ^= 1 << (bit % 8);
+  }
+}
+
+static void test_cache() {
+  const uint8_t cookie[EXT_FASTOPEN_MAX_COOKIE] = {1, 2, 3, 4, 5, 6, 7, 8};
+  struct sockaddr_in server;
+  make_addr(&server, "10.0.1.1", 15441);
+  uint8_t got[EXT_FASTOPEN_MAX_COOKIE];
+  CHECK(fastopen_cache_get(&server, got) == 0);
+
+  fastopen_cache_put(&server, cookie, 8);
+  CHECK(fastopen_cache_get(&server, got) == 8);
+  CHECK(memcmp(got, cookie, 8) == 0);
+  // by address and port
+  struct sockaddr_in other;
+  make_addr(&other, "10.0.1.1", 15442);
+  CHECK(fastopen_cache_get(&other, got) == 0);
+  make_addr(&other, "10.0.1.2", 15441);
+  CHECK(fastopen_cache_get(&other, got) == 0);
+
+  // a new cookie replaces the old one
+  fastopen_cache_put(&server, cookie + 4, 4);
+  CHECK(fastopen_cache_get(&server, got) == 4);
+  CHECK(memcmp(got, cookie + 4, 4) == 0);
+  fastopen_cache_put(&server, cookie, 0);
+  fastopen_cache_put(&server, cookie, EXT_FASTOPEN_MAX_COOKIE + 1);
+  CHECK(fastopen_cache_get(&server, got) == 4);
+
+  fastopen_cache_drop(&server);
+  CHECK(fastopen_cache_get(&server, got) == 0);
+  fastopen_cache_drop(&server);
+}
+
+static void test_cache_full() {
+  const uint8_t cookie[FASTOPEN_COOKIE_LEN] = {0};
+  struct sockaddr_in server;
+  uint8_t got[EXT_FASTOPEN_MAX_COOKIE];
+  for (uint16_t port = 0; port < FASTOPEN_CACHE_SIZE; port++) {
+    make_addr(&server, "10.0.2.1", port);
+    fastopen_cache_put(&server, cookie, sizeof(cookie));
+  }
+  for (uint16_t port = 0; port < FASTOPEN_CACHE_SIZE; port++) {
+    make_addr(&server, "10.0.2.1", port);
+    CHECK(fastopen_cache_get(&server, got) == sizeof(cookie));
+  }
+
+  // two more servers take the place of two of the first ones
+  for (uint16_t port = FASTOPEN_CACHE_SIZE; port < FASTOPEN_CACHE_SIZE + 2;
+       port++) {
+    make_addr(&server, "10.0.2.1", port);
+    fastopen_cache_put(&server, cookie, sizeof(cookie));
+    CHECK(fastopen_cache_get(&server, got) == sizeof(cookie));
+  }
+  int kept = 0;
+  for (uint16_t port = 0; port < FASTOPEN_CACHE_SIZE; port++) {
+    make_addr(&server, "10.0.2.1", port);
+    kept += fastopen_cache_get(&server, got) != 0;
+  }
+  CHECK(kept == FASTOPEN_CACHE_SIZE - 2);
+}
+
+static void test_enabled() {
+  unsetenv(FASTOPEN_ENV);
+  CHECK(!fastopen_enabled());
+  setenv(FASTOPEN_ENV, "1", 1);
+  CHECK(fastopen_enabled());
+  setenv(FASTOPEN_ENV, "0", 1);
+  CHECK(!fastopen_enabled());
+  unsetenv(FASTOPEN_ENV);
+}
+
+int main() {
+  test_cookie();
+  test_cache();
+  test_cache_full();
+  test_enabled();
+  if (failed) {
+    fprintf(stderr, "test_fastopen: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_fastopen: all checks passed\n");
+  return EXIT_SUCCESS;
+}
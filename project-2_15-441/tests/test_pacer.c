@@ -0,0 +1,119 @@
+/**
+ * This file checks the token bucket pacer of CMU-TCP.
+ *
+ *   - no rate, no delay; a first rate starts with a full bucket
+ *   - segments go out back to back as far as the bucket holds them, then one
+ *     every len / rate, and an idle pacer saves up no more than the bucket
+ *   - CMU_SO_MAX_PACING_RATE caps the rate the algorithm asks, paces alone
+ *     when the algorithm asks none, and lifting it restores the asked rate
+ *   - a segment larger than the bucket goes out once the bucket is full
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_pacer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pacer.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+#define SEG 1000
+// one segment a millisecond
+#define RATE 1000000
+
+static void test_idle() {
+  pacer_t pacer;
+  pacer_init(&pacer, SEG);
+  CHECK(!pacer_active(&pacer));
+  CHECK(pacer_delay_us(&pacer, SEG, 0) == 0);
+  pacer_consume(&pacer, 100 * SEG, 0);
+  CHECK(pacer_delay_us(&pacer, SEG, 0) == 0);
+
+  // asking for no rate leaves it off
+  pacer_set_rate(&pacer, 0, 0);
+  CHECK(!pacer_active(&pacer));
+}
+
+static void test_spacing() {
+  pacer_t pacer;
+  uint64_t now = 1000000;
+  pacer_init(&pacer, SEG);
+  pacer_set_rate(&pacer, RATE, now);
+  CHECK(pacer_active(&pacer) && pacer.rate == RATE);
+
+  // the bucket holds PACER_MIN_BURST_SEGMENTS segments at this rate
+  for (int i = 0; i < PACER_MIN_BURST_SEGMENTS; i++) {
+    CHECK(pacer_delay_us(&pacer, SEG, now) == 0);
+    pacer_consume(&pacer, SEG, now);
+  }
+  CHECK(pacer_delay_us(&pacer, SEG, now) == 1000);
+  CHECK(pacer_delay_us(&pacer, SEG, now + 400) == 600);
+  CHECK(pacer_delay_us(&pacer, SEG, now + 1000) == 0);
+  pacer_consume(&pacer, SEG, now + 1000);
+  CHECK(pacer_delay_us(&pacer, SEG, now + 1000) == 1000);
+
+  // a long idle time fills the bucket, no more
+  now += 10 * 1000000;
+  for (int i = 0; i < PACER_MIN_BURST_SEGMENTS; i++) {
+    CHECK(pacer_delay_us(&pacer, SEG, now) == 0);
+    pacer_consume(&pacer, SEG, now);
+  }
+  CHECK(pacer_delay_us(&pacer, SEG, now) > 0);
+}
+
+static void test_max_rate() {
+  pacer_t pacer;
+  pacer_init(&pacer, SEG);
+  pacer_set_rate(&pacer, 10 * RATE, 0);
+  pacer_set_max_rate(&pacer, RATE, 0);
+  CHECK(pacer.rate == RATE);
+  // a cap above what the algorithm asks changes nothing
+  pacer_set_max_rate(&pacer, 100 * RATE, 0);
+  CHECK(pacer.rate == 10 * RATE);
+  pacer_set_max_rate(&pacer, 0, 0);
+  CHECK(pacer.rate == 10 * RATE);
+
+  // the cap alone paces
+  pacer_set_rate(&pacer, 0, 0);
+  CHECK(!pacer_active(&pacer));
+  pacer_set_max_rate(&pacer, RATE, 0);
+  CHECK(pacer.rate == RATE);
+  pacer_set_max_rate(&pacer, 0, 0);
+  CHECK(!pacer_active(&pacer));
+}
+
+static void test_large_segment() {
+  pacer_t pacer;
+  uint64_t now = 1000000;
+  uint32_t large = 10 * PACER_MIN_BURST_SEGMENTS * SEG;
+  pacer_init(&pacer, SEG);
+  pacer_set_rate(&pacer, RATE, now);
+  CHECK(pacer_delay_us(&pacer, large, now) == 0);
+  pacer_consume(&pacer, large, now);
+  // the bucket is empty, and takes PACER_MIN_BURST_SEGMENTS ms to fill again
+  CHECK(pacer_delay_us(&pacer, large, now) == PACER_MIN_BURST_SEGMENTS * 1000);
+}
+
+int main() {
+  test_idle();
+  test_spacing();
+  test_max_rate();
+  test_large_segment();
+  if (failed) {
+    fprintf(stderr, "test_pacer: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_pacer: all checks passed\n");
+  return EXIT_SUCCESS;
+}
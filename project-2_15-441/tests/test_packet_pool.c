@@ -0,0 +1,111 @@
+/**
+ * This file checks the packet buffer pool of CMU-TCP.
+ *
+ *   - a buffer of up to PACKET_POOL_SLOT_SIZE bytes is a slot, a larger one
+ *     is malloc'ed; both can be written to their end
+ *   - a freed slot is handed out again by the same thread
+ *   - slots freed by another thread, more than it keeps for itself, go back to
+ *     the shared list and are not lost
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_packet_pool
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_pool.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+// more than a thread keeps, and than a batch
+#define NUM_PKTS (4 * PACKET_POOL_CACHE_MAX)
+
+static void test_sizes() {
+  uint8_t* small = packet_pool_alloc(1);
+  uint8_t* slot = packet_pool_alloc(PACKET_POOL_SLOT_SIZE);
+  uint8_t* large = packet_pool_alloc(MAX_DATAGRAM_LEN);
+  CHECK(small != NULL && slot != NULL && large != NULL);
+  memset(slot, 0xab, PACKET_POOL_SLOT_SIZE);
+  memset(large, 0xcd, MAX_DATAGRAM_LEN);
+  CHECK(slot[PACKET_POOL_SLOT_SIZE - 1] == 0xab);
+  CHECK(large[MAX_DATAGRAM_LEN - 1] == 0xcd);
+  packet_pool_free(small);
+  packet_pool_free(slot);
+  packet_pool_free(large);
+  packet_pool_free(NULL);
+
+  // the last slot freed is the next one out
+  uint8_t* again = packet_pool_alloc(MSS);
+  CHECK(again == slot);
+  packet_pool_free(again);
+}
+
+static void* free_all(void* in) {
+  uint8_t** pkts = (uint8_t**)in;
+  for (int i = 0; i < NUM_PKTS; i++) {
+    packet_pool_free(pkts[i]);
+  }
+  return NULL;
+}
+
+// whether 'pkt' is one of the 'num' buffers of 'pkts'
+static int contains(uint8_t** pkts, int num, const uint8_t* pkt) {
+  for (int i = 0; i < num; i++) {
+    if (pkts[i] == pkt) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void test_threads() {
+  static uint8_t* pkts[NUM_PKTS];
+  static uint8_t* freed[NUM_PKTS];
+  for (int round = 0; round < 3; round++) {
+    int reused = 0;
+    for (int i = 0; i < NUM_PKTS; i++) {
+      pkts[i] = packet_pool_alloc(MSS);
+      CHECK(pkts[i] != NULL);
+      memset(pkts[i], i, MSS);
+      reused += contains(freed, NUM_PKTS, pkts[i]);
+    }
+    // no slot is handed out twice
+    int distinct = 1;
+    for (int i = 0; i < NUM_PKTS; i++) {
+      distinct = distinct && pkts[i][0] == (uint8_t)i;
+    }
+    CHECK(distinct);
+    // the slots the other thread freed came back
+    if (round > 0) {
+      CHECK(reused == NUM_PKTS);
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, free_all, pkts);
+    pthread_join(thread, NULL);
+    memcpy(freed, pkts, sizeof(pkts));
+  }
+}
+
+int main() {
+  test_sizes();
+  test_threads();
+  if (failed) {
+    fprintf(stderr, "test_packet_pool: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_packet_pool: all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/**
+ * This file checks the path MTU discovery of CMU-TCP.
+ *
+ *   - a connection starts with the base MSS; without a search it uses the
+ *     largest size both ends accept at once
+ *   - the first probe tries that largest size; on a narrower path the search
+ *     halves the interval left, sends an unanswered probe PMTU_MAX_PROBES
+ *     times, and ends within PMTU_SEARCH_STEP of the path's size
+ *   - the search starts again PMTU_RAISE_US later, unless the largest size
+ *     got through
+ *   - PMTU_BLACK_HOLE_TIMEOUTS timeouts in a row fall back to the base MSS
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_pmtu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmu_packet.h"
+#include "grading.h"
+#include "pmtu.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+// a probe is answered at once, or taken as lost after this long
+#define PROBE_TIMEOUT_US 1000
+
+// sends the probes due over a path that carries segments of up to 'path_mss'
+// bytes until none is; return how many went out
+static int search(pmtu_t* pmtu, uint32_t path_mss, uint64_t* now_us) {
+  int sent = 0;
+  uint32_t size;
+  while ((size = pmtu_probe_due(pmtu, *now_us)) != 0 && sent < 100) {
+    pmtu_on_probe_sent(pmtu, size, PROBE_TIMEOUT_US, *now_us);
+    sent++;
+    if (size <= path_mss) {
+      CHECK(pmtu_on_probe_ack(pmtu, size, *now_us));
+    } else {
+      *now_us += PROBE_TIMEOUT_US;
+    }
+  }
+  return sent;
+}
+
+static void test_no_search() {
+  pmtu_t pmtu;
+  pmtu_init(&pmtu, MSS);
+  CHECK(pmtu.mss == MSS);
+  CHECK(pmtu_probe_due(&pmtu, 1) == 0);
+
+  pmtu_start(&pmtu, 9000, false, 1);
+  CHECK(pmtu.mss == 9000);
+  CHECK(pmtu_probe_due(&pmtu, 1) == 0);
+
+  // an offer below the base is no reason to go below it
+  pmtu_init(&pmtu, MSS);
+  pmtu_start(&pmtu, 536, true, 1);
+  CHECK(pmtu.mss == MSS && pmtu_probe_due(&pmtu, 1) == 0);
+}
+
+static void test_largest() {
+  pmtu_t pmtu;
+  uint64_t now_us = 1;
+  pmtu_init(&pmtu, MSS);
+  pmtu_start(&pmtu, MAX_MSS, true, now_us);
+  CHECK(pmtu_probe_due(&pmtu, now_us) == MAX_MSS);
+  CHECK(search(&pmtu, MAX_MSS, &now_us) == 1);
+  CHECK(pmtu.mss == MAX_MSS);
+  // nothing larger to search for later
+  CHECK(pmtu.deadline_us == 0);
+}
+
+static void test_narrower_path() {
+  pmtu_t pmtu;
+  uint64_t now_us = 1;
+  uint32_t path_mss = 4000;
+  pmtu_init(&pmtu, MSS);
+  pmtu_start(&pmtu, 9000, true, now_us);
+
+  // the first size is tried PMTU_MAX_PROBES times, then the one halfway
+  uint32_t first = pmtu_probe_due(&pmtu, now_us);
+  CHECK(first == 9000);
+  for (int i = 0; i < PMTU_MAX_PROBES; i++) {
+    CHECK(pmtu_probe_due(&pmtu, now_us) == first);
+    pmtu_on_probe_sent(&pmtu, first, PROBE_TIMEOUT_US, now_us);
+    CHECK(pmtu_probe_due(&pmtu, now_us) == 0);
+    now_us += PROBE_TIMEOUT_US;
+  }
+  CHECK(pmtu_probe_due(&pmtu, now_us) == MSS + (9000 - MSS) / 2);
+
+  search(&pmtu, path_mss, &now_us);
+  CHECK(pmtu.mss <= path_mss && pmtu.mss + PMTU_SEARCH_STEP > path_mss);
+  CHECK(pmtu.deadline_us == now_us + PMTU_RAISE_US);
+
+  // the path got better
+  now_us += PMTU_RAISE_US;
+  search(&pmtu, 9000, &now_us);
+  CHECK(pmtu.mss == 9000);
+
+  // older and foreign probe ACKs change nothing
+  CHECK(!pmtu_on_probe_ack(&pmtu, 4000, now_us));
+  CHECK(!pmtu_on_probe_ack(&pmtu, 9001, now_us));
+  CHECK(pmtu.mss == 9000);
+}
+
+static void test_black_hole() {
+  pmtu_t pmtu;
+  uint64_t now_us = 1;
+  pmtu_init(&pmtu, MSS);
+  pmtu_start(&pmtu, 9000, true, now_us);
+  search(&pmtu, 9000, &now_us);
+  CHECK(pmtu.mss == 9000);
+
+  // an ACK in between : not in a row
+  CHECK(!pmtu_on_timeout(&pmtu, now_us));
+  pmtu_on_ack(&pmtu);
+  CHECK(!pmtu_on_timeout(&pmtu, now_us));
+  CHECK(pmtu.mss == 9000);
+  for (int i = 1; i < PMTU_BLACK_HOLE_TIMEOUTS - 1; i++) {
+    CHECK(!pmtu_on_timeout(&pmtu, now_us));
+  }
+  CHECK(pmtu_on_timeout(&pmtu, now_us));
+  CHECK(pmtu.mss == MSS);
+
+  // and searches again at once
+  search(&pmtu, 2000, &now_us);
+  CHECK(pmtu.mss <= 2000 && pmtu.mss + PMTU_SEARCH_STEP > 2000);
+  // timeouts at the base size are the path's losses, not its MTU
+  pmtu_init(&pmtu, MSS);
+  for (int i = 0; i < PMTU_BLACK_HOLE_TIMEOUTS; i++) {
+    CHECK(!pmtu_on_timeout(&pmtu, now_us));
+  }
+}
+
+static void test_enabled() {
+  unsetenv(PMTU_PROBE_ENV);
+  CHECK(pmtu_probe_enabled());
+  setenv(PMTU_PROBE_ENV, "0", 1);
+  CHECK(!pmtu_probe_enabled());
+  setenv(PMTU_PROBE_ENV, "1", 1);
+  CHECK(pmtu_probe_enabled());
+  unsetenv(PMTU_PROBE_ENV);
+}
+
+int main() {
+  test_no_search();
+  test_largest();
+  test_narrower_path();
+  test_black_hole();
+  test_enabled();
+  if (failed) {
+    fprintf(stderr, "test_pmtu: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_pmtu: all checks passed\n");
+  return EXIT_SUCCESS;
+}
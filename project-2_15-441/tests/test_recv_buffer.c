@@ -0,0 +1,162 @@
+/**
+ * This file checks the reassembly of out-of-order data in recv_buffer_t.
+ *
+ *   - data received out of order is held back until the hole before it is
+ *     filled, then read in order, also where the buffer wraps around
+ *   - a segment that fills a hole and runs into data received after it takes
+ *     that data along
+ *   - segments already read, already received, or past the buffer are refused
+ *   - SACK blocks name the range of the latest segment received out of order
+ *     first, then the other ranges from the lowest up
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_recv_buffer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "recv_buffer.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+// not a multiple of the bitmap's words
+#define CAPACITY 1000
+#define SEG 10
+#define ISN 5000
+// the first byte of data
+#define FIRST (ISN + 1)
+
+static uint8_t pattern(uint32_t seq) { return (uint8_t)(seq * 131u); }
+
+// receive the 'len' bytes from 'seq' on
+static void receive(recv_buffer_t* buf, uint32_t seq, uint32_t len) {
+  uint8_t data[CAPACITY];
+  for (uint32_t i = 0; i < len; i++) {
+    data[i] = pattern(seq + i);
+  }
+  CHECK(recv_buffer_can_receive(buf, seq, len) == 0);
+  recv_buffer_receive(buf, seq, len, data);
+}
+
+// read all the data in order, from 'seq' on; return how much there was
+static uint32_t read_all(recv_buffer_t* buf, uint32_t seq) {
+  uint8_t data[CAPACITY];
+  uint32_t len = recv_buffer_max_read(buf);
+  recv_buffer_read(buf, data, len);
+  for (uint32_t i = 0; i < len; i++) {
+    if (data[i] != pattern(seq + i)) {
+      CHECK(data[i] == pattern(seq + i));
+      break;
+    }
+  }
+  return len;
+}
+
+static void test_reorder() {
+  recv_buffer_t* buf = recv_buffer_create(CAPACITY);
+  recv_buffer_initialize(buf, ISN);
+  CHECK(recv_buffer_max_receive(buf) == CAPACITY - 1);
+  int num_segs = 90;
+  uint32_t seq = FIRST;
+
+  // a window short of the capacity each time, so the buffer wraps around
+  for (int round = 0; round < 5; round++) {
+    for (int i = 1; i < num_segs; i += 2) {
+      receive(buf, seq + i * SEG, SEG);
+      CHECK(recv_buffer_max_read(buf) == 0);
+    }
+    CHECK(recv_buffer_has_ooo(buf));
+    for (int i = 0; i < num_segs; i += 2) {
+      receive(buf, seq + i * SEG, SEG);
+      CHECK(recv_buffer_max_read(buf) == (uint32_t)(i + 2) * SEG);
+    }
+    CHECK(!recv_buffer_has_ooo(buf));
+    CHECK(get_next_byte_expected_seqnum(buf) == seq + num_segs * SEG);
+    CHECK(read_all(buf, seq) == (uint32_t)num_segs * SEG);
+    seq += num_segs * SEG;
+  }
+  recv_buffer_clean(buf);
+}
+
+static void test_overlap() {
+  recv_buffer_t* buf = recv_buffer_create(CAPACITY);
+  recv_buffer_initialize(buf, ISN);
+  receive(buf, FIRST + 20, 10);
+  receive(buf, FIRST + 50, 10);
+  // fills the hole and half of what came after it
+  receive(buf, FIRST, 25);
+  CHECK(get_next_byte_expected_seqnum(buf) == FIRST + 30);
+  CHECK(recv_buffer_has_ooo(buf));
+  receive(buf, FIRST + 30, 20);
+  CHECK(get_next_byte_expected_seqnum(buf) == FIRST + 60);
+  CHECK(!recv_buffer_has_ooo(buf));
+
+  // 3 : in already, 2 : read already, 1 : past the buffer
+  CHECK(recv_buffer_can_receive(buf, FIRST, SEG) == 3);
+  CHECK(read_all(buf, FIRST) == 60);
+  CHECK(recv_buffer_can_receive(buf, FIRST, SEG) == 2);
+  CHECK(recv_buffer_can_receive(buf, FIRST + 60, CAPACITY) == 1);
+  CHECK(recv_buffer_can_receive(buf, FIRST + 60, CAPACITY - 1) == 0);
+  recv_buffer_clean(buf);
+}
+
+static void check_blocks(recv_buffer_t* buf, uint32_t max_blocks,
+                         const uint32_t (*expected)[2], uint32_t count) {
+  sack_block_t blocks[EXT_MAX_SACK_BLOCKS];
+  CHECK(recv_buffer_sack_blocks(buf, blocks, max_blocks) == count);
+  for (uint32_t i = 0; i < count; i++) {
+    CHECK(blocks[i].start == FIRST + expected[i][0]);
+    CHECK(blocks[i].end == FIRST + expected[i][1]);
+  }
+}
+
+static void test_sack_blocks() {
+  recv_buffer_t* buf = recv_buffer_create(CAPACITY);
+  recv_buffer_initialize(buf, ISN);
+  sack_block_t blocks[EXT_MAX_SACK_BLOCKS];
+  CHECK(recv_buffer_sack_blocks(buf, blocks, EXT_MAX_SACK_BLOCKS) == 0);
+
+  receive(buf, FIRST + 10, SEG);
+  receive(buf, FIRST + 30, SEG);
+  receive(buf, FIRST + 70, SEG);
+  receive(buf, FIRST + 90, SEG);
+  receive(buf, FIRST + 50, SEG);
+  const uint32_t latest[][2] = {{50, 60}, {10, 20}, {30, 40}, {70, 80}};
+  check_blocks(buf, 4, latest, 4);
+  // fewer blocks than ranges : the latest still goes first
+  check_blocks(buf, 2, latest, 2);
+  CHECK(recv_buffer_sack_blocks(buf, blocks, 0) == 0);
+
+  // ranges next to each other make one block
+  receive(buf, FIRST + 20, SEG);
+  const uint32_t joined[][2] = {{10, 40}, {50, 60}, {70, 80}};
+  check_blocks(buf, 3, joined, 3);
+
+  // once the latest is in order, the others from the lowest up
+  receive(buf, FIRST, SEG);
+  const uint32_t in_order[][2] = {{50, 60}, {70, 80}, {90, 100}};
+  check_blocks(buf, 3, in_order, 3);
+  recv_buffer_clean(buf);
+}
+
+int main() {
+  test_reorder();
+  test_overlap();
+  test_sack_blocks();
+  if (failed) {
+    fprintf(stderr, "test_recv_buffer: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_recv_buffer: all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/**
+ * This file checks the retransmission timeout estimator of CMU-TCP (RFC 6298).
+ *
+ *   - RTO_INITIAL_US before any sample, then SRTT + 4 * RTTVAR with the first
+ *     sample taken whole and the next ones with gains of 1/8 and 1/4
+ *   - the RTO stays RTO_GRANULARITY_US above SRTT and within [min, max]; the
+ *     minimum may be lowered (CMU_SO_RTO_MIN) and restored with 0
+ *   - each timeout doubles the RTO up to the max, until a sample ends the
+ *     backoff
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_rto
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rto.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+static void test_samples() {
+  rto_t rto;
+  rto_init(&rto);
+  CHECK(rto.srtt_us == 0 && rto.rto_us == RTO_INITIAL_US);
+
+  rto_on_sample(&rto, 100000);
+  CHECK(rto.srtt_us == 100000 && rto.rttvar_us == 50000);
+  CHECK(rto.rto_us == 100000 + 4 * 50000);
+
+  // a steady RTT shrinks RTTVAR by a quarter
+  rto_on_sample(&rto, 100000);
+  CHECK(rto.srtt_us == 100000 && rto.rttvar_us == 37500);
+  CHECK(rto.rto_us == 100000 + 4 * 37500);
+
+  // a longer one moves SRTT by an eighth of the difference
+  rto_on_sample(&rto, 180000);
+  CHECK(rto.srtt_us == 110000);
+  CHECK(rto.rttvar_us == 37500 - 37500 / 4 + 80000 / 4);
+
+  // a sample of 0 counts as 1 us
+  rto_init(&rto);
+  rto_on_sample(&rto, 0);
+  CHECK(rto.srtt_us == 1);
+}
+
+static void test_clamp() {
+  rto_t rto;
+  rto_init(&rto);
+  rto_on_sample(&rto, 1000);
+  CHECK(rto.rto_us == RTO_MIN_US);
+
+  rto_set_min(&rto, 1);
+  CHECK(rto.min_us == 1);
+  // SRTT + 4 * RTTVAR, 1000 + 2000
+  CHECK(rto.rto_us == 3000);
+  rto_set_min(&rto, 0);
+  CHECK(rto.min_us == RTO_MIN_US && rto.rto_us == RTO_MIN_US);
+
+  // RTTVAR small next to the clock granularity
+  rto_set_min(&rto, 1);
+  for (int i = 0; i < 100; i++) {
+    rto_on_sample(&rto, 1000);
+  }
+  CHECK(rto.rto_us == rto.srtt_us + RTO_GRANULARITY_US);
+
+  // a minimum over the max is the max
+  rto_set_min(&rto, RTO_MAX_US + 1);
+  CHECK(rto.min_us == RTO_MAX_US && rto.rto_us == RTO_MAX_US);
+}
+
+static void test_backoff() {
+  rto_t rto;
+  rto_init(&rto);
+  rto_on_sample(&rto, 100000);
+  uint32_t base = rto.rto_us;
+
+  rto_on_timeout(&rto);
+  CHECK(rto.backoff == 1 && rto.rto_us == 2 * base);
+  rto_on_timeout(&rto);
+  CHECK(rto.backoff == 2 && rto.rto_us == 4 * base);
+  // the minimum changes once the backoff ends
+  rto_set_min(&rto, 1);
+  CHECK(rto.rto_us == 4 * base);
+  for (int i = 0; i < 20; i++) {
+    rto_on_timeout(&rto);
+  }
+  CHECK(rto.rto_us == RTO_MAX_US);
+
+  rto_on_sample(&rto, 100000);
+  CHECK(rto.backoff == 0 && rto.rto_us < base);
+}
+
+int main() {
+  test_samples();
+  test_clamp();
+  test_backoff();
+  if (failed) {
+    fprintf(stderr, "test_rto: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_rto: all checks passed\n");
+  return EXIT_SUCCESS;
+}
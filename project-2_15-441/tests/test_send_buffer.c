@@ -0,0 +1,181 @@
+/**
+ * This file checks the retransmission scoreboard of send_buffer_t.
+ *
+ *   - each segment sent is tracked until a cumulative ACK covers it; only
+ *     segments entirely inside a SACK block are marked sacked
+ *   - the first segment is marked lost only if it was sent once; sending a
+ *     lost segment again puts it back in flight
+ *   - after a timeout every segment but the sacked ones is lost, and the sacked
+ *     ones too when the other side may have dropped them
+ *   - the bytes in flight leave out the sacked and lost ones, also after a
+ *     partial ACK
+ *   - RACK marks a segment lost once one sent after it was delivered and its
+ *     RTT plus the reordering window have passed, and a retransmission
+ *     acknowledged sooner than the lowest RTT is not taken as delivered
+ *
+ * Prints each failed check and exits with a failure status if there is one.
+ *
+ * Usage: test_send_buffer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "send_buffer.h"
+
+#define CHECK(COND)                                                            \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+      failed++;                                                                \
+    }                                                                          \
+  } while (0)
+
+static int failed = 0;
+
+#define CAPACITY 65536
+#define SEG 1000
+#define NUM_SEGS 10
+#define ISN 5000
+// the first byte of data
+#define FIRST (ISN + 1)
+
+static send_buffer_t* make_buffer() {
+  static uint8_t data[NUM_SEGS * SEG];
+  send_buffer_t* buf = send_buffer_create(CAPACITY);
+  send_buffer_initialize(buf, ISN);
+  send_buffer_write(buf, data, sizeof(data));
+  return buf;
+}
+
+// put segment 'i' on the wire at 'now_us'
+static void send_seg(send_buffer_t* buf, int i, uint64_t now_us) {
+  uint8_t data[SEG];
+  uint32_t seq = FIRST + i * SEG;
+  send_buffer_dump(buf, seqnum_to_index_send(buf, seq), SEG, data);
+  send_buffer_on_send(buf, seq, SEG, now_us);
+}
+
+// the SACK block of segments 'first' to 'last'
+static uint32_t sack(send_buffer_t* buf, int first, int last, uint64_t now_us) {
+  sack_block_t block = {FIRST + first * SEG, FIRST + (last + 1) * SEG};
+  return send_buffer_on_sack(buf, &block, 1, now_us);
+}
+
+static void ack(send_buffer_t* buf, uint32_t hdr_ack, uint64_t now_us) {
+  rate_sample_t rs;
+  send_buffer_ack_segments(buf, hdr_ack, now_us, &rs);
+  send_buffer_update_ack(buf, hdr_ack);
+}
+
+static void test_sack() {
+  send_buffer_t* buf = make_buffer();
+  for (int i = 0; i < NUM_SEGS; i++) {
+    send_seg(buf, i, 1000 + i);
+  }
+  CHECK(send_buffer_in_flight(buf) == NUM_SEGS * SEG);
+
+  CHECK(sack(buf, 3, 4, 2000) == 2 * SEG);
+  CHECK(sack(buf, 3, 4, 2000) == 0);
+  CHECK(buf->sacked_bytes == 2 * SEG);
+  // a block that covers only part of segment 5
+  sack_block_t block = {FIRST + 5 * SEG + SEG / 2, FIRST + 7 * SEG};
+  CHECK(send_buffer_on_sack(buf, &block, 1, 2000) == SEG);
+  CHECK(buf->sacked_bytes == 3 * SEG);
+  CHECK(buf->delivered == 3 * SEG);
+  CHECK(send_buffer_in_flight(buf) == (NUM_SEGS - 3) * SEG);
+
+  uint32_t seq, len;
+  CHECK(send_buffer_last_segment(buf, &seq, &len));
+  CHECK(seq == FIRST + (NUM_SEGS - 1) * SEG && len == SEG);
+  send_buffer_clean(buf);
+}
+
+static void test_lost() {
+  send_buffer_t* buf = make_buffer();
+  for (int i = 0; i < NUM_SEGS; i++) {
+    send_seg(buf, i, 1000 + i);
+  }
+  sack(buf, 3, 4, 2000);
+  sack(buf, 6, 6, 2000);
+
+  uint32_t seq, len;
+  CHECK(!send_buffer_next_lost(buf, &seq, &len));
+  send_buffer_mark_first_lost(buf);
+  CHECK(send_buffer_next_lost(buf, &seq, &len));
+  CHECK(seq == FIRST && len == SEG);
+  CHECK(send_buffer_in_flight(buf) == (NUM_SEGS - 4) * SEG);
+
+  // sent again : in flight, and not to be marked lost a second time
+  send_seg(buf, 0, 3000);
+  CHECK(!send_buffer_next_lost(buf, &seq, &len));
+  send_buffer_mark_first_lost(buf);
+  CHECK(!send_buffer_next_lost(buf, &seq, &len));
+
+  // a timeout : segments 0 to 2, 5 and 7 to 9
+  send_buffer_mark_all_lost(buf, false);
+  CHECK(buf->lost_bytes == 7 * SEG && buf->sacked_bytes == 3 * SEG);
+  CHECK(send_buffer_in_flight(buf) == 0);
+
+  ack(buf, FIRST + 5 * SEG, 4000);
+  CHECK(buf->segments_count == NUM_SEGS - 5);
+  CHECK(buf->lost_bytes == 4 * SEG && buf->sacked_bytes == SEG);
+  // sacked bytes count once
+  CHECK(buf->delivered == 6 * SEG);
+  CHECK(send_buffer_next_lost(buf, &seq, &len));
+  CHECK(seq == FIRST + 5 * SEG);
+
+  send_buffer_mark_all_lost(buf, true);
+  CHECK(buf->lost_bytes == 5 * SEG && buf->sacked_bytes == 0);
+
+  // half of segment 5
+  ack(buf, FIRST + 5 * SEG + SEG / 2, 5000);
+  CHECK(buf->lost_bytes == 5 * SEG - SEG / 2);
+  CHECK(send_buffer_next_lost(buf, &seq, &len));
+  CHECK(seq == FIRST + 5 * SEG + SEG / 2 && len == SEG / 2);
+  CHECK(send_buffer_in_flight(buf) == 0);
+  send_buffer_clean(buf);
+}
+
+static void test_rack() {
+  send_buffer_t* buf = make_buffer();
+  uint64_t wait_us;
+  for (int i = 0; i < 4; i++) {
+    send_seg(buf, i, 1000 + i);
+  }
+  CHECK(send_buffer_rack_mark_lost(buf, 1000, 20000, &wait_us) == 0);
+  CHECK(wait_us == 0);
+
+  // segment 3 is delivered 10 ms after it was sent
+  sack(buf, 3, 3, 11003);
+  CHECK(buf->rack_rtt_us == 10000 && buf->rack_min_rtt_us == 10000);
+  CHECK(send_buffer_rack_mark_lost(buf, 1000, 11003, &wait_us) == 0);
+  // segment 0 is due first
+  CHECK(wait_us == 1000 + 10000 + 1000 - 11003);
+  CHECK(send_buffer_rack_mark_lost(buf, 1000, 12001, &wait_us) == 2 * SEG);
+  CHECK(wait_us == 1);
+  CHECK(send_buffer_rack_mark_lost(buf, 1000, 12002, &wait_us) == SEG);
+  CHECK(wait_us == 0);
+
+  // a retransmission acknowledged too soon : the original got there
+  send_seg(buf, 0, 12100);
+  ack(buf, FIRST + SEG, 12200);
+  CHECK(buf->rack_xmit_us == 1003);
+  // one that took a round trip
+  send_seg(buf, 1, 12300);
+  ack(buf, FIRST + 2 * SEG, 22300);
+  CHECK(buf->rack_xmit_us == 12300 && buf->rack_rtt_us == 10000);
+  send_buffer_clean(buf);
+}
+
+int main() {
+  test_sack();
+  test_lost();
+  test_rack();
+  if (failed) {
+    fprintf(stderr, "test_send_buffer: %d checks failed\n", failed);
+    return EXIT_FAILURE;
+  }
+  printf("test_send_buffer: all checks passed\n");
+  return EXIT_SUCCESS;
+}